@@ -9,6 +9,9 @@ extern "C" {
 SQUIRREL_API SQUserPointer sqstd_createblob(HSQUIRRELVM v, SQInteger size);
 SQUIRREL_API SQRESULT sqstd_getblob(HSQUIRRELVM v,SQInteger idx,SQUserPointer *ptr);
 SQUIRREL_API SQInteger sqstd_getblobsize(HSQUIRRELVM v,SQInteger idx);
+/*pushes a blob over size bytes at p without copying them, hook(p,size) runs once no blob uses them.
+  on failure nothing is pushed, the hook never runs and p stays with the caller*/
+SQUIRREL_API SQRESULT sqstd_createblobview(HSQUIRRELVM v,SQUserPointer p,SQInteger size,SQRELEASEHOOK hook);
 
 SQUIRREL_API SQRESULT sqstd_register_bloblib(HSQUIRRELVM v);
 
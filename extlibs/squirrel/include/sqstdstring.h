@@ -9,6 +9,12 @@ extern "C" {
 typedef unsigned int SQRexBool;
 typedef struct SQRex SQRex;
 
+/*matching engines, sqstd_rex_compile picks SQREX_NFA (linear time) whenever the pattern fits it.
+  The NFA is leftmost-first and gives back characters from greedy repeats, so regexp("a.*b")
+  matches all of "a1b2b"; SQREX_BACKTRACK keeps the old stop-at-first-follower behaviour*/
+#define SQREX_BACKTRACK 0
+#define SQREX_NFA 1
+
 typedef struct {
 	const SQChar *begin;
 	SQInteger len;
@@ -21,6 +27,8 @@ SQUIRREL_API SQBool sqstd_rex_search(SQRex* exp,const SQChar* text, const SQChar
 SQUIRREL_API SQBool sqstd_rex_searchrange(SQRex* exp,const SQChar* text_begin,const SQChar* text_end,const SQChar** out_begin, const SQChar** out_end);
 SQUIRREL_API SQInteger sqstd_rex_getsubexpcount(SQRex* exp);
 SQUIRREL_API SQBool sqstd_rex_getsubexp(SQRex* exp, SQInteger n, SQRexMatch *subexp);
+SQUIRREL_API SQInteger sqstd_rex_getmode(SQRex* exp);
+SQUIRREL_API SQBool sqstd_rex_setmode(SQRex* exp, SQInteger mode);
 
 SQUIRREL_API SQRESULT sqstd_format(HSQUIRRELVM v,SQInteger nformatstringidx,SQInteger *outlen,SQChar **output);
 
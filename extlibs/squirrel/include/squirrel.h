@@ -288,6 +288,7 @@ typedef struct tagSQStackInfos{
 }SQStackInfos;
 
 typedef struct SQVM* HSQUIRRELVM;
+typedef struct SQSharedState* HSQMEMORY;
 typedef SQObject HSQOBJECT;
 typedef SQMemberHandle HSQMEMBERHANDLE;
 typedef SQInteger (*SQFUNCTION)(HSQUIRRELVM);
@@ -313,8 +314,48 @@ typedef struct tagSQFunctionInfo {
 	const SQChar *source;
 }SQFunctionInfo;
 
+typedef void *(*SQMALLOCFUNCTION)(SQUserPointer,SQUnsignedInteger);
+typedef void *(*SQREALLOCFUNCTION)(SQUserPointer,void*,SQUnsignedInteger,SQUnsignedInteger);
+typedef void (*SQFREEFUNCTION)(SQUserPointer,void*,SQUnsignedInteger);
+
+typedef struct tagSQAllocator {
+	SQMALLOCFUNCTION mallocfunc;
+	SQREALLOCFUNCTION reallocfunc;
+	SQFREEFUNCTION freefunc;
+	SQUserPointer up;
+}SQAllocator;
+
+typedef struct tagSQMemoryStats {
+	SQUnsignedInteger used;
+	SQUnsignedInteger peak;
+	SQUnsignedInteger allocations;
+	SQUnsignedInteger limit;
+}SQMemoryStats;
+
+#define SQ_SLAB_NUMCLASSES 12
+
+typedef struct tagSQSlabClassStats {
+	SQUnsignedInteger size;
+	SQUnsignedInteger inuse;
+	SQUnsignedInteger free;
+	SQUnsignedInteger pages;
+	SQUnsignedInteger allocations;
+}SQSlabClassStats;
+
+typedef struct tagSQStringTableStats {
+	SQUnsignedInteger strings;
+	SQUnsignedInteger slots;
+	SQUnsignedInteger usedslots;
+	SQUnsignedInteger longestchain;
+}SQStringTableStats;
+
 /*vm*/
 SQUIRREL_API HSQUIRRELVM sq_open(SQInteger initialstacksize);
+SQUIRREL_API HSQUIRRELVM sq_openwithallocator(SQInteger initialstacksize,const SQAllocator *allocator);
+SQUIRREL_API void sq_getallocator(HSQUIRRELVM v,SQAllocator *allocator);
+SQUIRREL_API SQInteger sq_getslabstats(HSQUIRRELVM v,SQSlabClassStats *stats);
+SQUIRREL_API void sq_getmemorystats(HSQUIRRELVM v,SQMemoryStats *stats);
+SQUIRREL_API void sq_setmemorylimit(HSQUIRRELVM v,SQUnsignedInteger limit);
 SQUIRREL_API HSQUIRRELVM sq_newthread(HSQUIRRELVM friendvm, SQInteger initialstacksize);
 SQUIRREL_API void sq_seterrorhandler(HSQUIRRELVM v);
 SQUIRREL_API void sq_close(HSQUIRRELVM v);
@@ -453,16 +494,26 @@ SQUIRREL_API SQRESULT sq_getobjtypetag(const HSQOBJECT *o,SQUserPointer * typeta
 
 /*GC*/
 SQUIRREL_API SQInteger sq_collectgarbage(HSQUIRRELVM v);
+SQUIRREL_API SQBool sq_collectgarbage_step(HSQUIRRELVM v,SQInteger budget);
+SQUIRREL_API void sq_setgcpacing(HSQUIRRELVM v,SQInteger growth,SQInteger stepsize);
 SQUIRREL_API SQRESULT sq_resurrectunreachable(HSQUIRRELVM v);
 
 /*serialization*/
 SQUIRREL_API SQRESULT sq_writeclosure(HSQUIRRELVM vm,SQWRITEFUNC writef,SQUserPointer up);
 SQUIRREL_API SQRESULT sq_readclosure(HSQUIRRELVM vm,SQREADFUNC readf,SQUserPointer up);
+SQUIRREL_API SQRESULT sq_readclosurebuffer(HSQUIRRELVM vm,const void *buf,SQInteger size);
+SQUIRREL_API SQRESULT sq_getclosurestringcount(HSQUIRRELVM vm,SQInteger idx,SQInteger *count);
+SQUIRREL_API void sq_reservestrings(HSQUIRRELVM vm,SQInteger count);
+SQUIRREL_API void sq_getstringtablestats(HSQUIRRELVM vm,SQStringTableStats *stats);
 
 /*mem allocation*/
 SQUIRREL_API void *sq_malloc(SQUnsignedInteger size);
 SQUIRREL_API void *sq_realloc(void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize);
 SQUIRREL_API void sq_free(void *p,SQUnsignedInteger size);
+SQUIRREL_API HSQMEMORY sq_getmemory(HSQUIRRELVM v);
+SQUIRREL_API void *sq_memmalloc(HSQMEMORY m,SQUnsignedInteger size);
+SQUIRREL_API void *sq_memrealloc(HSQMEMORY m,void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize);
+SQUIRREL_API void sq_memfree(HSQMEMORY m,void *p,SQUnsignedInteger size);
 
 /*debug*/
 SQUIRREL_API SQRESULT sq_stackinfos(HSQUIRRELVM v,SQInteger level,SQStackInfos *si);
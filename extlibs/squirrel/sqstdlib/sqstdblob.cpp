@@ -7,8 +7,6 @@
 #include "sqstdstream.h"
 #include "sqstdblobimpl.h"
 
-#define SQSTD_BLOB_TYPE_TAG (SQSTD_STREAM_TYPE_TAG | 0x00000002)
-
 //Blob
 
 
@@ -30,19 +28,6 @@ static SQInteger _blob_resize(HSQUIRRELVM v)
 	return 0;
 }
 
-static void __swap_dword(unsigned int *n)
-{
-	*n=(unsigned int)(((*n&0xFF000000)>>24)  |
-			((*n&0x00FF0000)>>8)  |
-			((*n&0x0000FF00)<<8)  |
-			((*n&0x000000FF)<<24));
-}
-
-static void __swap_word(unsigned short *n)
-{
-	*n=(unsigned short)((*n>>8)&0x00FF)| ((*n<<8)&0xFF00);
-}
-
 static SQInteger _blob_swap4(HSQUIRRELVM v)
 {
 	SETUP_BLOB(v);
@@ -108,6 +93,22 @@ static SQInteger _blob__nexti(HSQUIRRELVM v)
 	return sq_throwerror(v,_SC("internal error (_nexti) wrong argument type"));
 }
 
+//a view of [start,end) that shares memory with the blob, negative indices count from the end
+static SQInteger _blob_slice(HSQUIRRELVM v)
+{
+	SETUP_BLOB(v);
+	SQInteger start, end = self->Len();
+	sq_getinteger(v,2,&start);
+	if(sq_gettop(v) > 2) sq_getinteger(v,3,&end);
+	if(start < 0) start += self->Len();
+	if(end < 0) end += self->Len();
+	if(start < 0 || start > end || end > self->Len())
+		return sq_throwerror(v,_SC("slice out of range"));
+	if(SQ_FAILED(push_blobview(v,self->GetRegion(),(unsigned char *)self->GetBuf() + start,end - start)))
+		return sq_throwerror(v,_SC("cannot create blob"));
+	return 1;
+}
+
 static SQInteger _blob__typeof(HSQUIRRELVM v)
 {
 	sq_pushstring(v,_SC("blob"),-1);
@@ -117,8 +118,9 @@ static SQInteger _blob__typeof(HSQUIRRELVM v)
 static SQInteger _blob_releasehook(SQUserPointer p, SQInteger size)
 {
 	SQBlob *self = (SQBlob*)p;
+	HSQMEMORY mem = self->GetMemory();
 	self->~SQBlob();
-	sq_free(self,sizeof(SQBlob));
+	sq_memfree(mem,self,sizeof(SQBlob));
 	return 1;
 }
 
@@ -132,10 +134,18 @@ static SQInteger _blob_constructor(HSQUIRRELVM v)
 	if(size < 0) return sq_throwerror(v, _SC("cannot create blob with negative size"));
 	//SQBlob *b = new SQBlob(size);
 
-	SQBlob *b = new (sq_malloc(sizeof(SQBlob)))SQBlob(size);
+	HSQMEMORY mem = sq_getmemory(v);
+	void *p = sq_memmalloc(mem,sizeof(SQBlob));
+	if(!p) return sq_throwerror(v, _SC("not enough memory"));
+	SQBlob *b = new (p)SQBlob(mem,size);
+	if(size && !b->IsValid()) {
+		b->~SQBlob();
+		sq_memfree(mem,b,sizeof(SQBlob));
+		return sq_throwerror(v, _SC("not enough memory"));
+	}
 	if(SQ_FAILED(sq_setinstanceup(v,1,b))) {
 		b->~SQBlob();
-		sq_free(b,sizeof(SQBlob));
+		sq_memfree(mem,b,sizeof(SQBlob));
 		return sq_throwerror(v, _SC("cannot create blob"));
 	}
 	sq_setreleasehook(v,1,_blob_releasehook);
@@ -150,11 +160,19 @@ static SQInteger _blob__cloned(HSQUIRRELVM v)
 			return SQ_ERROR; 
 	}
 	//SQBlob *thisone = new SQBlob(other->Len());
-	SQBlob *thisone = new (sq_malloc(sizeof(SQBlob)))SQBlob(other->Len());
+	HSQMEMORY mem = sq_getmemory(v);
+	void *p = sq_memmalloc(mem,sizeof(SQBlob));
+	if(!p) return sq_throwerror(v, _SC("not enough memory"));
+	SQBlob *thisone = new (p)SQBlob(mem,other->Len());
+	if(other->Len() && !thisone->IsValid()) {
+		thisone->~SQBlob();
+		sq_memfree(mem,thisone,sizeof(SQBlob));
+		return sq_throwerror(v, _SC("not enough memory"));
+	}
 	memcpy(thisone->GetBuf(),other->GetBuf(),thisone->Len());
 	if(SQ_FAILED(sq_setinstanceup(v,1,thisone))) {
 		thisone->~SQBlob();
-		sq_free(thisone,sizeof(SQBlob));
+		sq_memfree(mem,thisone,sizeof(SQBlob));
 		return sq_throwerror(v, _SC("cannot clone blob"));
 	}
 	sq_setreleasehook(v,1,_blob_releasehook);
@@ -167,6 +185,7 @@ static SQRegFunction _blob_methods[] = {
 	_DECL_BLOB_FUNC(resize,2,_SC("xn")),
 	_DECL_BLOB_FUNC(swap2,1,_SC("x")),
 	_DECL_BLOB_FUNC(swap4,1,_SC("x")),
+	_DECL_BLOB_FUNC(slice,-2,_SC("xnn")),
 	_DECL_BLOB_FUNC(_set,3,_SC("xnn")),
 	_DECL_BLOB_FUNC(_get,2,_SC("xn")),
 	_DECL_BLOB_FUNC(_typeof,1,_SC("x")),
@@ -270,6 +289,39 @@ SQUserPointer sqstd_createblob(HSQUIRRELVM v, SQInteger size)
 	return NULL;
 }
 
+SQRESULT push_blobview(HSQUIRRELVM v,SQBlobRegion *region,unsigned char *buf,SQInteger size)
+{
+	SQInteger top = sq_gettop(v);
+	sq_pushregistrytable(v);
+	sq_pushstring(v,_SC("std_blob"),-1);
+	if(SQ_SUCCEEDED(sq_get(v,-2))) {
+		sq_remove(v,-2); //removes the registry
+		sq_pushroottable(v); // push the this
+		sq_pushinteger(v,0); //size
+		SQBlob *blob = NULL;
+		if(SQ_SUCCEEDED(sq_call(v,2,SQTrue,SQFalse))
+			&& SQ_SUCCEEDED(sq_getinstanceup(v,-1,(SQUserPointer *)&blob,(SQUserPointer)SQSTD_BLOB_TYPE_TAG))) {
+			sq_remove(v,-2);
+			//turns the empty blob into the view in place
+			HSQMEMORY mem = blob->GetMemory();
+			blob->~SQBlob();
+			new (blob) SQBlob(mem,region,buf,size);
+			return SQ_OK;
+		}
+	}
+	sq_settop(v,top);
+	return SQ_ERROR;
+}
+
+SQRESULT sqstd_createblobview(HSQUIRRELVM v, SQUserPointer p, SQInteger size, SQRELEASEHOOK hook)
+{
+	SQBlobRegion *region = SQBlobRegion::Create(p,size,hook);
+	SQRESULT res = push_blobview(v,region,(unsigned char *)p,size);
+	if(SQ_FAILED(res)) region->Detach(); //on failure p still belongs to the caller
+	region->Release(); //the view holds its own reference
+	return res;
+}
+
 SQRESULT sqstd_register_bloblib(HSQUIRRELVM v)
 {
 	return declare_stream(v,_SC("blob"),(SQUserPointer)SQSTD_BLOB_TYPE_TAG,_SC("std_blob"),_blob_methods,bloblib_funcs);
@@ -2,22 +2,101 @@
 #ifndef _SQSTD_BLOBIMPL_H_
 #define _SQSTD_BLOBIMPL_H_
 
+#define SQSTD_BLOB_TYPE_TAG (SQSTD_STREAM_TYPE_TAG | 0x00000002)
+
+inline void __swap_dword(unsigned int *n)
+{
+	*n=(unsigned int)(((*n&0xFF000000)>>24)  |
+			((*n&0x00FF0000)>>8)  |
+			((*n&0x0000FF00)<<8)  |
+			((*n&0x000000FF)<<24));
+}
+
+inline void __swap_word(unsigned short *n)
+{
+	*n=(unsigned short)((*n>>8)&0x00FF)| ((*n<<8)&0xFF00);
+}
+
+inline void __swap_qword(unsigned int *n)
+{
+	unsigned int t = n[0];
+	n[0] = n[1];
+	n[1] = t;
+	__swap_dword(&n[0]);
+	__swap_dword(&n[1]);
+}
+
+//memory that blobs can point into without owning it, like a mapped file. Every user
+//holds a reference and the last one to let go hands the memory to the hook
+struct SQBlobRegion
+{
+	static SQBlobRegion *Create(SQUserPointer p, SQInteger size, SQRELEASEHOOK hook) {
+		return new (sq_malloc(sizeof(SQBlobRegion)))SQBlobRegion(p, size, hook, NULL);
+	}
+	//memory from sq_memmalloc(mem), handed back there
+	static SQBlobRegion *Create(HSQMEMORY mem, SQUserPointer p, SQInteger size) {
+		return new (sq_malloc(sizeof(SQBlobRegion)))SQBlobRegion(p, size, NULL, mem);
+	}
+	void AddRef() { _refs++; }
+	void Release() {
+		if(--_refs == 0) {
+			if(_hook) _hook(_p, _size);
+			else if(_mem) sq_memfree(_mem, _p, _size);
+			this->~SQBlobRegion();
+			sq_free(this, sizeof(SQBlobRegion));
+		}
+	}
+	//the memory stays with the caller, the hook will not run for it
+	void Detach() { _hook = NULL; _mem = NULL; }
+	SQUserPointer GetBuf() { return _p; }
+	SQInteger Len() { return _size; }
+private:
+	SQBlobRegion(SQUserPointer p, SQInteger size, SQRELEASEHOOK hook, HSQMEMORY mem) {
+		_refs = 1;
+		_p = p;
+		_size = size;
+		_hook = hook;
+		_mem = mem;
+	}
+	SQInteger _refs;
+	SQUserPointer _p;
+	SQInteger _size;
+	SQRELEASEHOOK _hook;
+	HSQMEMORY _mem;
+};
+
+//the buffer and the blob itself are counted against the memory limit of mem,
+//when the buffer would exceed it the blob is not valid
 struct SQBlob : public SQStream
 {
-	SQBlob(SQInteger size) {
+	SQBlob(HSQMEMORY mem, SQInteger size) {
+		_mem = mem;
 		_size = size;
 		_allocated = size;
-		_buf = (unsigned char *)sq_malloc(size);
-		memset(_buf, 0, _size);
+		_buf = (unsigned char *)sq_memmalloc(mem, size);
+		if(_buf) memset(_buf, 0, _size);
+		else _size = _allocated = 0;
 		_ptr = 0;
 		_owns = true;
+		_region = NULL;
+	}
+	//a view of size bytes at buf, inside region; it cannot be resized
+	SQBlob(HSQMEMORY mem, SQBlobRegion *region, unsigned char *buf, SQInteger size) {
+		_mem = mem;
+		_size = size;
+		_allocated = size;
+		_buf = buf;
+		_ptr = 0;
+		_owns = false;
+		_region = region;
+		_region->AddRef();
 	}
 	virtual ~SQBlob() {
-		sq_free(_buf, _allocated);
+		FreeBuf();
 	}
 	SQInteger Write(void *buffer, SQInteger size) {
-		if(!CanAdvance(size)) {
-			GrowBufOf(_ptr + size - _size);
+		if(!CanAdvance(size) && !GrowBufOf(_ptr + size - _size)) {
+			size = _size - _ptr; //views, and buffers that cannot grow, write what fits
 		}
 		memcpy(&_buf[_ptr], buffer, size);
 		_ptr += size;
@@ -35,15 +114,16 @@ struct SQBlob : public SQStream
 		return n;
 	}
 	bool Resize(SQInteger n) {
-		if(!_owns) return false;
+		if(!_owns || n < 0) return false;
 		if(n != _allocated) {
-			unsigned char *newbuf = (unsigned char *)sq_malloc(n);
+			unsigned char *newbuf = (unsigned char *)sq_memmalloc(_mem, n);
+			if(!newbuf) return false;
 			memset(newbuf,0,n);
 			if(_size > n)
 				memcpy(newbuf,_buf,n);
 			else
 				memcpy(newbuf,_buf,_size);
-			sq_free(_buf,_allocated);
+			FreeBuf();
 			_buf=newbuf;
 			_allocated = n;
 			if(_size > _allocated)
@@ -62,7 +142,7 @@ struct SQBlob : public SQStream
 			else
 				ret = Resize(_size * 2);
 		}
-		_size = _size + n;
+		if(ret) _size = _size + n;
 		return ret;
 	}
 	bool CanAdvance(SQInteger n) {
@@ -97,12 +177,28 @@ struct SQBlob : public SQStream
 	SQInteger Tell() { return _ptr; }
 	SQInteger Len() { return _size; }
 	SQUserPointer GetBuf(){ return _buf; }
+	//the region views of this blob keep alive, an owned buffer is handed to one on first use
+	SQBlobRegion *GetRegion() {
+		if(!_region) _region = SQBlobRegion::Create(_mem, _buf, _allocated);
+		return _region;
+	}
+	HSQMEMORY GetMemory() { return _mem; }
 private:
+	//after a resize, views keep the old buffer alive and stop following the blob
+	void FreeBuf() {
+		if(_region) _region->Release();
+		else if(_buf) sq_memfree(_mem, _buf, _allocated);
+		_region = NULL;
+	}
+	HSQMEMORY _mem;
 	SQInteger _size;
 	SQInteger _allocated;
 	SQInteger _ptr;
 	unsigned char *_buf;
 	bool _owns;
+	SQBlobRegion *_region;
 };
 
+SQRESULT push_blobview(HSQUIRRELVM v,SQBlobRegion *region,unsigned char *buf,SQInteger size);
+
 #endif //_SQSTD_BLOBIMPL_H_
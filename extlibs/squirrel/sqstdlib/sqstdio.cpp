@@ -3,9 +3,19 @@
 #include <stdio.h>
 #include <squirrel.h>
 #include <sqstdio.h>
+#include <string.h>
 #include "sqstdstream.h"
+#include "sqstdblobimpl.h"
+#if !defined(_WIN32) && !defined(SQUNICODE)
+#define SQSTD_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define SQSTD_FILE_TYPE_TAG (SQSTD_STREAM_TYPE_TAG | 0x00000001)
+#define SQSTD_MMAPFILE_TYPE_TAG (SQSTD_STREAM_TYPE_TAG | 0x00000003)
 //basic API
 SQFILE sqstd_fopen(const SQChar *filename ,const SQChar *mode)
 {
@@ -172,6 +182,211 @@ static SQRegFunction _file_methods[] = {
 
 
 
+#ifdef SQSTD_MMAP
+//Memory mapped file, the mapping is shared with the blobs readblob() returns
+//and is unmapped once the file and all of them are gone
+struct SQMappedFile : public SQStream {
+	SQMappedFile(SQBlobRegion *region, bool writable) {
+		_region = region;
+		_region->AddRef();
+		_buf = (unsigned char *)region->GetBuf();
+		_size = region->Len();
+		_ptr = 0;
+		_writable = writable;
+	}
+	virtual ~SQMappedFile() { Close(); }
+	void Close() {
+		if(_region) {
+			_region->Release();
+			_region = NULL;
+		}
+	}
+	SQInteger Read(void *buffer,SQInteger size) {
+		SQInteger n = _size - _ptr < size ? _size - _ptr : size;
+		if(n <= 0) return 0;
+		memcpy(buffer, &_buf[_ptr], n);
+		_ptr += n;
+		return n;
+	}
+	SQInteger Write(void *buffer,SQInteger size) {
+		SQInteger n = _size - _ptr < size ? _size - _ptr : size;
+		if(!_writable || n <= 0) return 0;
+		memcpy(&_buf[_ptr], buffer, n);
+		_ptr += n;
+		return n;
+	}
+	SQInteger Flush() {
+		if(_writable && _size) return msync(_buf, _size, MS_SYNC);
+		return 0;
+	}
+	SQInteger Tell() { return _ptr; }
+	SQInteger Len() { return _size; }
+	SQInteger Seek(SQInteger offset, SQInteger origin) {
+		switch(origin) {
+			case SQ_SEEK_SET: break;
+			case SQ_SEEK_CUR: offset += _ptr; break;
+			case SQ_SEEK_END: offset += _size; break;
+			default: return -1;
+		}
+		if(offset < 0 || offset > _size) return -1;
+		_ptr = offset;
+		return 0;
+	}
+	bool IsValid() { return _region?true:false; }
+	bool EOS() { return _ptr == _size; }
+	bool IsWritable() { return _writable; }
+	SQBlobRegion *GetRegion() { return _region; }
+	unsigned char *GetBuf() { return _buf; }
+private:
+	SQBlobRegion *_region;
+	unsigned char *_buf;
+	SQInteger _size;
+	SQInteger _ptr;
+	bool _writable;
+};
+
+#define SETUP_MMAPFILE(v) \
+	SQMappedFile *self = NULL; \
+	if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_MMAPFILE_TYPE_TAG))) \
+		return sq_throwerror(v,_SC("invalid type tag")); \
+	if(!self || !self->IsValid()) \
+		return sq_throwerror(v,_SC("the file is closed"));
+
+static SQInteger _mmapfile_unmap(SQUserPointer p, SQInteger size)
+{
+	if(p) munmap(p,size);
+	return 1;
+}
+
+static SQInteger _mmapfile_releasehook(SQUserPointer p, SQInteger size)
+{
+	SQMappedFile *self = (SQMappedFile*)p;
+	self->~SQMappedFile();
+	sq_free(self,sizeof(SQMappedFile));
+	return 1;
+}
+
+//mode "r" maps the file copy-on-write, "r+" shares writes with the file and "w+" creates it.
+//With "r+" and "w+" the optional size resizes the file before mapping it
+static SQInteger _mmapfile_constructor(HSQUIRRELVM v)
+{
+	const SQChar *filename,*mode = _SC("r");
+	SQInteger size = -1;
+	sq_getstring(v,2,&filename);
+	if(sq_gettop(v) > 2) sq_getstring(v,3,&mode);
+	if(sq_gettop(v) > 3) sq_getinteger(v,4,&size);
+	int flags;
+	bool writable = true;
+	if(strcmp(mode,"r") == 0) { flags = O_RDONLY; writable = false; }
+	else if(strcmp(mode,"r+") == 0) flags = O_RDWR;
+	else if(strcmp(mode,"w+") == 0) flags = O_RDWR|O_CREAT|O_TRUNC;
+	else return sq_throwerror(v,_SC("invalid mode, expected \"r\", \"r+\" or \"w+\""));
+	if(size != -1 && (!writable || size < 0))
+		return sq_throwerror(v,_SC("invalid size"));
+	int fd = open(filename,flags,0666);
+	if(fd < 0) return sq_throwerror(v,_SC("cannot open file"));
+	struct stat info;
+	if((size != -1 && ftruncate(fd,(off_t)size) != 0) || fstat(fd,&info) != 0) {
+		close(fd);
+		return sq_throwerror(v,_SC("cannot resize file"));
+	}
+	void *p = NULL;
+	if(info.st_size > 0) {
+		p = mmap(NULL,(size_t)info.st_size,PROT_READ|PROT_WRITE,writable ? MAP_SHARED : MAP_PRIVATE,fd,0);
+		if(p == MAP_FAILED) {
+			close(fd);
+			return sq_throwerror(v,_SC("cannot map file"));
+		}
+	}
+	close(fd); //the mapping stays valid
+	SQBlobRegion *region = SQBlobRegion::Create(p,(SQInteger)info.st_size,_mmapfile_unmap);
+	SQMappedFile *f = new (sq_malloc(sizeof(SQMappedFile)))SQMappedFile(region,writable);
+	region->Release(); //the file holds its own reference now
+	if(SQ_FAILED(sq_setinstanceup(v,1,f))) {
+		f->~SQMappedFile();
+		sq_free(f,sizeof(SQMappedFile));
+		return sq_throwerror(v, _SC("cannot create mmapfile"));
+	}
+	sq_setreleasehook(v,1,_mmapfile_releasehook);
+	return 0;
+}
+
+static SQInteger _mmapfile_close(HSQUIRRELVM v)
+{
+	SQMappedFile *self = NULL;
+	if(SQ_SUCCEEDED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_MMAPFILE_TYPE_TAG))
+		&& self != NULL)
+	{
+		self->Close();
+	}
+	return 0;
+}
+
+//returns a blob over the next size bytes of the mapping instead of a copy
+static SQInteger _mmapfile_readblob(HSQUIRRELVM v)
+{
+	SETUP_MMAPFILE(v);
+	SQInteger size;
+	sq_getinteger(v,2,&size);
+	if(size > self->Len() - self->Tell())
+		size = self->Len() - self->Tell();
+	if(size <= 0)
+		return sq_throwerror(v,_SC("no data left to read"));
+	if(SQ_FAILED(push_blobview(v,self->GetRegion(),self->GetBuf() + self->Tell(),size)))
+		return sq_throwerror(v,_SC("cannot create blob"));
+	self->Seek(size,SQ_SEEK_CUR);
+	return 1;
+}
+
+static SQInteger _mmapfile_advise(HSQUIRRELVM v)
+{
+	SETUP_MMAPFILE(v);
+	const SQChar *hint;
+	SQInteger offset = 0, len = self->Len(), page = sysconf(_SC_PAGESIZE);
+	int advice;
+	sq_getstring(v,2,&hint);
+	if(sq_gettop(v) > 2) sq_getinteger(v,3,&offset);
+	if(sq_gettop(v) > 3) sq_getinteger(v,4,&len);
+	if(strcmp(hint,"normal") == 0) advice = MADV_NORMAL;
+	else if(strcmp(hint,"sequential") == 0) advice = MADV_SEQUENTIAL;
+	else if(strcmp(hint,"random") == 0) advice = MADV_RANDOM;
+	else if(strcmp(hint,"willneed") == 0) advice = MADV_WILLNEED;
+	else if(strcmp(hint,"dontneed") == 0) advice = MADV_DONTNEED;
+	else return sq_throwerror(v,_SC("invalid hint"));
+	//a private mapping would silently drop what its views changed
+	if(advice == MADV_DONTNEED && !self->IsWritable())
+		return sq_throwerror(v,_SC("dontneed needs a mapping opened with r+ or w+"));
+	if(offset < 0 || len < 0 || offset + len > self->Len())
+		return sq_throwerror(v,_SC("invalid range"));
+	if(len == 0) return 0;
+	//madvise wants a page aligned address
+	SQInteger start = offset - offset % page;
+	if(madvise(self->GetBuf() + start,(size_t)(offset + len - start),advice) != 0)
+		return sq_throwerror(v,_SC("madvise failed"));
+	return 0;
+}
+
+static SQInteger _mmapfile__typeof(HSQUIRRELVM v)
+{
+	sq_pushstring(v,_SC("mmapfile"),-1);
+	return 1;
+}
+
+#define _DECL_MMAPFILE_FUNC(name,nparams,typecheck) {_SC(#name),_mmapfile_##name,nparams,typecheck}
+static SQRegFunction _mmapfile_methods[] = {
+	_DECL_MMAPFILE_FUNC(constructor,-2,_SC("xssn")),
+	_DECL_MMAPFILE_FUNC(close,1,_SC("x")),
+	_DECL_MMAPFILE_FUNC(readblob,2,_SC("xn")),
+	_DECL_MMAPFILE_FUNC(advise,-2,_SC("xsnn")),
+	_DECL_MMAPFILE_FUNC(_typeof,1,_SC("x")),
+	{0,0,0,0},
+};
+
+static SQRegFunction _mmapfile_funcs[] = {
+	{0,0}
+};
+#endif
+
 SQRESULT sqstd_createfile(HSQUIRRELVM v, SQFILE file,SQBool own)
 {
 	SQInteger top = sq_gettop(v);
@@ -288,6 +503,69 @@ SQInteger file_write(SQUserPointer file,SQUserPointer p,SQInteger size)
 	return sqstd_fwrite(p,1,size,(SQFILE)file);
 }
 
+#ifdef SQUNICODE
+//decodes like _io_file_lexfeed_UTF8 and stops where it would, returns the number of characters
+static SQInteger _io_utf8_decode(const unsigned char *s,SQInteger size,SQChar *out)
+{
+	static const SQInteger utf8_lengths[16] = {1,1,1,1,1,1,1,1,0,0,0,0,2,2,3,4};
+	static const unsigned char byte_masks[5] = {0,0,0x1f,0x0f,0x07};
+	SQInteger n = 0, i = 0;
+	while(i < size) {
+		SQInteger c = s[i++];
+		if(c >= 0x80) {
+			SQInteger codelen = utf8_lengths[c>>4];
+			if(codelen == 0 || i + codelen - 1 > size)
+				break;
+			c &= byte_masks[codelen];
+			for(SQInteger k = 0; k < codelen-1; k++)
+				c = (c<<6) | (s[i++] & 0x3F);
+		}
+		out[n++] = (SQChar)c;
+	}
+	return n;
+}
+#endif
+
+//reads the rest of a plain or UTF-8 text file in one go and compiles it from memory,
+//falls back to the per character read function if the file can't be sized
+static SQRESULT _io_file_compile_text(HSQUIRRELVM v,SQFILE file,const SQChar *filename,SQBool utf8,SQBool printerror)
+{
+	SQLEXREADFUNC func = _io_file_lexfeed_PLAIN;
+#ifdef SQUNICODE
+	if(utf8) func = _io_file_lexfeed_UTF8;
+#endif
+	SQInteger start = sqstd_ftell(file);
+	if(start < 0 || sqstd_fseek(file,0,SQ_SEEK_END) != 0)
+		return sq_compile(v,func,file,filename,printerror);
+	SQInteger size = sqstd_ftell(file) - start;
+	sqstd_fseek(file,start,SQ_SEEK_SET);
+	if(size <= 0)
+		return sq_compilebuffer(v,_SC(""),0,filename,printerror);
+	HSQMEMORY mem = sq_getmemory(v);
+	char *bytes = (char *)sq_memmalloc(mem,size);
+	if(!bytes) return sq_throwerror(v,_SC("not enough memory"));
+	SQInteger read = sqstd_fread(bytes,1,size,file);
+	SQRESULT res;
+#ifdef SQUNICODE
+	//never more characters than bytes
+	SQChar *buf = (SQChar *)sq_memmalloc(mem,size*sizeof(SQChar));
+	if(!buf) {
+		sq_memfree(mem,bytes,size);
+		return sq_throwerror(v,_SC("not enough memory"));
+	}
+	SQInteger len = read;
+	if(utf8) len = _io_utf8_decode((const unsigned char *)bytes,read,buf);
+	else for(SQInteger i = 0; i < read; i++) buf[i] = bytes[i];
+	res = sq_compilebuffer(v,buf,len,filename,printerror);
+	sq_memfree(mem,buf,size*sizeof(SQChar));
+#else
+	//narrow builds lex UTF-8 bytes as they are
+	res = sq_compilebuffer(v,bytes,read,filename,printerror);
+#endif
+	sq_memfree(mem,bytes,size);
+	return res;
+}
+
 SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
 {
 	SQFILE file = sqstd_fopen(filename,_SC("rb"));
@@ -332,6 +610,12 @@ SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
 				default: sqstd_fseek(file,0,SQ_SEEK_SET); break; // ascii
 			}
 
+			//plain and UTF-8 text is lexed from memory, past the BOM
+			if(func != _io_file_lexfeed_UCS2_LE && func != _io_file_lexfeed_UCS2_BE) {
+				SQRESULT res = _io_file_compile_text(v,file,filename,us == 0xBBEF,printerror);
+				sqstd_fclose(file);
+				return res;
+			}
 			if(SQ_SUCCEEDED(sq_compile(v,func,file,filename,printerror))){
 				sqstd_fclose(file);
 				return SQ_OK;
@@ -417,6 +701,9 @@ SQRESULT sqstd_register_iolib(HSQUIRRELVM v)
 	SQInteger top = sq_gettop(v);
 	//create delegate
 	declare_stream(v,_SC("file"),(SQUserPointer)SQSTD_FILE_TYPE_TAG,_SC("std_file"),_file_methods,iolib_funcs);
+#ifdef SQSTD_MMAP
+	declare_stream(v,_SC("mmapfile"),(SQUserPointer)SQSTD_MMAPFILE_TYPE_TAG,_SC("std_mmapfile"),_mmapfile_methods,_mmapfile_funcs);
+#endif
 	sq_pushstring(v,_SC("stdout"),-1);
 	sqstd_createfile(v,stdout,SQFalse);
 	sq_newslot(v,-3,SQFalse);
@@ -57,6 +57,37 @@ typedef struct tagSQRexNode{
 	SQInteger next;
 }SQRexNode;
 
+//Thompson NFA program, run as a Pike VM: one thread per instruction at most,
+//so matching is linear in the length of the text
+#define NFA_CHAR	0
+#define NFA_ANY		1
+#define NFA_CLASS	2 //x = class node
+#define NFA_CCLASS	3 //x = class id
+#define NFA_SPLIT	4 //prefers x over y
+#define NFA_JMP		5
+#define NFA_SAVE	6 //x = capture slot
+#define NFA_BOL		7
+#define NFA_EOL		8
+#define NFA_WB		9 //x = 'b' or 'B'
+#define NFA_MATCH	10
+
+//patterns with counted repetitions that would expand past this are matched by backtracking
+#define NFA_MAX_INSTRUCTIONS 2048
+
+//longest literal kept for the search prefilter, longer runs are cut into pieces
+#define REX_MAX_LITERAL 32
+
+typedef struct tagSQRexInst{
+	SQInteger op;
+	SQInteger x;
+	SQInteger y;
+}SQRexInst;
+
+typedef struct tagSQRexThread{
+	SQInteger pc;
+	const SQChar **slots;
+}SQRexThread;
+
 struct SQRex{
 	const SQChar *_eol;
 	const SQChar *_bol;
@@ -71,6 +102,19 @@ struct SQRex{
 	SQInteger _currsubexp;
 	void *_jmpbuf;
 	const SQChar **_error;
+	SQInteger _mode;
+	SQRexInst *_prog;
+	SQInteger _ninst;
+	SQInteger _nallocinst;
+	SQRexThread *_threads;
+	const SQChar **_slots;
+	SQInteger *_marks;
+	SQInteger _gen;
+	SQBool _anchored;
+	SQChar _prefix[REX_MAX_LITERAL];
+	SQInteger _prefixlen;
+	SQChar _required[REX_MAX_LITERAL];
+	SQInteger _requiredlen;
 };
 
 static SQInteger sqstd_rex_list(SQRex *exp);
@@ -374,6 +418,14 @@ static SQBool sqstd_rex_matchclass(SQRex* exp,SQRexNode *node,SQChar c)
 	return SQFalse;
 }
 
+static SQBool sqstd_rex_wordboundary(SQRex* exp,const SQChar *str)
+{
+	return (str == exp->_bol && !isspace(*str))
+		|| (str == exp->_eol && !isspace(*(str-1)))
+		|| (str < exp->_eol && !isspace(*str) && isspace(*(str+1)))
+		|| (str < exp->_eol && isspace(*str) && !isspace(*(str+1)));
+}
+
 static const SQChar *sqstd_rex_matchnode(SQRex* exp,SQRexNode *node,const SQChar *str,SQRexNode *next)
 {
 	
@@ -482,10 +534,7 @@ static const SQChar *sqstd_rex_matchnode(SQRex* exp,SQRexNode *node,const SQChar
 			return cur;
 	}				 
 	case OP_WB:
-		if((str == exp->_bol && !isspace(*str))
-		 || (str == exp->_eol && !isspace(*(str-1)))
-		 || (!isspace(*str) && isspace(*(str+1)))
-		 || (isspace(*str) && !isspace(*(str+1))) ) {
+		if(sqstd_rex_wordboundary(exp,str)) {
 			return (node->left == 'b')?str:NULL;
 		}
 		return (node->left == 'b')?NULL:str;
@@ -520,6 +569,292 @@ static const SQChar *sqstd_rex_matchnode(SQRex* exp,SQRexNode *node,const SQChar
 	return NULL;
 }
 
+typedef struct tagSQRexLiteral{
+	SQChar run[REX_MAX_LITERAL];
+	SQInteger len;
+	SQBool atstart; //nothing but literals consumed so far
+}SQRexLiteral;
+
+static void sqstd_rex_endliteral(SQRex *exp,SQRexLiteral *lit)
+{
+	if(lit->atstart) {
+		memcpy(exp->_prefix,lit->run,lit->len * sizeof(SQChar));
+		exp->_prefixlen = lit->len;
+		lit->atstart = SQFalse;
+	}
+	if(lit->len > exp->_requiredlen) {
+		memcpy(exp->_required,lit->run,lit->len * sizeof(SQChar));
+		exp->_requiredlen = lit->len;
+	}
+	lit->len = 0;
+}
+
+static void sqstd_rex_addliteral(SQRex *exp,SQRexLiteral *lit,SQChar c)
+{
+	if(lit->len == REX_MAX_LITERAL) sqstd_rex_endliteral(exp,lit);
+	lit->run[lit->len++] = c;
+}
+
+//collects the runs of characters every match has to contain: the first becomes
+//the prefix searches skip to, the longest one has to be in the text at all
+static void sqstd_rex_literals(SQRex *exp,SQInteger node,SQRexLiteral *lit)
+{
+	for(; node != -1; node = exp->_nodes[node].next) {
+		SQRexNode *n = &exp->_nodes[node];
+		switch(n->type) {
+		case OP_EXPR:
+		case OP_NOCAPEXPR:
+			if(n->left != -1 && exp->_nodes[n->left].type != OP_OR) {
+				sqstd_rex_literals(exp,n->left,lit);
+				continue;
+			}
+			break;
+		case OP_BOL:
+			if(lit->atstart && lit->len == 0) {
+				exp->_anchored = SQTrue;
+				continue;
+			}
+			break;
+		case OP_GREEDY: {
+			SQInteger p0 = (n->right >> 16)&0x0000FFFF, p1 = n->right&0x0000FFFF, i;
+			SQRexNodeType c = exp->_nodes[n->left].type;
+			if(c >= OP_GREEDY) break;
+			for(i = 0; i < p0 && i < REX_MAX_LITERAL; i++)
+				sqstd_rex_addliteral(exp,lit,(SQChar)c);
+			if(p0 == p1 && p0 <= REX_MAX_LITERAL) continue;
+			break;
+		}
+		default:
+			if(n->type < OP_GREEDY) {
+				sqstd_rex_addliteral(exp,lit,(SQChar)n->type);
+				continue;
+			}
+		}
+		sqstd_rex_endliteral(exp,lit);
+	}
+}
+
+static const SQChar *sqstd_rex_findliteral(const SQChar *str,const SQChar *end,const SQChar *lit,SQInteger len)
+{
+	while(end - str >= len) {
+#ifdef SQUNICODE
+		while(str < end && *str != lit[0]) str++;
+		if(str == end) return NULL;
+#else
+		if(!(str = (const SQChar *)memchr(str,lit[0],end - str))) return NULL;
+#endif
+		if(end - str < len) return NULL;
+		if(memcmp(str,lit,len * sizeof(SQChar)) == 0) return str;
+		str++;
+	}
+	return NULL;
+}
+
+static SQInteger sqstd_rex_emit(SQRex *exp,SQInteger op,SQInteger x,SQInteger y)
+{
+	if(exp->_ninst == NFA_MAX_INSTRUCTIONS) return -1;
+	if(exp->_nallocinst == exp->_ninst) {
+		SQInteger oldsize = exp->_nallocinst;
+		exp->_nallocinst = oldsize ? oldsize * 2 : 16;
+		exp->_prog = (SQRexInst *)sq_realloc(exp->_prog,oldsize * sizeof(SQRexInst),exp->_nallocinst * sizeof(SQRexInst));
+	}
+	SQRexInst *i = &exp->_prog[exp->_ninst];
+	i->op = op; i->x = x; i->y = y;
+	return exp->_ninst++;
+}
+
+static SQBool sqstd_rex_compilelist(SQRex *exp,SQInteger node);
+
+static SQBool sqstd_rex_compilenode(SQRex *exp,SQInteger node)
+{
+	SQRexNode *n = &exp->_nodes[node];
+	switch(n->type) {
+	case OP_EXPR:
+		return sqstd_rex_emit(exp,NFA_SAVE,n->right*2,0) != -1
+			&& sqstd_rex_compilelist(exp,n->left)
+			&& sqstd_rex_emit(exp,NFA_SAVE,n->right*2+1,0) != -1;
+	case OP_NOCAPEXPR:
+		return sqstd_rex_compilelist(exp,n->left);
+	case OP_OR: {
+		SQInteger split = sqstd_rex_emit(exp,NFA_SPLIT,0,0), jmp;
+		if(split == -1) return SQFalse;
+		exp->_prog[split].x = exp->_ninst;
+		if(!sqstd_rex_compilelist(exp,n->left) || (jmp = sqstd_rex_emit(exp,NFA_JMP,0,0)) == -1) return SQFalse;
+		exp->_prog[split].y = exp->_ninst;
+		if(!sqstd_rex_compilelist(exp,n->right)) return SQFalse;
+		exp->_prog[jmp].x = exp->_ninst;
+		return SQTrue;
+	}
+	case OP_GREEDY: {
+		SQInteger p0 = (n->right >> 16)&0x0000FFFF, p1 = n->right&0x0000FFFF, i;
+		for(i = 0; i < p0; i++)
+			if(!sqstd_rex_compilenode(exp,n->left)) return SQFalse;
+		if(p1 == 0xFFFF) {
+			SQInteger split = sqstd_rex_emit(exp,NFA_SPLIT,0,0);
+			if(split == -1) return SQFalse;
+			exp->_prog[split].x = exp->_ninst;
+			if(!sqstd_rex_compilenode(exp,n->left) || sqstd_rex_emit(exp,NFA_JMP,split,0) == -1) return SQFalse;
+			exp->_prog[split].y = exp->_ninst;
+			return SQTrue;
+		}
+		//x{p0,p1} is p0 copies of x followed by p1-p0 optional ones, each skipping to the end
+		SQInteger first = exp->_ninst;
+		for(i = p0; i < p1; i++) {
+			SQInteger split = sqstd_rex_emit(exp,NFA_SPLIT,0,-1);
+			if(split == -1) return SQFalse;
+			exp->_prog[split].x = exp->_ninst;
+			if(!sqstd_rex_compilenode(exp,n->left)) return SQFalse;
+		}
+		for(i = first; i < exp->_ninst; i++)
+			if(exp->_prog[i].op == NFA_SPLIT && exp->_prog[i].y == -1) exp->_prog[i].y = exp->_ninst;
+		return SQTrue;
+	}
+	case OP_BOL: return sqstd_rex_emit(exp,NFA_BOL,0,0) != -1;
+	case OP_EOL: return sqstd_rex_emit(exp,NFA_EOL,0,0) != -1;
+	case OP_WB: return sqstd_rex_emit(exp,NFA_WB,n->left,0) != -1;
+	case OP_DOT: return sqstd_rex_emit(exp,NFA_ANY,0,0) != -1;
+	case OP_CLASS:
+	case OP_NCLASS: return sqstd_rex_emit(exp,NFA_CLASS,node,0) != -1;
+	case OP_CCLASS: return sqstd_rex_emit(exp,NFA_CCLASS,n->left,0) != -1;
+	default: return sqstd_rex_emit(exp,NFA_CHAR,n->type,0) != -1;
+	}
+}
+
+static SQBool sqstd_rex_compilelist(SQRex *exp,SQInteger node)
+{
+	for(; node != -1; node = exp->_nodes[node].next)
+		if(!sqstd_rex_compilenode(exp,node)) return SQFalse;
+	return SQTrue;
+}
+
+static void sqstd_rex_freenfa(SQRex *exp)
+{
+	SQInteger nslots = exp->_nsubexpr * 2;
+	if(exp->_prog) sq_free(exp->_prog,exp->_nallocinst * sizeof(SQRexInst));
+	if(exp->_threads) sq_free(exp->_threads,2 * exp->_ninst * sizeof(SQRexThread));
+	if(exp->_slots) sq_free(exp->_slots,(2 * exp->_ninst + 1) * nslots * sizeof(const SQChar *));
+	if(exp->_marks) sq_free(exp->_marks,exp->_ninst * sizeof(SQInteger));
+	exp->_prog = NULL; exp->_threads = NULL; exp->_slots = NULL; exp->_marks = NULL;
+	exp->_ninst = exp->_nallocinst = 0;
+}
+
+static SQBool sqstd_rex_compilenfa(SQRex *exp)
+{
+	SQInteger nslots = exp->_nsubexpr * 2, i;
+	if(!sqstd_rex_compilenode(exp,exp->_first) || sqstd_rex_emit(exp,NFA_MATCH,0,0) == -1) {
+		sqstd_rex_freenfa(exp);
+		return SQFalse;
+	}
+	exp->_threads = (SQRexThread *)sq_malloc(2 * exp->_ninst * sizeof(SQRexThread));
+	exp->_slots = (const SQChar **)sq_malloc((2 * exp->_ninst + 1) * nslots * sizeof(const SQChar *));
+	exp->_marks = (SQInteger *)sq_malloc(exp->_ninst * sizeof(SQInteger));
+	for(i = 0; i < 2 * exp->_ninst; i++)
+		exp->_threads[i].slots = &exp->_slots[i * nslots];
+	memset(exp->_marks,0,exp->_ninst * sizeof(SQInteger));
+	exp->_gen = 0;
+	return SQTrue;
+}
+
+//follows the instructions that don't consume a character and queues the ones that do
+static void sqstd_rex_addthread(SQRex *exp,SQRexThread *list,SQInteger *n,SQInteger pc,const SQChar **slots,const SQChar *sp)
+{
+	if(exp->_marks[pc] == exp->_gen) return;
+	exp->_marks[pc] = exp->_gen;
+	SQRexInst *i = &exp->_prog[pc];
+	switch(i->op) {
+	case NFA_JMP: sqstd_rex_addthread(exp,list,n,i->x,slots,sp); return;
+	case NFA_SPLIT:
+		sqstd_rex_addthread(exp,list,n,i->x,slots,sp);
+		sqstd_rex_addthread(exp,list,n,i->y,slots,sp);
+		return;
+	case NFA_SAVE: {
+		const SQChar *old = slots[i->x];
+		slots[i->x] = sp;
+		sqstd_rex_addthread(exp,list,n,pc+1,slots,sp);
+		slots[i->x] = old;
+		return;
+	}
+	case NFA_BOL: if(sp == exp->_bol) sqstd_rex_addthread(exp,list,n,pc+1,slots,sp); return;
+	case NFA_EOL: if(sp == exp->_eol) sqstd_rex_addthread(exp,list,n,pc+1,slots,sp); return;
+	case NFA_WB:
+		if(sqstd_rex_wordboundary(exp,sp) == (i->x == 'b')) sqstd_rex_addthread(exp,list,n,pc+1,slots,sp);
+		return;
+	default: {
+		SQRexThread *t = &list[(*n)++];
+		t->pc = pc;
+		memcpy(t->slots,slots,exp->_nsubexpr * 2 * sizeof(const SQChar *));
+	}
+	}
+}
+
+//leftmost-first matching: earlier threads have priority, the first to reach NFA_MATCH
+//cuts off the ones behind it. A full match only accepts threads that end at _eol
+static const SQChar *sqstd_rex_nfaexec(SQRex *exp,const SQChar *begin,SQBool full,const SQChar **out_begin)
+{
+	SQInteger nslots = exp->_nsubexpr * 2, nc = 0, nn, i;
+	SQRexThread *clist = exp->_threads, *nlist = exp->_threads + exp->_ninst, *tmp;
+	const SQChar **start = &exp->_slots[2 * exp->_ninst * nslots];
+	const SQChar *sp = begin, *cand = NULL;
+	SQBool matched = SQFalse, restart = !full && !exp->_anchored;
+	if(restart && exp->_prefixlen) {
+		if(!(cand = sqstd_rex_findliteral(begin,exp->_eol,exp->_prefix,exp->_prefixlen))) return NULL;
+		sp = cand;
+	}
+	for(i = 0; i < nslots; i++) start[i] = NULL;
+	exp->_gen++;
+	sqstd_rex_addthread(exp,clist,&nc,0,start,sp);
+	for(;;) {
+		nn = 0;
+		exp->_gen++;
+		for(i = 0; i < nc; i++) {
+			SQRexThread *t = &clist[i];
+			SQRexInst *in = &exp->_prog[t->pc];
+			SQBool ok = SQFalse;
+			switch(in->op) {
+			case NFA_MATCH:
+				if(full && sp != exp->_eol) break;
+				matched = SQTrue;
+				for(SQInteger k = 0; k < exp->_nsubexpr; k++) {
+					const SQChar *b = t->slots[k*2], *e = t->slots[k*2+1];
+					exp->_matches[k].begin = (b && e) ? b : 0;
+					exp->_matches[k].len = (b && e) ? e - b : 0;
+				}
+				i = nc; //lower priority threads are cut
+				continue;
+			case NFA_CHAR: ok = sp < exp->_eol && *sp == in->x; break;
+			case NFA_ANY: ok = sp < exp->_eol; break;
+			case NFA_CLASS: {
+				SQRexNode *node = &exp->_nodes[in->x];
+				ok = sp < exp->_eol && (sqstd_rex_matchclass(exp,&exp->_nodes[node->left],*sp) ? node->type == OP_CLASS : node->type == OP_NCLASS);
+				break;
+			}
+			case NFA_CCLASS: ok = sp < exp->_eol && sqstd_rex_matchcclass(in->x,*sp); break;
+			}
+			if(ok) sqstd_rex_addthread(exp,nlist,&nn,t->pc+1,t->slots,sp+1);
+		}
+		if(sp >= exp->_eol) break;
+		sp++;
+		//unanchored searches start a new, lowest priority, attempt at every position until one matches.
+		//With a literal prefix only its occurrences are tried, skipping ahead while no thread is alive
+		if(restart && !matched && sp < exp->_eol) {
+			if(exp->_prefixlen) {
+				if(cand && cand < sp) cand = sqstd_rex_findliteral(sp,exp->_eol,exp->_prefix,exp->_prefixlen);
+				if(nn == 0 && cand) sp = cand;
+			}
+			if(!exp->_prefixlen || sp == cand) {
+				for(i = 0; i < nslots; i++) start[i] = NULL;
+				sqstd_rex_addthread(exp,nlist,&nn,0,start,sp);
+			}
+		}
+		if(nn == 0) break;
+		tmp = clist; clist = nlist; nlist = tmp;
+		nc = nn;
+	}
+	if(!matched) return NULL;
+	if(out_begin) *out_begin = exp->_matches[0].begin;
+	return exp->_matches[0].begin + exp->_matches[0].len;
+}
+
 /* public api */
 SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
 {
@@ -533,6 +868,14 @@ SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
 	exp->_nsubexpr = 0;
 	exp->_first = sqstd_rex_newnode(exp,OP_EXPR);
 	exp->_error = error;
+	exp->_mode = SQREX_BACKTRACK;
+	exp->_prog = NULL;
+	exp->_threads = NULL;
+	exp->_slots = NULL;
+	exp->_marks = NULL;
+	exp->_ninst = exp->_nallocinst = 0;
+	exp->_anchored = SQFalse;
+	exp->_prefixlen = exp->_requiredlen = 0;
 	exp->_jmpbuf = sq_malloc(sizeof(jmp_buf));
 	if(setjmp(*((jmp_buf*)exp->_jmpbuf)) == 0) {
 		SQInteger res = sqstd_rex_list(exp);
@@ -558,6 +901,13 @@ SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
 #endif
 		exp->_matches = (SQRexMatch *) sq_malloc(exp->_nsubexpr * sizeof(SQRexMatch));
 		memset(exp->_matches,0,exp->_nsubexpr * sizeof(SQRexMatch));
+		if(sqstd_rex_compilenfa(exp))
+			exp->_mode = SQREX_NFA;
+		SQRexLiteral lit;
+		lit.len = 0;
+		lit.atstart = SQTrue;
+		sqstd_rex_literals(exp,exp->_first,&lit);
+		sqstd_rex_endliteral(exp,&lit);
 	}
 	else{
 		sqstd_rex_free(exp);
@@ -572,6 +922,7 @@ void sqstd_rex_free(SQRex *exp)
 		if(exp->_nodes) sq_free(exp->_nodes,exp->_nallocated * sizeof(SQRexNode));
 		if(exp->_jmpbuf) sq_free(exp->_jmpbuf,sizeof(jmp_buf));
 		if(exp->_matches) sq_free(exp->_matches,exp->_nsubexpr * sizeof(SQRexMatch));
+		sqstd_rex_freenfa(exp);
 		sq_free(exp,sizeof(SQRex));
 	}
 }
@@ -582,6 +933,10 @@ SQBool sqstd_rex_match(SQRex* exp,const SQChar* text)
 	exp->_bol = text;
 	exp->_eol = text + scstrlen(text);
 	exp->_currsubexp = 0;
+	if(exp->_prefixlen && (exp->_eol - text < exp->_prefixlen || memcmp(text,exp->_prefix,exp->_prefixlen * sizeof(SQChar)) != 0))
+		return SQFalse;
+	if(exp->_mode == SQREX_NFA)
+		return sqstd_rex_nfaexec(exp,text,SQTrue,NULL) ? SQTrue : SQFalse;
 	res = sqstd_rex_matchnode(exp,exp->_nodes,text,NULL);
 	if(res == NULL || res != exp->_eol)
 		return SQFalse;
@@ -595,7 +950,19 @@ SQBool sqstd_rex_searchrange(SQRex* exp,const SQChar* text_begin,const SQChar* t
 	if(text_begin >= text_end) return SQFalse;
 	exp->_bol = text_begin;
 	exp->_eol = text_end;
+	if(exp->_requiredlen > exp->_prefixlen && !sqstd_rex_findliteral(text_begin,text_end,exp->_required,exp->_requiredlen))
+		return SQFalse;
+	if(exp->_mode == SQREX_NFA) {
+		const SQChar *begin;
+		if(!(cur = sqstd_rex_nfaexec(exp,text_begin,SQFalse,&begin)))
+			return SQFalse;
+		if(out_begin) *out_begin = begin;
+		if(out_end) *out_end = cur;
+		return SQTrue;
+	}
 	do {
+		if(exp->_prefixlen && !(text_begin = sqstd_rex_findliteral(text_begin,text_end,exp->_prefix,exp->_prefixlen)))
+			return SQFalse;
 		cur = text_begin;
 		while(node != -1) {
 			exp->_currsubexp = 0;
@@ -605,7 +972,7 @@ SQBool sqstd_rex_searchrange(SQRex* exp,const SQChar* text_begin,const SQChar* t
 			node = exp->_nodes[node].next;
 		}
 		text_begin++;
-	} while(cur == NULL && text_begin != text_end);
+	} while(cur == NULL && text_begin != text_end && !exp->_anchored);
 
 	if(cur == NULL)
 		return SQFalse;
@@ -634,3 +1001,16 @@ SQBool sqstd_rex_getsubexp(SQRex* exp, SQInteger n, SQRexMatch *subexp)
 	return SQTrue;
 }
 
+
+SQInteger sqstd_rex_getmode(SQRex* exp)
+{
+	return exp->_mode;
+}
+
+SQBool sqstd_rex_setmode(SQRex* exp, SQInteger mode)
+{
+	if(mode == SQREX_NFA && !exp->_prog) return SQFalse;
+	if(mode != SQREX_NFA && mode != SQREX_BACKTRACK) return SQFalse;
+	exp->_mode = mode;
+	return SQTrue;
+}
@@ -19,18 +19,20 @@
 SQInteger _stream_readblob(HSQUIRRELVM v)
 {
 	SETUP_STREAM(v);
-	SQUserPointer data,blobp;
+	SQBlob *blob = NULL;
 	SQInteger size,res;
 	sq_getinteger(v,2,&size);
 	if(size > self->Len()) {
 		size = self->Len();
 	}
-	data = sq_getscratchpad(v,size);
-	res = self->Read(data,size);
+	//reads straight into the blob so the buffer counts against the memory limit
+	if(!sqstd_createblob(v,size))
+		return sq_throwerror(v,_SC("not enough memory"));
+	sq_getinstanceup(v,-1,(SQUserPointer*)&blob,(SQUserPointer)SQSTD_BLOB_TYPE_TAG);
+	res = self->Read(blob->GetBuf(),size);
 	if(res <= 0)
 		return sq_throwerror(v,_SC("no data left to read"));
-	blobp = sqstd_createblob(v,res);
-	memcpy(blobp,data,res);
+	if(res < size) blob->Resize(res);
 	return 1;
 }
 
@@ -97,6 +99,104 @@ SQInteger _stream_readn(HSQUIRRELVM v)
 	return 1;
 }
 
+static SQInteger __stream_formatsize(SQInteger format)
+{
+	switch(format) {
+	case 'l': return sizeof(SQInteger);
+	case 'i': return sizeof(SQInt32);
+	case 's': return sizeof(short);
+	case 'w': return sizeof(unsigned short);
+	case 'c': return sizeof(char);
+	case 'b': return sizeof(unsigned char);
+	case 'f': return sizeof(float);
+	case 'd': return sizeof(double);
+	}
+	return 0;
+}
+
+static SQInteger __stream_remaining(SQStream *self)
+{
+	SQInteger n = self->Len() - self->Tell();
+	return n > 0 ? n : 0;
+}
+
+static void __stream_swap(unsigned char *data,SQInteger size,SQInteger count)
+{
+	for(SQInteger i = 0; i < count; i++, data += size) {
+		switch(size) {
+		case 2: __swap_word((unsigned short *)data); break;
+		case 4: __swap_dword((unsigned int *)data); break;
+		case 8: __swap_qword((unsigned int *)data); break;
+		}
+	}
+}
+
+#define READ_ARRAY(type,push,cast) { \
+	type *t = (type *)data; \
+	for(SQInteger i = 0; i < count; i++) { \
+		push(v, (cast)t[i]); \
+		sq_arrayappend(v, -2); \
+	} \
+	}
+SQInteger _stream_readarray(HSQUIRRELVM v)
+{
+	SETUP_STREAM(v);
+	SQInteger format, count, size;
+	SQBool swap = SQFalse;
+	sq_getinteger(v, 2, &format);
+	sq_getinteger(v, 3, &count);
+	if(sq_gettop(v) > 3) sq_getbool(v, 4, &swap);
+	if(!(size = __stream_formatsize(format)))
+		return sq_throwerror(v, _SC("invalid format"));
+	if(count < 0)
+		return sq_throwerror(v, _SC("invalid count"));
+	//also keeps count * size from overflowing
+	if(count > __stream_remaining(self) / size)
+		return sq_throwerror(v, _SC("not enough data left to read"));
+	unsigned char *data = (unsigned char *)sq_getscratchpad(v, count * size);
+	SAFE_READN(data, count * size);
+	if(swap) __stream_swap(data, size, count);
+	sq_newarray(v, 0);
+	switch(format) {
+	case 'l': READ_ARRAY(SQInteger, sq_pushinteger, SQInteger); break;
+	case 'i': READ_ARRAY(SQInt32, sq_pushinteger, SQInteger); break;
+	case 's': READ_ARRAY(short, sq_pushinteger, SQInteger); break;
+	case 'w': READ_ARRAY(unsigned short, sq_pushinteger, SQInteger); break;
+	case 'c': READ_ARRAY(char, sq_pushinteger, SQInteger); break;
+	case 'b': READ_ARRAY(unsigned char, sq_pushinteger, SQInteger); break;
+	case 'f': READ_ARRAY(float, sq_pushfloat, SQFloat); break;
+	case 'd': READ_ARRAY(double, sq_pushfloat, SQFloat); break;
+	}
+	return 1;
+}
+
+SQInteger _stream_readinto(HSQUIRRELVM v)
+{
+	SETUP_STREAM(v);
+	SQBlob *blob = NULL;
+	SQInteger offset, size;
+	if(SQ_FAILED(sq_getinstanceup(v, 2, (SQUserPointer*)&blob, (SQUserPointer)SQSTD_BLOB_TYPE_TAG)) || !blob || !blob->IsValid())
+		return sq_throwerror(v, _SC("invalid parameter"));
+	if(blob == self)
+		return sq_throwerror(v, _SC("cannot read a blob into itself"));
+	sq_getinteger(v, 3, &offset);
+	sq_getinteger(v, 4, &size);
+	if(offset < 0 || offset > blob->Len() || size < 0)
+		return sq_throwerror(v, _SC("invalid range"));
+	SQInteger left = __stream_remaining(self);
+	if(size > left) size = left;
+	SQInteger len = blob->Len();
+	if(offset + size > len && !blob->GrowBufOf(offset + size - len))
+		return sq_throwerror(v, _SC("cannot grow the blob"));
+	SQInteger res = self->Read((unsigned char *)blob->GetBuf() + offset, size);
+	if(res < 0) res = 0;
+	//a short read only keeps what was actually read
+	if(res < size && offset + size > len)
+		blob->Resize(offset + res > len ? offset + res : len);
+	sq_pushinteger(v, res);
+	return 1;
+}
+
 SQInteger _stream_writeblob(HSQUIRRELVM v)
 {
 	SQUserPointer data;
@@ -180,6 +280,46 @@ SQInteger _stream_writen(HSQUIRRELVM v)
 	return 0;
 }
 
+#define WRITE_ARRAY(type,get,tmptype) { \
+	type *t = (type *)data; \
+	tmptype x; \
+	for(SQInteger i = 0; i < count; i++) { \
+		sq_pushinteger(v, i); \
+		sq_rawget(v, 3); \
+		if(SQ_FAILED(get(v, -1, &x))) \
+			return sq_throwerror(v, _SC("the array contains a non numeric value")); \
+		sq_poptop(v); \
+		t[i] = (type)x; \
+	} \
+	}
+SQInteger _stream_writearray(HSQUIRRELVM v)
+{
+	SETUP_STREAM(v);
+	SQInteger format, count, size;
+	SQBool swap = SQFalse;
+	sq_getinteger(v, 2, &format);
+	count = sq_getsize(v, 3);
+	if(sq_gettop(v) > 3) sq_getbool(v, 4, &swap);
+	if(!(size = __stream_formatsize(format)))
+		return sq_throwerror(v, _SC("invalid format"));
+	unsigned char *data = (unsigned char *)sq_getscratchpad(v, count * size);
+	switch(format) {
+	case 'l': WRITE_ARRAY(SQInteger, sq_getinteger, SQInteger); break;
+	case 'i': WRITE_ARRAY(SQInt32, sq_getinteger, SQInteger); break;
+	case 's': WRITE_ARRAY(short, sq_getinteger, SQInteger); break;
+	case 'w': WRITE_ARRAY(unsigned short, sq_getinteger, SQInteger); break;
+	case 'c': WRITE_ARRAY(char, sq_getinteger, SQInteger); break;
+	case 'b': WRITE_ARRAY(unsigned char, sq_getinteger, SQInteger); break;
+	case 'f': WRITE_ARRAY(float, sq_getfloat, SQFloat); break;
+	case 'd': WRITE_ARRAY(double, sq_getfloat, SQFloat); break;
+	}
+	if(swap) __stream_swap(data, size, count);
+	if(self->Write(data, count * size) != count * size)
+		return sq_throwerror(v, _SC("io error"));
+	sq_pushinteger(v, count * size);
+	return 1;
+}
+
 SQInteger _stream_seek(HSQUIRRELVM v)
 {
 	SETUP_STREAM(v);
@@ -243,6 +383,9 @@ static SQRegFunction _stream_methods[] = {
 	_DECL_STREAM_FUNC(readn,2,_SC("xn")),
 	_DECL_STREAM_FUNC(writeblob,-2,_SC("xx")),
 	_DECL_STREAM_FUNC(writen,3,_SC("xnn")),
+	_DECL_STREAM_FUNC(readarray,-3,_SC("xnnb")),
+	_DECL_STREAM_FUNC(writearray,-3,_SC("xnab")),
+	_DECL_STREAM_FUNC(readinto,4,_SC("xxnn")),
 	_DECL_STREAM_FUNC(seek,-2,_SC("xnn")),
 	_DECL_STREAM_FUNC(tell,1,_SC("x")),
 	_DECL_STREAM_FUNC(len,1,_SC("x")),
@@ -7,6 +7,9 @@ SQInteger _stream_readline(HSQUIRRELVM v);
 SQInteger _stream_readn(HSQUIRRELVM v);
 SQInteger _stream_writeblob(HSQUIRRELVM v);
 SQInteger _stream_writen(HSQUIRRELVM v);
+SQInteger _stream_readarray(HSQUIRRELVM v);
+SQInteger _stream_writearray(HSQUIRRELVM v);
+SQInteger _stream_readinto(HSQUIRRELVM v);
 SQInteger _stream_seek(HSQUIRRELVM v);
 SQInteger _stream_tell(HSQUIRRELVM v);
 SQInteger _stream_len(HSQUIRRELVM v);
@@ -226,17 +226,92 @@ static SQInteger _string_split(HSQUIRRELVM v)
 	return 1;
 }
 
+#define REX_CACHE_SIZE 32
+
+struct SQRexCache;
+
+struct SQRexObj {
+	SQRex *rex;
+	SQRexCache *cache;
+	SQChar *pattern;
+	SQInteger len;
+};
+
+//compiled patterns of released regexp instances, handed to the next instance built from
+//the same pattern. Every SQRexObj holds a reference, so instances can outlive the registry slot
+struct SQRexCache {
+	SQInteger refs;
+	SQBool open;
+	SQInteger n;
+	SQRexObj *entries[REX_CACHE_SIZE]; //most recently released first
+};
+
 #define SETUP_REX(v) \
-	SQRex *self = NULL; \
-	sq_getinstanceup(v,1,(SQUserPointer *)&self,0); 
+	SQRexObj *rexobj = NULL; \
+	sq_getinstanceup(v,1,(SQUserPointer *)&rexobj,0); \
+	SQRex *self = rexobj->rex;
+
+static void _rexobj_free(SQRexObj *self)
+{
+	SQRexCache *cache = self->cache;
+	sqstd_rex_free(self->rex);
+	sq_free(self->pattern,(self->len+1)*sizeof(SQChar));
+	sq_free(self,sizeof(SQRexObj));
+	if(cache && --cache->refs == 0) sq_free(cache,sizeof(SQRexCache));
+}
 
 static SQInteger _rexobj_releasehook(SQUserPointer p, SQInteger size)
 {
-	SQRex *self = ((SQRex *)p);
-	sqstd_rex_free(self);
+	SQRexObj *self = ((SQRexObj *)p);
+	SQRexCache *cache = self->cache;
+	if(!cache || !cache->open) {
+		_rexobj_free(self);
+		return 1;
+	}
+	if(cache->n == REX_CACHE_SIZE) _rexobj_free(cache->entries[--cache->n]);
+	memmove(&cache->entries[1],&cache->entries[0],cache->n*sizeof(SQRexObj *));
+	cache->entries[0] = self;
+	cache->n++;
+	return 1;
+}
+
+static SQInteger _rexcache_releasehook(SQUserPointer p, SQInteger size)
+{
+	SQRexCache *cache = *((SQRexCache **)p);
+	cache->open = SQFalse;
+	while(cache->n) _rexobj_free(cache->entries[--cache->n]);
+	if(--cache->refs == 0) sq_free(cache,sizeof(SQRexCache));
 	return 1;
 }
 
+static SQRexCache *_rexcache_get(HSQUIRRELVM v)
+{
+	SQRexCache **cache = NULL;
+	sq_pushregistrytable(v);
+	sq_pushstring(v,_SC("std_regexp_cache"),-1);
+	if(SQ_SUCCEEDED(sq_rawget(v,-2))) {
+		sq_getuserdata(v,-1,(SQUserPointer *)&cache,NULL);
+		sq_poptop(v);
+	}
+	sq_poptop(v);
+	return cache ? *cache : NULL;
+}
+
+//takes a compiled pattern out of the cache and puts it back in its default mode
+static SQRexObj *_rexcache_take(SQRexCache *cache,const SQChar *pattern,SQInteger len)
+{
+	for(SQInteger i = 0; i < cache->n; i++) {
+		SQRexObj *obj = cache->entries[i];
+		if(obj->len == len && memcmp(obj->pattern,pattern,len*sizeof(SQChar)) == 0) {
+			memmove(&cache->entries[i],&cache->entries[i+1],(cache->n-i-1)*sizeof(SQRexObj *));
+			cache->n--;
+			if(!sqstd_rex_setmode(obj->rex,SQREX_NFA)) sqstd_rex_setmode(obj->rex,SQREX_BACKTRACK);
+			return obj;
+		}
+	}
+	return NULL;
+}
+
 static SQInteger _regexp_match(HSQUIRRELVM v)
 {
 	SETUP_REX(v);
@@ -311,13 +386,43 @@ static SQInteger _regexp_constructor(HSQUIRRELVM v)
 {
 	const SQChar *error,*pattern;
 	sq_getstring(v,2,&pattern);
-	SQRex *rex = sqstd_rex_compile(pattern,&error);
-	if(!rex) return sq_throwerror(v,error);
-	sq_setinstanceup(v,1,rex);
+	SQInteger len = sq_getsize(v,2);
+	SQRexCache *cache = _rexcache_get(v);
+	SQRexObj *obj = cache ? _rexcache_take(cache,pattern,len) : NULL;
+	if(!obj) {
+		SQRex *rex = sqstd_rex_compile(pattern,&error);
+		if(!rex) return sq_throwerror(v,error);
+		obj = (SQRexObj *)sq_malloc(sizeof(SQRexObj));
+		obj->rex = rex;
+		obj->cache = cache;
+		obj->pattern = (SQChar *)sq_malloc((len+1)*sizeof(SQChar));
+		memcpy(obj->pattern,pattern,(len+1)*sizeof(SQChar));
+		obj->len = len;
+		if(cache) cache->refs++;
+	}
+	SQRex *rex = obj->rex;
+	sq_setinstanceup(v,1,obj);
 	sq_setreleasehook(v,1,_rexobj_releasehook);
+	if(sq_gettop(v) > 2) {
+		const SQChar *mode;
+		sq_getstring(v,3,&mode);
+		if(scstrcmp(mode,_SC("backtrack")) == 0) sqstd_rex_setmode(rex,SQREX_BACKTRACK);
+		else if(scstrcmp(mode,_SC("nfa")) == 0) {
+			if(!sqstd_rex_setmode(rex,SQREX_NFA))
+				return sq_throwerror(v,_SC("pattern too large for the nfa engine"));
+		}
+		else return sq_throwerror(v,_SC("invalid mode, expected \"nfa\" or \"backtrack\""));
+	}
 	return 0;
 }
 
+static SQInteger _regexp_mode(HSQUIRRELVM v)
+{
+	SETUP_REX(v);
+	sq_pushstring(v,sqstd_rex_getmode(self) == SQREX_NFA ? _SC("nfa") : _SC("backtrack"),-1);
+	return 1;
+}
+
 static SQInteger _regexp__typeof(HSQUIRRELVM v)
 {
 	sq_pushstring(v,_SC("regexp"),-1);
@@ -326,16 +431,149 @@ static SQInteger _regexp__typeof(HSQUIRRELVM v)
 
 #define _DECL_REX_FUNC(name,nparams,pmask) {_SC(#name),_regexp_##name,nparams,pmask}
 static SQRegFunction rexobj_funcs[]={
-	_DECL_REX_FUNC(constructor,2,_SC(".s")),
+	_DECL_REX_FUNC(constructor,-2,_SC(".ss")),
 	_DECL_REX_FUNC(search,-2,_SC("xsn")),
 	_DECL_REX_FUNC(match,2,_SC("xs")),
 	_DECL_REX_FUNC(capture,-2,_SC("xsn")),
 	_DECL_REX_FUNC(subexpcount,1,_SC("x")),
+	_DECL_REX_FUNC(mode,1,_SC("x")),
 	_DECL_REX_FUNC(_typeof,1,_SC("x")),
 	{0,0}
 };
 #undef _DECL_REX_FUNC
 
+#define SQSTD_STRINGBUILDER_TYPE_TAG 0x40000001
+
+struct SQStringBuilder {
+	HSQMEMORY mem;
+	SQChar *buf;
+	SQInteger len;
+	SQInteger allocated;
+};
+
+#define SETUP_STRINGBUILDER(v) \
+	SQStringBuilder *self = NULL; \
+	if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer *)&self,(SQUserPointer)SQSTD_STRINGBUILDER_TYPE_TAG))) \
+		return sq_throwerror(v,_SC("invalid type tag")); \
+	if(!self) \
+		return sq_throwerror(v,_SC("the stringbuilder is invalid"));
+
+static SQInteger _stringbuilder_releasehook(SQUserPointer p, SQInteger size)
+{
+	SQStringBuilder *self = ((SQStringBuilder *)p);
+	if(self->buf) sq_memfree(self->mem,self->buf,self->allocated*sizeof(SQChar));
+	sq_memfree(self->mem,self,sizeof(SQStringBuilder));
+	return 1;
+}
+
+//the contents are only interned when tostring() is called
+static SQRESULT _stringbuilder_write(HSQUIRRELVM v,SQStringBuilder *self,const SQChar *s,SQInteger len)
+{
+	if(self->len + len > self->allocated) {
+		SQInteger newsize = self->allocated ? self->allocated * 2 : 64;
+		while(newsize < self->len + len) newsize *= 2;
+		SQChar *buf = (SQChar *)sq_memrealloc(self->mem,self->buf,self->allocated*sizeof(SQChar),newsize*sizeof(SQChar));
+		if(!buf) return sq_throwerror(v,_SC("not enough memory"));
+		self->buf = buf;
+		self->allocated = newsize;
+	}
+	memcpy(self->buf+self->len,s,len*sizeof(SQChar));
+	self->len += len;
+	return SQ_OK;
+}
+
+static SQInteger _stringbuilder_constructor(HSQUIRRELVM v)
+{
+	SQInteger size = 0;
+	if(sq_gettop(v) > 1) sq_getinteger(v,2,&size);
+	if(size < 0) return sq_throwerror(v,_SC("cannot create a stringbuilder with negative size"));
+	HSQMEMORY mem = sq_getmemory(v);
+	SQStringBuilder *self = (SQStringBuilder *)sq_memmalloc(mem,sizeof(SQStringBuilder));
+	if(!self) return sq_throwerror(v,_SC("not enough memory"));
+	self->mem = mem;
+	self->buf = size ? (SQChar *)sq_memmalloc(mem,size*sizeof(SQChar)) : NULL;
+	if(size && !self->buf) {
+		sq_memfree(mem,self,sizeof(SQStringBuilder));
+		return sq_throwerror(v,_SC("not enough memory"));
+	}
+	self->len = 0;
+	self->allocated = size;
+	if(SQ_FAILED(sq_setinstanceup(v,1,self))) {
+		_stringbuilder_releasehook(self,0);
+		return sq_throwerror(v,_SC("cannot create stringbuilder"));
+	}
+	sq_setreleasehook(v,1,_stringbuilder_releasehook);
+	return 0;
+}
+
+static SQInteger _stringbuilder_append(HSQUIRRELVM v)
+{
+	SETUP_STRINGBUILDER(v);
+	const SQChar *str;
+	if(sq_gettype(v,2) != OT_STRING && SQ_FAILED(sq_tostring(v,2)))
+		return SQ_ERROR;
+	sq_getstring(v,-1,&str);
+	if(SQ_FAILED(_stringbuilder_write(v,self,str,sq_getsize(v,-1))))
+		return SQ_ERROR;
+	sq_push(v,1);
+	return 1;
+}
+
+static SQInteger _stringbuilder_appendf(HSQUIRRELVM v)
+{
+	SETUP_STRINGBUILDER(v);
+	SQChar *dest = NULL;
+	SQInteger length = 0;
+	if(SQ_FAILED(sqstd_format(v,2,&length,&dest)))
+		return -1;
+	if(SQ_FAILED(_stringbuilder_write(v,self,dest,length)))
+		return SQ_ERROR;
+	sq_push(v,1);
+	return 1;
+}
+
+static SQInteger _stringbuilder_clear(HSQUIRRELVM v)
+{
+	SETUP_STRINGBUILDER(v);
+	self->len = 0;
+	sq_push(v,1);
+	return 1;
+}
+
+static SQInteger _stringbuilder_len(HSQUIRRELVM v)
+{
+	SETUP_STRINGBUILDER(v);
+	sq_pushinteger(v,self->len);
+	return 1;
+}
+
+static SQInteger _stringbuilder_tostring(HSQUIRRELVM v)
+{
+	SETUP_STRINGBUILDER(v);
+	sq_pushstring(v,self->len ? self->buf : _SC(""),self->len);
+	return 1;
+}
+
+static SQInteger _stringbuilder__typeof(HSQUIRRELVM v)
+{
+	sq_pushstring(v,_SC("stringbuilder"),-1);
+	return 1;
+}
+
+#define _DECL_STRINGBUILDER_FUNC(name,nparams,pmask) {_SC(#name),_stringbuilder_##name,nparams,pmask}
+static SQRegFunction stringbuilder_funcs[]={
+	_DECL_STRINGBUILDER_FUNC(constructor,-1,_SC("xn")),
+	_DECL_STRINGBUILDER_FUNC(append,2,_SC("x.")),
+	_DECL_STRINGBUILDER_FUNC(appendf,-2,_SC("xs")),
+	_DECL_STRINGBUILDER_FUNC(clear,1,_SC("x")),
+	_DECL_STRINGBUILDER_FUNC(len,1,_SC("x")),
+	_DECL_STRINGBUILDER_FUNC(tostring,1,_SC("x")),
+	{_SC("_tostring"),_stringbuilder_tostring,1,_SC("x")},
+	_DECL_STRINGBUILDER_FUNC(_typeof,1,_SC("x")),
+	{0,0}
+};
+#undef _DECL_STRINGBUILDER_FUNC
+
 #define _DECL_FUNC(name,nparams,pmask) {_SC(#name),_string_##name,nparams,pmask}
 static SQRegFunction stringlib_funcs[]={
 	_DECL_FUNC(format,-2,_SC(".s")),
@@ -348,13 +586,14 @@ static SQRegFunction stringlib_funcs[]={
 #undef _DECL_FUNC
 
 
-SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
+static void _register_class(HSQUIRRELVM v,const SQChar *name,SQUserPointer typetag,SQRegFunction *funcs)
 {
-	sq_pushstring(v,_SC("regexp"),-1);
+	sq_pushstring(v,name,-1);
 	sq_newclass(v,SQFalse);
+	if(typetag) sq_settypetag(v,-1,typetag);
 	SQInteger i = 0;
-	while(rexobj_funcs[i].name != 0) {
-		SQRegFunction &f = rexobj_funcs[i];
+	while(funcs[i].name != 0) {
+		SQRegFunction &f = funcs[i];
 		sq_pushstring(v,f.name,-1);
 		sq_newclosure(v,f.f,0);
 		sq_setparamscheck(v,f.nparamscheck,f.typemask);
@@ -363,8 +602,25 @@ SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
 		i++;
 	}
 	sq_newslot(v,-3,SQFalse);
+}
 
-	i = 0;
+SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
+{
+	_register_class(v,_SC("regexp"),NULL,rexobj_funcs);
+	_register_class(v,_SC("stringbuilder"),(SQUserPointer)SQSTD_STRINGBUILDER_TYPE_TAG,stringbuilder_funcs);
+
+	sq_pushregistrytable(v);
+	sq_pushstring(v,_SC("std_regexp_cache"),-1);
+	SQRexCache *cache = (SQRexCache *)sq_malloc(sizeof(SQRexCache));
+	cache->refs = 1;
+	cache->open = SQTrue;
+	cache->n = 0;
+	*((SQRexCache **)sq_newuserdata(v,sizeof(SQRexCache *))) = cache;
+	sq_setreleasehook(v,-1,_rexcache_releasehook);
+	sq_newslot(v,-3,SQFalse);
+	sq_poptop(v);
+
+	SQInteger i = 0;
 	while(stringlib_funcs[i].name!=0)
 	{
 		sq_pushstring(v,stringlib_funcs[i].name,-1);
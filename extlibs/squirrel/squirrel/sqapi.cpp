@@ -39,18 +39,29 @@ SQInteger sq_aux_invalidtype(HSQUIRRELVM v,SQObjectType type)
 }
 
 HSQUIRRELVM sq_open(SQInteger initialstacksize)
+{
+	SQAllocator slab;
+	if(!sq_slab_create(&slab))
+		return sq_openwithallocator(initialstacksize, &sq_defaultallocator);
+	HSQUIRRELVM v = sq_openwithallocator(initialstacksize, &slab);
+	if(!v) sq_slab_destroy(&slab);
+	return v;
+}
+
+HSQUIRRELVM sq_openwithallocator(SQInteger initialstacksize,const SQAllocator *allocator)
 {
 	SQSharedState *ss;
 	SQVM *v;
-	sq_new(ss, SQSharedState);
+	ss = (SQSharedState *)allocator->mallocfunc(allocator->up, sizeof(SQSharedState));
+	new (ss) SQSharedState(*allocator);
 	ss->Init();
-	v = (SQVM *)SQ_MALLOC(sizeof(SQVM));
+	v = (SQVM *)SQ_MALLOC(ss,sizeof(SQVM));
 	new (v) SQVM(ss);
 	ss->_root_vm = v;
 	if(v->Init(NULL, initialstacksize)) {
 		return v;
 	} else {
-		sq_delete(v, SQVM);
+		sq_delete(ss, v, SQVM);
 		return NULL;
 	}
 	return v;
@@ -62,14 +73,14 @@ HSQUIRRELVM sq_newthread(HSQUIRRELVM friendvm, SQInteger initialstacksize)
 	SQVM *v;
 	ss=_ss(friendvm);
 	
-	v= (SQVM *)SQ_MALLOC(sizeof(SQVM));
+	v= (SQVM *)SQ_MALLOC(ss,sizeof(SQVM));
 	new (v) SQVM(ss);
 	
 	if(v->Init(friendvm, initialstacksize)) {
 		friendvm->Push(v);
 		return v;
 	} else {
-		sq_delete(v, SQVM);
+		sq_delete(ss, v, SQVM);
 		return NULL;
 	}
 }
@@ -114,8 +125,37 @@ void sq_setdebughook(HSQUIRRELVM v)
 void sq_close(HSQUIRRELVM v)
 {
 	SQSharedState *ss = _ss(v);
+	SQAllocator alloc = ss->_alloc;
 	_thread(ss->_root_vm)->Finalize();
-	sq_delete(ss, SQSharedState);
+	ss->~SQSharedState();
+	alloc.freefunc(alloc.up, ss, sizeof(SQSharedState));
+	sq_slab_destroy(&alloc);
+}
+
+void sq_getallocator(HSQUIRRELVM v,SQAllocator *allocator)
+{
+	*allocator = _ss(v)->_alloc;
+}
+
+SQInteger sq_getslabstats(HSQUIRRELVM v,SQSlabClassStats *stats)
+{
+	return sq_slab_getstats(&_ss(v)->_alloc, stats);
+}
+
+void sq_getmemorystats(HSQUIRRELVM v,SQMemoryStats *stats)
+{
+	SQSharedState *ss = _ss(v);
+	stats->used = ss->_memused;
+	stats->peak = ss->_mempeak;
+	stats->allocations = ss->_memallocs;
+	stats->limit = ss->_memlimit;
+}
+
+void sq_setmemorylimit(HSQUIRRELVM v,SQUnsignedInteger limit)
+{
+	SQSharedState *ss = _ss(v);
+	ss->_memlimit = limit;
+	ss->_memlimitreached = limit && ss->_memused > limit;
 }
 
 SQInteger sq_getversion()
@@ -421,7 +461,7 @@ SQRESULT sq_setparamscheck(HSQUIRRELVM v,SQInteger nparamscheck,const SQChar *ty
 	SQNativeClosure *nc = _nativeclosure(o);
 	nc->_nparamscheck = nparamscheck;
 	if(typemask) {
-		SQIntVec res;
+		SQIntVec res(_ss(v));
 		if(!CompileTypemask(res, typemask))
 			return sq_throwerror(v, _SC("invalid typemask"));
 		nc->_typecheck.copy(res);
@@ -446,7 +486,7 @@ SQRESULT sq_bindenv(HSQUIRRELVM v,SQInteger idx)
 		!sq_isclass(env) &&
 		!sq_isinstance(env))
 		return sq_throwerror(v,_SC("invalid environment"));
-	SQWeakRef *w = _refcounted(env)->GetWeakRef(type(env));
+	SQWeakRef *w = _refcounted(env)->GetWeakRef(_ss(v),type(env));
 	SQObjectPtr ret;
 	if(sq_isclosure(o)) {
 		SQClosure *c = _closure(o)->Clone();
@@ -1175,6 +1215,34 @@ SQRESULT sq_readclosure(HSQUIRRELVM v,SQREADFUNC r,SQUserPointer up)
 	return SQ_OK;
 }
 
+SQRESULT sq_readclosurebuffer(HSQUIRRELVM v,const void *buf,SQInteger size)
+{
+	SQMemoryReader reader;
+	reader._buf = (const unsigned char *)buf;
+	reader._size = buf ? size : 0;
+	reader._pos = 0;
+	return sq_readclosure(v,SQMemoryReader::Read,&reader);
+}
+
+SQRESULT sq_getclosurestringcount(HSQUIRRELVM v,SQInteger idx,SQInteger *count)
+{
+	SQObjectPtr *o = NULL;
+	_GETSAFE_OBJ(v, idx, OT_CLOSURE,o);
+	*count = _closure(*o)->_function->CountStrings();
+	return SQ_OK;
+}
+
+void sq_reservestrings(HSQUIRRELVM v,SQInteger count)
+{
+	if(count > 0)
+		_ss(v)->_stringtable->Reserve(count);
+}
+
+void sq_getstringtablestats(HSQUIRRELVM v,SQStringTableStats *stats)
+{
+	_ss(v)->_stringtable->GetStats(stats);
+}
+
 SQChar *sq_getscratchpad(HSQUIRRELVM v,SQInteger minsize)
 {
 	return _ss(v)->GetScratchPad(minsize);
@@ -1199,6 +1267,25 @@ SQInteger sq_collectgarbage(HSQUIRRELVM v)
 #endif
 }
 
+SQBool sq_collectgarbage_step(HSQUIRRELVM v,SQInteger budget)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+	return _ss(v)->CollectGarbageStep(v,budget)?SQTrue:SQFalse;
+#else
+	return SQTrue;
+#endif
+}
+
+void sq_setgcpacing(HSQUIRRELVM v,SQInteger growth,SQInteger stepsize)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+	SQSharedState *ss = _ss(v);
+	ss->_gcpause = growth > 0 ? growth : 0;
+	ss->_gcstepsize = stepsize > 0 ? stepsize : 0;
+	ss->GCSetThreshold();
+#endif
+}
+
 SQRESULT sq_getcallee(HSQUIRRELVM v)
 {
 	if(v->_callsstacksize > 1)
@@ -1408,7 +1495,7 @@ void sq_weakref(HSQUIRRELVM v,SQInteger idx)
 {
 	SQObject &o=stack_get(v,idx);
 	if(ISREFCOUNTED(type(o))) {
-		v->Push(_refcounted(o)->GetWeakRef(type(o)));
+		v->Push(_refcounted(o)->GetWeakRef(_ss(v),type(o)));
 		return;
 	}
 	v->Push(o);
@@ -1460,26 +1547,17 @@ SQRESULT sq_next(HSQUIRRELVM v,SQInteger idx)
 	return SQ_ERROR;
 }
 
-struct BufState{
-	const SQChar *buf;
-	SQInteger ptr;
-	SQInteger size;
-};
-
-SQInteger buf_lexfeed(SQUserPointer file)
-{
-	BufState *buf=(BufState*)file;
-	if(buf->size<(buf->ptr+1))
-		return 0;
-	return buf->buf[buf->ptr++];
-}
-
 SQRESULT sq_compilebuffer(HSQUIRRELVM v,const SQChar *s,SQInteger size,const SQChar *sourcename,SQBool raiseerror) {
-	BufState buf;
-	buf.buf = s;
-	buf.size = size;
-	buf.ptr = 0;
-	return sq_compile(v, buf_lexfeed, &buf, sourcename, raiseerror);
+	SQObjectPtr o;
+#ifndef NO_COMPILER
+	if(CompileBuffer(v, s, size, sourcename, o, raiseerror?true:false, _ss(v)->_debuginfo)) {
+		v->Push(SQClosure::Create(_ss(v), _funcproto(o)));
+		return SQ_OK;
+	}
+	return SQ_ERROR;
+#else
+	return sq_throwerror(v,_SC("this is a no compiler build"));
+#endif
 }
 
 void sq_move(HSQUIRRELVM dest,HSQUIRRELVM src,SQInteger idx)
@@ -1505,15 +1583,38 @@ SQPRINTFUNCTION sq_geterrorfunc(HSQUIRRELVM v)
 
 void *sq_malloc(SQUnsignedInteger size)
 {
-	return SQ_MALLOC(size);
+	return malloc(size);
 }
 
 void *sq_realloc(void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize)
 {
-	return SQ_REALLOC(p,oldsize,newsize);
+	return realloc(p,newsize);
 }
 
 void sq_free(void *p,SQUnsignedInteger size)
 {
-	SQ_FREE(p,size);
+	free(p);
+}
+
+//memory counted against the VM's limit; it stays valid until sq_close, threads included
+HSQMEMORY sq_getmemory(HSQUIRRELVM v)
+{
+	return _ss(v);
+}
+
+//NULL when the VM's memory limit would be exceeded, m==NULL falls back to sq_malloc
+void *sq_memmalloc(HSQMEMORY m,SQUnsignedInteger size)
+{
+	return m ? sq_vm_tryrealloc(m,NULL,0,size) : sq_malloc(size);
+}
+
+void *sq_memrealloc(HSQMEMORY m,void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize)
+{
+	return m ? sq_vm_tryrealloc(m,p,oldsize,newsize) : sq_realloc(p,oldsize,newsize);
+}
+
+void sq_memfree(HSQMEMORY m,void *p,SQUnsignedInteger size)
+{
+	if(m) sq_vm_free(m,p,size);
+	else sq_free(p,size);
 }
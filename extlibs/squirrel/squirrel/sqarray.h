@@ -5,14 +5,14 @@
 struct SQArray : public CHAINABLE_OBJ
 {
 private:
-	SQArray(SQSharedState *ss,SQInteger nsize){_values.resize(nsize); INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+	SQArray(SQSharedState *ss,SQInteger nsize) : _values(ss) {_values.resize(nsize); INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
 	~SQArray()
 	{
 		REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
 	}
 public:
 	static SQArray* Create(SQSharedState *ss,SQInteger nInitialSize){
-		SQArray *newarray=(SQArray*)SQ_MALLOC(sizeof(SQArray));
+		SQArray *newarray=(SQArray*)SQ_MALLOC(ss,sizeof(SQArray));
 		new (newarray) SQArray(ss,nInitialSize);
 		return newarray;
 	}
@@ -62,6 +62,8 @@ public:
 		Resize(size,_null);
 	}
 	void Resize(SQInteger size,SQObjectPtr &fill) { _values.resize(size,fill); ShrinkIfNeeded(); }
+	//false when the memory limit would be exceeded, the array is left as it was
+	bool TryResize(SQInteger size,SQObjectPtr &fill) { if(!_values.tryresize(size,fill)) return false; ShrinkIfNeeded(); return true; }
 	void Reserve(SQInteger size) { _values.reserve(size); }
 	void Append(const SQObject &o){_values.push_back(o);}
 	void Extend(const SQArray *a);
@@ -86,7 +88,7 @@ public:
 	}
 	void Release()
 	{
-		sq_delete(this,SQArray);
+		sq_delete(_sharedstate,this,SQArray);
 	}
 	
 	SQObjectPtrVec _values;
@@ -51,6 +51,13 @@ static SQInteger base_collectgarbage(HSQUIRRELVM v)
 	sq_pushinteger(v, sq_collectgarbage(v));
 	return 1;
 }
+static SQInteger base_collectgarbagestep(HSQUIRRELVM v)
+{
+	SQInteger budget;
+	sq_getinteger(v, 2, &budget);
+	sq_pushbool(v, sq_collectgarbage_step(v, budget));
+	return 1;
+}
 static SQInteger base_resurectureachable(HSQUIRRELVM v)
 {
 	sq_resurrectunreachable(v);
@@ -232,15 +239,12 @@ static SQInteger base_suspend(HSQUIRRELVM v)
 
 static SQInteger base_array(HSQUIRRELVM v)
 {
-	SQArray *a;
-	SQObject &size = stack_get(v,2);
-	if(sq_gettop(v) > 2) {
-		a = SQArray::Create(_ss(v),0);
-		a->Resize(tointeger(size),stack_get(v,3));
-	}
-	else {
-		a = SQArray::Create(_ss(v),tointeger(size));
-	}
+	SQInteger size = tointeger(stack_get(v,2));
+	if(size < 0) return sq_throwerror(v,_SC("negative size"));
+	SQObjectPtr fill;
+	if(sq_gettop(v) > 2) fill = stack_get(v,3);
+	SQObjectPtr a = SQArray::Create(_ss(v),0);
+	if(!_array(a)->TryResize(size,fill)) return sq_throwerror(v,_SC("not enough memory"));
 	v->Push(a);
 	return 1;
 }
@@ -284,6 +288,7 @@ static SQRegFunction base_funcs[]={
 	{_SC("dummy"),base_dummy,0,NULL},
 #ifndef NO_GARBAGE_COLLECTOR
 	{_SC("collectgarbage"),base_collectgarbage,0, NULL},
+	{_SC("collectgarbagestep"),base_collectgarbagestep,2, _SC(".i")},
 	{_SC("resurrectunreachable"),base_resurectureachable,0, NULL},
 #endif
 	{0,0}
@@ -528,7 +533,8 @@ static SQInteger array_resize(HSQUIRRELVM v)
 	if(sq_isnumeric(nsize)) {
 		if(sq_gettop(v) > 2)
 			fill = stack_get(v, 3);
-		_array(o)->Resize(tointeger(nsize),fill);
+		if(tointeger(nsize) < 0) return sq_throwerror(v, _SC("negative size"));
+		if(!_array(o)->TryResize(tointeger(nsize),fill)) return sq_throwerror(v, _SC("not enough memory"));
 		return 0;
 	}
 	return sq_throwerror(v, _SC("size must be a number"));
@@ -10,7 +10,7 @@
 
 
 
-SQClass::SQClass(SQSharedState *ss,SQClass *base)
+SQClass::SQClass(SQSharedState *ss,SQClass *base) : _defaultvalues(ss), _methods(ss)
 {
 	_base = base;
 	_typetag = 0;
@@ -35,7 +35,11 @@ SQClass::SQClass(SQSharedState *ss,SQClass *base)
 
 void SQClass::Finalize() { 
 	_attributes.Null();
-	_defaultvalues.resize(0);
+	//keep the slots, instances finalized after their class still read the field count from here
+	for(SQUnsignedInteger i = 0; i < _defaultvalues.size(); i++) {
+		_defaultvalues[i].val.Null();
+		_defaultvalues[i].attrs.Null();
+	}
 	_methods.resize(0);
 	_NULL_SQOBJECT_VECTOR(_metamethods,MT_LAST);
 	__ObjRelease(_members);
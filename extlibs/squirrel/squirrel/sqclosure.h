@@ -14,7 +14,7 @@ private:
 public:
 	static SQClosure *Create(SQSharedState *ss,SQFunctionProto *func){
 		SQInteger size = _CALC_CLOSURE_SIZE(func);
-		SQClosure *nc=(SQClosure*)SQ_MALLOC(size);
+		SQClosure *nc=(SQClosure*)SQ_MALLOC(ss,size);
 		new (nc) SQClosure(ss,func);
 		nc->_outervalues = (SQObjectPtr *)(nc + 1);
 		nc->_defaultparams = &nc->_outervalues[func->_noutervalues];
@@ -28,8 +28,9 @@ public:
 		_DESTRUCT_VECTOR(SQObjectPtr,f->_noutervalues,_outervalues);
 		_DESTRUCT_VECTOR(SQObjectPtr,f->_ndefaultparams,_defaultparams);
 		__ObjRelease(_function);
+		SQSharedState *ss = _sharedstate;
 		this->~SQClosure();
-		sq_vm_free(this,size);
+		sq_vm_free(ss,this,size);
 	}
 	
 	SQClosure *Clone()
@@ -72,7 +73,7 @@ private:
 public:
 	static SQOuter *Create(SQSharedState *ss, SQObjectPtr *outer)
 	{
-		SQOuter *nc  = (SQOuter*)SQ_MALLOC(sizeof(SQOuter));
+		SQOuter *nc  = (SQOuter*)SQ_MALLOC(ss,sizeof(SQOuter));
 		new (nc) SQOuter(ss, outer);
 		return nc;
 	}
@@ -80,8 +81,9 @@ public:
 
 	void Release()
 	{
+		SQSharedState *ss = _sharedstate;
 		this->~SQOuter();
-		sq_vm_free(this,sizeof(SQOuter));
+		sq_vm_free(ss,this,sizeof(SQOuter));
 	}
 	
 #ifndef NO_GARBAGE_COLLECTOR
@@ -101,10 +103,10 @@ struct SQGenerator : public CHAINABLE_OBJ
 {
 	enum SQGeneratorState{eRunning,eSuspended,eDead};
 private:
-	SQGenerator(SQSharedState *ss,SQClosure *closure){_closure=closure;_state=eRunning;_ci._generator=NULL;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+	SQGenerator(SQSharedState *ss,SQClosure *closure) : _stack(ss), _etraps(ss) {_closure=closure;_state=eRunning;_ci._generator=NULL;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
 public:
 	static SQGenerator *Create(SQSharedState *ss,SQClosure *closure){
-		SQGenerator *nc=(SQGenerator*)SQ_MALLOC(sizeof(SQGenerator));
+		SQGenerator *nc=(SQGenerator*)SQ_MALLOC(ss,sizeof(SQGenerator));
 		new (nc) SQGenerator(ss,closure);
 		return nc;
 	}
@@ -117,7 +119,7 @@ public:
 		_stack.resize(0);
 		_closure.Null();}
 	void Release(){
-		sq_delete(this,SQGenerator);
+		sq_delete(_sharedstate,this,SQGenerator);
 	}
 	
 	bool Yield(SQVM *v,SQInteger target);
@@ -139,12 +141,12 @@ public:
 struct SQNativeClosure : public CHAINABLE_OBJ
 {
 private:
-	SQNativeClosure(SQSharedState *ss,SQFUNCTION func){_function=func;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this); _env = NULL;}
+	SQNativeClosure(SQSharedState *ss,SQFUNCTION func) : _typecheck(ss) {_function=func;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this); _env = NULL;}
 public:
 	static SQNativeClosure *Create(SQSharedState *ss,SQFUNCTION func,SQInteger nouters)
 	{
 		SQInteger size = _CALC_NATVIVECLOSURE_SIZE(nouters);
-		SQNativeClosure *nc=(SQNativeClosure*)SQ_MALLOC(size);
+		SQNativeClosure *nc=(SQNativeClosure*)SQ_MALLOC(ss,size);
 		new (nc) SQNativeClosure(ss,func);
 		nc->_outervalues = (SQObjectPtr *)(nc + 1);
 		nc->_noutervalues = nouters;
@@ -170,8 +172,9 @@ public:
 	void Release(){
 		SQInteger size = _CALC_NATVIVECLOSURE_SIZE(_noutervalues);
 		_DESTRUCT_VECTOR(SQObjectPtr,_noutervalues,_outervalues);
+		SQSharedState *ss = _sharedstate;
 		this->~SQNativeClosure();
-		sq_free(this,size);
+		sq_vm_free(ss,this,size);
 	}
 	
 #ifndef NO_GARBAGE_COLLECTOR
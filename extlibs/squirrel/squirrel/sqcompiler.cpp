@@ -71,10 +71,22 @@ class SQCompiler
 {
 public:
 	SQCompiler(SQVM *v, SQLEXREADFUNC rg, SQUserPointer up, const SQChar* sourcename, bool raiseerror, bool lineinfo)
+		: _lex(_ss(v))
 	{
 		_vm=v;
 		_lex.Init(_ss(v), rg, up,ThrowError,this);
-		_sourcename = SQString::Create(_ss(v), sourcename);
+		Setup(sourcename, raiseerror, lineinfo);
+	}
+	SQCompiler(SQVM *v, const SQChar *s, SQInteger size, const SQChar* sourcename, bool raiseerror, bool lineinfo)
+		: _lex(_ss(v))
+	{
+		_vm=v;
+		_lex.Init(_ss(v), s, size,ThrowError,this);
+		Setup(sourcename, raiseerror, lineinfo);
+	}
+	void Setup(const SQChar* sourcename, bool raiseerror, bool lineinfo)
+	{
+		_sourcename = SQString::Create(_ss(_vm), sourcename);
 		_lineinfo = lineinfo;_raiseerror = raiseerror;
 		_scope.outers = 0;
 		_scope.stacksize = 0;
@@ -426,6 +438,22 @@ public:
 			break;
 		case _SC('?'): {
 			Lex();
+			bool istrue;
+			if(ConstantCondition(istrue)) {
+				SQInteger trg = _fs->PushTarget();
+				SQInteger start = _fs->GetCurrentPos() + 1;
+				Expression();
+				SQInteger first_exp = _fs->PopTarget();
+				if(trg != first_exp) _fs->AddInstruction(_OP_MOVE, trg, first_exp);
+				if(!istrue) _fs->DiscardCode(start);
+				Expect(_SC(':'));
+				start = _fs->GetCurrentPos() + 1;
+				Expression();
+				SQInteger second_exp = _fs->PopTarget();
+				if(trg != second_exp) _fs->AddInstruction(_OP_MOVE, trg, second_exp);
+				if(istrue) _fs->DiscardCode(start);
+				break;
+			}
 			_fs->AddInstruction(_OP_JZ, _fs->PopTarget());
 			SQInteger jzpos = _fs->GetCurrentPos();
 			SQInteger trg = _fs->PushTarget();
@@ -451,8 +479,48 @@ public:
 	{
 		Lex(); (this->*f)();
 		SQInteger op1 = _fs->PopTarget();SQInteger op2 = _fs->PopTarget();
+		SQInteger operands[2] = { op2, op1 };
+		SQObjectPtr vals[2], res;
+		if(_fs->GetConstantOperands(2, operands, vals) && FoldOp(op, op3, vals[0], vals[1], res)) {
+			_fs->PopConstantOperands(2);
+			EmitLoadConst(res, _fs->PushTarget());
+			return;
+		}
 		_fs->AddInstruction(op, _fs->PushTarget(), op1, op2, op3);
 	}
+	//evaluates a binary operation on constants like SQVM::Execute would, false leaves it to run time
+	bool FoldOp(SQOpcode op, SQInteger op3, const SQObjectPtr &o1, const SQObjectPtr &o2, SQObjectPtr &res)
+	{
+		bool numeric = sq_isnumeric(o1) && sq_isnumeric(o2);
+		switch(op) {
+		case _OP_ADD:
+			if(!numeric && type(o1) != OT_STRING && type(o2) != OT_STRING) return false;
+			return _vm->ARITH_OP('+', res, o1, o2);
+		case _OP_SUB: return numeric && _vm->ARITH_OP('-', res, o1, o2);
+		case _OP_MUL: return numeric && _vm->ARITH_OP('*', res, o1, o2);
+		case _OP_DIV:
+		case _OP_MOD:
+			//division by zero raises at run time, MIN/-1 traps
+			if(!numeric || (type(o2) == OT_INTEGER && (_integer(o2) == 0 || _integer(o2) == -1))) return false;
+			return _vm->ARITH_OP(op == _OP_DIV ? '/' : '%', res, o1, o2);
+		case _OP_BITW:
+			if(type(o1) != OT_INTEGER || type(o2) != OT_INTEGER) return false;
+			if((op3 == BW_SHIFTL || op3 == BW_SHIFTR || op3 == BW_USHIFTR)
+				&& (_integer(o2) < 0 || _integer(o2) >= (SQInteger)(sizeof(SQInteger) * 8))) return false;
+			return _vm->BW_OP(op3, res, o1, o2);
+		case _OP_CMP:
+			if(!numeric && (type(o1) != OT_STRING || type(o2) != OT_STRING)) return false;
+			return _vm->CMP_OP((CmpOP)op3, o1, o2, res);
+		case _OP_EQ:
+		case _OP_NE: {
+			bool eq;
+			SQVM::IsEqual(o1, o2, eq);
+			res = op == _OP_EQ ? eq : !eq;
+			return true;
+			}
+		default: return false;
+		}
+	}
 	void LogicalOrExp()
 	{
 		LogicalAndExp();
@@ -760,12 +828,7 @@ public:
 					_es.epos = _fs->PushTarget();
 
 					/* generate direct or literal function depending on size */
-					SQObjectType ctype = type(constval);
-					switch(ctype) {
-						case OT_INTEGER: EmitLoadConstInt(_integer(constval),_es.epos); break;
-						case OT_FLOAT: EmitLoadConstFloat(_float(constval),_es.epos); break;
-						default: _fs->AddInstruction(_OP_LOAD,_es.epos,_fs->GetConstant(constval)); break;
-					}
+					EmitLoadConst(constval,_es.epos);
 					_es.etype = EXPR;
 				}
 				else {
@@ -875,12 +938,48 @@ public:
 			_fs->AddInstruction(_OP_LOAD, target, _fs->GetNumericConstant(value));
 		}
 	}
+	void EmitLoadConst(const SQObjectPtr &value,SQInteger target)
+	{
+		switch(type(value)) {
+			case OT_INTEGER: EmitLoadConstInt(_integer(value),target); break;
+			case OT_FLOAT: EmitLoadConstFloat(_float(value),target); break;
+			case OT_BOOL: _fs->AddInstruction(_OP_LOADBOOL,target,_integer(value)); break;
+			default: _fs->AddInstruction(_OP_LOAD,target,_fs->GetConstant(value)); break;
+		}
+	}
 	void UnaryOP(SQOpcode op)
 	{
 		PrefixedExpr();
 		SQInteger src = _fs->PopTarget();
+		SQObjectPtr val, res;
+		if(_fs->GetConstantOperands(1, &src, &val)) {
+			bool folded = true;
+			switch(op) {
+				case _OP_NEG: folded = sq_isnumeric(val) && _vm->NEG_OP(res, val); break;
+				case _OP_NOT: res = SQVM::IsFalse(val); break;
+				case _OP_BWNOT: if((folded = type(val) == OT_INTEGER)) res = ~_integer(val); break;
+				default: folded = false; break;
+			}
+			if(folded) {
+				_fs->PopConstantOperands(1);
+				EmitLoadConst(res, _fs->PushTarget());
+				return;
+			}
+		}
 		_fs->AddInstruction(op, _fs->PushTarget(), src);
 	}
+	//true when the condition just compiled is a constant, its load and target are dropped
+	bool ConstantCondition(bool &istrue)
+	{
+		SQInteger trg = _fs->TopTarget();
+		SQObjectPtr val;
+		if(!_fs->GetConstantOperands(1, &trg, &val)) return false;
+		_fs->PopConstantOperands(1);
+		_fs->PopTarget();
+		_fs->DiscardCode(_fs->GetCurrentPos() + 1);
+		istrue = !SQVM::IsFalse(val);
+		return true;
+	}
 	bool NeedGet()
 	{
 		switch(_token) {
@@ -1007,6 +1106,11 @@ public:
 		SQInteger jmppos;
 		bool haselse = false;
 		Lex(); Expect(_SC('(')); CommaExpr(); Expect(_SC(')'));
+		bool istrue;
+		if(ConstantCondition(istrue)) {
+			ConstantIfStatement(istrue);
+			return;
+		}
 		_fs->AddInstruction(_OP_JZ, _fs->PopTarget());
 		SQInteger jnepos = _fs->GetCurrentPos();
 		BEGIN_SCOPE();
@@ -1029,22 +1133,44 @@ public:
 		}
 		_fs->SetIntructionParam(jnepos, 1, endifblock - jnepos + (haselse?1:0));
 	}
+	//compiles both branches for their syntax but only keeps the code of the taken one
+	void ConstantIfStatement(bool istrue)
+	{
+		SQInteger start = _fs->GetCurrentPos() + 1;
+		BEGIN_SCOPE();
+		Statement();
+		if(_token != _SC('}') && _token != TK_ELSE) OptionalSemicolon();
+		END_SCOPE();
+		if(!istrue) _fs->DiscardCode(start);
+		if(_token == TK_ELSE){
+			start = _fs->GetCurrentPos() + 1;
+			BEGIN_SCOPE();
+			Lex();
+			Statement(); OptionalSemicolon();
+			END_SCOPE();
+			if(istrue) _fs->DiscardCode(start);
+		}
+	}
 	void WhileStatement()
 	{
 		SQInteger jzpos, jmppos;
 		jmppos = _fs->GetCurrentPos();
 		Lex(); Expect(_SC('(')); CommaExpr(); Expect(_SC(')'));
+		bool istrue, isconst = ConstantCondition(istrue);
 		
 		BEGIN_BREAKBLE_BLOCK();
-		_fs->AddInstruction(_OP_JZ, _fs->PopTarget());
-		jzpos = _fs->GetCurrentPos();
+		if(!isconst) {
+			_fs->AddInstruction(_OP_JZ, _fs->PopTarget());
+			jzpos = _fs->GetCurrentPos();
+		}
 		BEGIN_SCOPE();
 		
 		Statement();
 		
 		END_SCOPE();
 		_fs->AddInstruction(_OP_JMP, 0, jmppos - _fs->GetCurrentPos() - 1);
-		_fs->SetIntructionParam(jzpos, 1, _fs->GetCurrentPos() - jzpos);
+		if(!isconst) _fs->SetIntructionParam(jzpos, 1, _fs->GetCurrentPos() - jzpos);
+		else if(!istrue) _fs->DiscardCode(jmppos + 1);
 		
 		END_BREAKBLE_BLOCK(jmppos);
 	}
@@ -1089,7 +1215,7 @@ public:
 		_fs->SnoozeOpt();
 		SQInteger expend = _fs->GetCurrentPos();
 		SQInteger expsize = (expend - expstart) + 1;
-		SQInstructionVec exp;
+		SQInstructionVec exp(_ss(_vm));
 		if(expsize > 0) {
 			for(SQInteger i = 0; i < expsize; i++)
 				exp.push_back(_fs->GetInstruction(expstart + i));
@@ -1502,4 +1628,10 @@ bool Compile(SQVM *vm,SQLEXREADFUNC rg, SQUserPointer up, const SQChar *sourcena
 	return p.Compile(out);
 }
 
+bool CompileBuffer(SQVM *vm,const SQChar *s, SQInteger size, const SQChar *sourcename, SQObjectPtr &out, bool raiseerror, bool lineinfo)
+{
+	SQCompiler p(vm, s, size, sourcename, raiseerror, lineinfo);
+	return p.Compile(out);
+}
+
 #endif
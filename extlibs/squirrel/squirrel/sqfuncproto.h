@@ -73,9 +73,10 @@ public:
 	{
 		SQFunctionProto *f;
 		//I compact the whole class and members in a single memory allocation
-		f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
+		f = (SQFunctionProto *)sq_vm_malloc(ss,_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
 		new (f) SQFunctionProto(ss);
 		f->_ninstructions = ninstructions;
+		f->_inlinecaches = NULL;
 		f->_literals = (SQObjectPtr*)&f->_instructions[ninstructions];
 		f->_nliterals = nliterals;
 		f->_parameters = (SQObjectPtr*)&f->_literals[nliterals];
@@ -107,14 +108,17 @@ public:
 		//_DESTRUCT_VECTOR(SQLineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
 		_DESTRUCT_VECTOR(SQLocalVarInfo,_nlocalvarinfos,_localvarinfos);
 		SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+		SQSharedState *ss = _sharedstate;
+		if(_inlinecaches) sq_vm_free(ss,_inlinecaches,_ninstructions*sizeof(SQInlineCache));
 		this->~SQFunctionProto();
-		sq_vm_free(this,size);
+		sq_vm_free(ss,this,size);
 	}
 	
 	const SQChar* GetLocal(SQVM *v,SQUnsignedInteger stackbase,SQUnsignedInteger nseq,SQUnsignedInteger nop);
 	SQInteger GetLine(SQInstruction *curr);
 	bool Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
 	static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
+	SQInteger CountStrings();
 #ifndef NO_GARBAGE_COLLECTOR
 	void Mark(SQCollectable **chain);
 	void Finalize(){ _NULL_SQOBJECT_VECTOR(_literals,_nliterals); }
@@ -147,6 +151,7 @@ public:
 	SQInteger _ndefaultparams;
 	SQInteger *_defaultparams;
 	
+	SQInlineCache *_inlinecaches; //one per instruction, allocated by the first call
 	SQInteger _ninstructions;
 	SQInstruction _instructions[1];
 };
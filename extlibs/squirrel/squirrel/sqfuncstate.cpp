@@ -12,68 +12,9 @@
 
 #ifdef _DEBUG_DUMP
 SQInstructionDesc g_InstrDesc[]={
-	{_SC("_OP_LINE")},
-	{_SC("_OP_LOAD")},
-	{_SC("_OP_LOADINT")},
-	{_SC("_OP_LOADFLOAT")},
-	{_SC("_OP_DLOAD")},
-	{_SC("_OP_TAILCALL")},
-	{_SC("_OP_CALL")},
-	{_SC("_OP_PREPCALL")},
-	{_SC("_OP_PREPCALLK")},
-	{_SC("_OP_GETK")},
-	{_SC("_OP_MOVE")},
-	{_SC("_OP_NEWSLOT")},
-	{_SC("_OP_DELETE")},
-	{_SC("_OP_SET")},
-	{_SC("_OP_GET")},
-	{_SC("_OP_EQ")},
-	{_SC("_OP_NE")},
-	{_SC("_OP_ADD")},
-	{_SC("_OP_SUB")},
-	{_SC("_OP_MUL")},
-	{_SC("_OP_DIV")},
-	{_SC("_OP_MOD")},
-	{_SC("_OP_BITW")},
-	{_SC("_OP_RETURN")},
-	{_SC("_OP_LOADNULLS")},
-	{_SC("_OP_LOADROOT")},
-	{_SC("_OP_LOADBOOL")},
-	{_SC("_OP_DMOVE")},
-	{_SC("_OP_JMP")},
-	{_SC("_OP_JCMP")},
-	{_SC("_OP_JZ")},
-	{_SC("_OP_SETOUTER")},
-	{_SC("_OP_GETOUTER")},
-	{_SC("_OP_NEWOBJ")},
-	{_SC("_OP_APPENDARRAY")},
-	{_SC("_OP_COMPARITH")},
-	{_SC("_OP_INC")},
-	{_SC("_OP_INCL")},
-	{_SC("_OP_PINC")},
-	{_SC("_OP_PINCL")},
-	{_SC("_OP_CMP")},
-	{_SC("_OP_EXISTS")},
-	{_SC("_OP_INSTANCEOF")},
-	{_SC("_OP_AND")},
-	{_SC("_OP_OR")},
-	{_SC("_OP_NEG")},
-	{_SC("_OP_NOT")},
-	{_SC("_OP_BWNOT")},
-	{_SC("_OP_CLOSURE")},
-	{_SC("_OP_YIELD")},
-	{_SC("_OP_RESUME")},
-	{_SC("_OP_FOREACH")},
-	{_SC("_OP_POSTFOREACH")},
-	{_SC("_OP_CLONE")},
-	{_SC("_OP_TYPEOF")},
-	{_SC("_OP_PUSHTRAP")},
-	{_SC("_OP_POPTRAP")},
-	{_SC("_OP_THROW")},
-	{_SC("_OP_NEWSLOTA")},
-	{_SC("_OP_GETBASE")},
-	{_SC("_OP_CLOSE")},
-	{_SC("_OP_JCMP")}
+#define SQ_OPDESC(op) {_SC(#op)},
+	SQ_OPCODES(SQ_OPDESC)
+#undef SQ_OPDESC
 };
 #endif
 void DumpLiteral(SQObjectPtr &o)
@@ -88,6 +29,10 @@ void DumpLiteral(SQObjectPtr &o)
 }
 
 SQFuncState::SQFuncState(SQSharedState *ss,SQFuncState *parent,CompilerErrorFunc efunc,void *ed)
+	: _vlocals(ss), _targetstack(ss), _unresolvedbreaks(ss), _unresolvedcontinues(ss),
+	_functions(ss), _parameters(ss), _outervalues(ss), _instructions(ss), _localvarinfos(ss),
+	_lineinfos(ss), _scope_blocks(ss), _breaktargets(ss), _continuetargets(ss), _defaultparams(ss),
+	_sunkcalls(ss), _literalvals(ss), _childstates(ss)
 {
 		_nliterals = 0;
 		_literals = SQTable::Create(ss,0);
@@ -95,6 +40,8 @@ SQFuncState::SQFuncState(SQSharedState *ss,SQFuncState *parent,CompilerErrorFunc
 		_sharedstate = ss;
 		_lastline = 0;
 		_optimization = true;
+		_lasttarget = -1;
+		_prepcallk = -1;
 		_parent = parent;
 		_stacksize = 0;
 		_traps = 0;
@@ -125,7 +72,7 @@ void SQFuncState::Dump(SQFunctionProto *func)
 	scprintf(_SC("-----LITERALS\n"));
 	SQObjectPtr refidx,key,val;
 	SQInteger idx;
-	SQObjectPtrVec templiterals;
+	SQObjectPtrVec templiterals(_ss);
 	templiterals.resize(_nliterals);
 	while((idx=_table(_literals)->Next(false,refidx,key,val))!=-1) {
 		refidx=idx;
@@ -163,7 +110,7 @@ void SQFuncState::Dump(SQFunctionProto *func)
 	n=0;
 	for(i=0;i<_instructions.size();i++){
 		SQInstruction &inst=_instructions[i];
-		if(inst.op==_OP_LOAD || inst.op==_OP_DLOAD || inst.op==_OP_PREPCALLK || inst.op==_OP_GETK ){
+		if(inst.op==_OP_LOAD || inst.op==_OP_DLOAD || inst.op==_OP_PREPCALLK || inst.op==_OP_GETK || inst.op==_OP_CALLK || inst.op==_OP_GETKADD ){
 			
 			SQInteger lidx = inst._arg1;
 			scprintf(_SC("[%03d] %15s %d "),n,g_InstrDesc[inst.op].name,inst._arg0);
@@ -230,6 +177,7 @@ SQInteger SQFuncState::GetConstant(const SQObject &cons)
 	{
 		val = _nliterals;
 		_table(_literals)->NewSlot(cons,val);
+		_literalvals.push_back(cons);
 		_nliterals++;
 		if(_nliterals > MAX_LITERALS) {
 			val.Null();
@@ -239,6 +187,77 @@ SQInteger SQFuncState::GetConstant(const SQObject &cons)
 	return _integer(val);
 }
 
+bool SQFuncState::GetConstantLoad(const SQInstruction &i,SQInteger target,SQObjectPtr &val)
+{
+	if(i._arg0 != target) return false;
+	switch(i.op) {
+	case _OP_LOADINT:
+#ifndef _SQ64
+		val = (SQInteger)i._arg1;
+#else
+		val = (SQInteger)((SQUnsignedInteger32)i._arg1);
+#endif
+		return true;
+	case _OP_LOADFLOAT: val = *((SQFloat *)&i._arg1); return true;
+	case _OP_LOADBOOL: val = i._arg1?true:false; return true;
+	case _OP_LOAD: val = _literalvals[i._arg1]; return true;
+	default: return false;
+	}
+}
+
+bool SQFuncState::GetConstantOperands(SQInteger n,const SQInteger *targets,SQObjectPtr *vals)
+{
+	//a pending jump target means the loads below it are not the only way to get here
+	if(!_optimization) return false;
+	SQInteger last = _instructions.size() - 1, pos = last;
+	for(SQInteger k = n - 1; k >= 0; pos--) {
+		if(pos < 0 || IsLocal(targets[k]) || (k > 0 && targets[k] == targets[k-1])) return false;
+		if(pos < last && pos + 1 <= _lasttarget) return false;
+		SQInstruction &i = _instructions[pos];
+		if(i.op == _OP_DLOAD) {
+			if(i._arg2 != targets[k]) return false;
+			vals[k--] = _literalvals[i._arg3];
+			if(k < 0) break;
+			if(i._arg0 != targets[k]) return false;
+			vals[k--] = _literalvals[i._arg1];
+		}
+		else {
+			if(!GetConstantLoad(i,targets[k],vals[k])) return false;
+			k--;
+		}
+	}
+	return true;
+}
+
+void SQFuncState::PopConstantOperands(SQInteger n)
+{
+	while(n > 0) {
+		SQInstruction &i = _instructions.back();
+		if(i.op == _OP_DLOAD && n == 1) {
+			i.op = _OP_LOAD; //keep the first load
+			n--;
+		}
+		else {
+			n -= i.op == _OP_DLOAD ? 2 : 1;
+			_instructions.pop_back();
+		}
+	}
+	if((SQInteger)_instructions.size() <= _lasttarget) _optimization = false;
+}
+
+void SQFuncState::DiscardCode(SQInteger start)
+{
+	while((SQInteger)_instructions.size() > start) _instructions.pop_back();
+	while(_lineinfos.size() > 0 && _lineinfos.back()._op >= start) _lineinfos.pop_back();
+	_lastline = _lineinfos.size() > 0 ? _lineinfos.back()._line : 0;
+	while(_localvarinfos.size() > 0 && (SQInteger)_localvarinfos.back()._start_op >= start) _localvarinfos.pop_back();
+	while(_unresolvedbreaks.size() > 0 && _unresolvedbreaks.back() >= start) _unresolvedbreaks.pop_back();
+	while(_unresolvedcontinues.size() > 0 && _unresolvedcontinues.back() >= start) _unresolvedcontinues.pop_back();
+	while(_sunkcalls.size() > 0 && _sunkcalls[_sunkcalls.size()-2] >= start) { _sunkcalls.pop_back(); _sunkcalls.pop_back(); }
+	_prepcallk = -1;
+	_optimization = false;
+}
+
 void SQFuncState::SetIntructionParams(SQInteger pos,SQInteger arg0,SQInteger arg1,SQInteger arg2,SQInteger arg3)
 {
 	_instructions[pos]._arg0=(unsigned char)*((SQUnsignedInteger *)&arg0);
@@ -383,6 +402,81 @@ void SQFuncState::MarkLocalAsOuter(SQInteger pos)
 	SQLocalVarInfo &lvi = _vlocals[pos];
 	lvi._end_op = UINT_MINUS_ONE;
 	_outers++;
+	UnsinkPrepCalls(lvi._pos);
+}
+
+//argument setup a method fetch can be moved past: it cannot fail or run any script code
+static bool IsSinkableArg(const SQInstruction &i,SQInteger *writes,SQInteger *reads)
+{
+	writes[0] = writes[1] = reads[0] = reads[1] = -1;
+	switch(i.op) {
+	case _OP_LOAD: case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: writes[0] = i._arg0; return true;
+	case _OP_DLOAD: writes[0] = i._arg0; writes[1] = i._arg2; return true;
+	case _OP_MOVE: writes[0] = i._arg0; reads[0] = i._arg1; return true;
+	case _OP_DMOVE: writes[0] = i._arg0; reads[0] = i._arg1; writes[1] = i._arg2; reads[1] = i._arg3; return true;
+	default: return false;
+	}
+}
+
+static bool IsSinkableArg(const SQInstruction &i)
+{
+	SQInteger writes[2], reads[2];
+	return IsSinkableArg(i,writes,reads);
+}
+
+//moves the _OP_PREPCALLK at head past the argument setup that follows it, next to its _OP_CALL.
+//the fetch then runs after the arguments are loaded, which nothing but the fetch itself can tell
+bool SQFuncState::SinkPrepCall(SQInteger head,bool &readslocals)
+{
+	SQInteger size = _instructions.size();
+	const SQInstruction &h = _instructions[head];
+	//a jump landing between the two or a new line would see the fetch moved
+	if(_lasttarget > head || (_lineinfos.size() > 0 && _lineinfos.back()._op > head)) return false;
+	readslocals = false;
+	for(SQInteger n = head + 1; n < size; n++) {
+		SQInteger writes[2], reads[2];
+		if(!IsSinkableArg(_instructions[n],writes,reads)) return false;
+		for(SQInteger k = 0; k < 2; k++) {
+			if(writes[k] != -1 && (writes[k] == h._arg0 || writes[k] == h._arg2 || writes[k] == h._arg3)) return false;
+			if(reads[k] == -1) continue;
+			if(reads[k] == h._arg0 || reads[k] == h._arg3 || IsCapturedLocal(reads[k])) return false;
+			readslocals = true;
+		}
+	}
+	SQInstruction fetch = h;
+	for(SQInteger n = head; n < size - 1; n++) _instructions[n] = _instructions[n+1];
+	_instructions[size-1] = fetch;
+	return true;
+}
+
+bool SQFuncState::IsCapturedLocal(SQInteger reg)
+{
+	for(SQInteger n = 0; n < (SQInteger)_vlocals.size(); n++) {
+		if(_vlocals[n]._pos == (SQUnsignedInteger)reg && _vlocals[n]._end_op == UINT_MINUS_ONE) return true;
+	}
+	return false;
+}
+
+//a captured local can change under a fetch that runs a metamethod, so the calls that copy it
+//as an argument go back to fetching before their arguments
+void SQFuncState::UnsinkPrepCalls(SQInteger reg)
+{
+	for(SQInteger s = 0; s < (SQInteger)_sunkcalls.size(); ) {
+		SQInteger pos = _sunkcalls[s], count = _sunkcalls[s+1];
+		bool reads = false;
+		for(SQInteger n = pos - count; n < pos; n++) {
+			SQInteger writes[2], r[2];
+			IsSinkableArg(_instructions[n],writes,r);
+			if(r[0] == reg || r[1] == reg) reads = true;
+		}
+		if(!reads) { s += 2; continue; }
+		SQInstruction fetch = _instructions[pos];
+		fetch.op = _OP_PREPCALLK;
+		for(SQInteger n = pos; n > pos - count; n--) _instructions[n] = _instructions[n-1];
+		_instructions[pos - count] = fetch;
+		_sunkcalls.remove(s+1);
+		_sunkcalls.remove(s);
+	}
 }
 
 SQInteger SQFuncState::GetOuterVariable(const SQObject &name)
@@ -450,6 +544,9 @@ void SQFuncState::DiscardTarget()
 void SQFuncState::AddInstruction(SQInstruction &i)
 {
 	SQInteger size = _instructions.size();
+	if(_prepcallk != -1 && (!_optimization || (i.op != _OP_CALL && !IsSinkableArg(i))))
+		_prepcallk = -1;
+	if(!_optimization) _lasttarget = size;
 	if(size > 0 && _optimization){ //simple optimizer
 		SQInstruction &pi = _instructions[size-1];//previous instruction
 		switch(i.op) {
@@ -458,6 +555,12 @@ void SQFuncState::AddInstruction(SQInstruction &i)
 				pi.op = _OP_JCMP;
 				pi._arg0 = (unsigned char)pi._arg1;
 				pi._arg1 = i._arg1;
+				if(size > 1) { //compare against an integer constant
+					SQInstruction &ppi = _instructions[size-2];
+					if(ppi.op == _OP_LOADINT && ppi._arg0 == pi._arg0 && ppi._arg0 != pi._arg2 && (!IsLocal(ppi._arg0))) {
+						ppi.op = _OP_JCMPI;
+					}
+				}
 				return;
 			}
 		case _OP_SET:
@@ -474,6 +577,9 @@ void SQFuncState::AddInstruction(SQInstruction &i)
 		case _OP_RETURN:
 			if( _parent && i._arg0 != MAX_FUNC_STACKSIZE && pi.op == _OP_CALL && _returnexp < size-1) {
 				pi.op = _OP_TAILCALL;
+				if(_instructions[size-2].op == _OP_CALLK) {
+					_instructions[size-2].op = _OP_PREPCALLK;
+				}
 			} else if(pi.op == _OP_CLOSE){
 				pi = i;
 				return;
@@ -496,9 +602,30 @@ void SQFuncState::AddInstruction(SQInstruction &i)
 				pi._arg1 = pi._arg1;
 				pi._arg2 = i._arg2;
 				pi._arg3 = i._arg3;
+				_prepcallk = size - 1;
 				return;
 			}
 			break;
+		case _OP_CALL:
+			if(_prepcallk != -1 && _prepcallk < size) {
+				SQInteger head = _prepcallk, count = size - 1 - head;
+				SQInstruction &h = _instructions[head];
+				bool readslocals;
+				if(h.op == _OP_PREPCALLK && h._arg0 == i._arg1 && h._arg3 == i._arg2 && SinkPrepCall(head,readslocals)) {
+					pi.op = _OP_CALLK;
+					if(readslocals) {
+						_sunkcalls.push_back(size - 1);
+						_sunkcalls.push_back(count);
+					}
+				}
+			}
+			_prepcallk = -1;
+			break;
+		case _OP_ADD:
+			if( (pi.op == _OP_GETK || pi.op == _OP_GET) && (pi._arg0 == i._arg1 || pi._arg0 == i._arg2) && (!IsLocal(pi._arg0))) {
+				pi.op = pi.op == _OP_GETK ? _OP_GETKADD : _OP_GETADD;
+			}
+			break;
 		case _OP_APPENDARRAY: {
 			SQInteger aat = -1;
 			switch(pi.op) {
@@ -629,7 +756,7 @@ SQFunctionProto *SQFuncState::BuildProto()
 
 SQFuncState *SQFuncState::PushChildState(SQSharedState *ss)
 {
-	SQFuncState *child = (SQFuncState *)sq_malloc(sizeof(SQFuncState));
+	SQFuncState *child = (SQFuncState *)SQ_MALLOC(ss,sizeof(SQFuncState));
 	new (child) SQFuncState(ss,this,_errfunc,_errtarget);
 	_childstates.push_back(child);
 	return child;
@@ -638,7 +765,7 @@ SQFuncState *SQFuncState::PushChildState(SQSharedState *ss)
 void SQFuncState::PopChildState()
 {
 	SQFuncState *child = _childstates.back();
-	sq_delete(child,SQFuncState);
+	sq_delete(_ss,child,SQFuncState);
 	_childstates.pop_back();
 }
 
@@ -20,6 +20,9 @@ struct SQFuncState
 	void SetIntructionParam(SQInteger pos,SQInteger arg,SQInteger val);
 	SQInstruction &GetInstruction(SQInteger pos){return _instructions[pos];}
 	void PopInstructions(SQInteger size){for(SQInteger i=0;i<size;i++)_instructions.pop_back();}
+	bool GetConstantOperands(SQInteger n,const SQInteger *targets,SQObjectPtr *vals);
+	void PopConstantOperands(SQInteger n);
+	void DiscardCode(SQInteger start);
 	void SetStackSize(SQInteger n);
 	SQInteger CountOuters(SQInteger stacksize);
 	void SnoozeOpt(){_optimization=false;}
@@ -77,10 +80,18 @@ struct SQFuncState
 	SQInteger _traps; //contains number of nested exception traps
 	SQInteger _outers;
 	bool _optimization;
+	SQInteger _lasttarget; //last instruction added with the optimizer snoozed, a possible jump target
+	SQInteger _prepcallk; //_OP_PREPCALLK whose call arguments are still being set up, or -1
+	SQIntVec _sunkcalls; //_OP_CALLK moved past arguments that copy locals, pairs of position and count
+	SQObjectPtrVec _literalvals; //_literals by index
 	SQSharedState *_sharedstate;
 	sqvector<SQFuncState*> _childstates;
 	SQInteger GetConstant(const SQObject &cons);
 private:
+	bool GetConstantLoad(const SQInstruction &i,SQInteger target,SQObjectPtr &val);
+	bool SinkPrepCall(SQInteger head,bool &readslocals);
+	bool IsCapturedLocal(SQInteger reg);
+	void UnsinkPrepCalls(SQInteger reg);
 	CompilerErrorFunc _errfunc;
 	void *_errtarget;
 	SQSharedState *_ss;
@@ -16,58 +16,49 @@
 #define INIT_TEMP_STRING() { _longstr.resize(0);}
 #define APPEND_CHAR(c) { _longstr.push_back(c);}
 #define TERMINATE_BUFFER() {_longstr.push_back(_SC('\0'));}
-#define ADD_KEYWORD(key,id) _keywords->NewSlot( SQString::Create(ss, _SC(#key)) ,SQInteger(id))
 
-SQLexer::SQLexer(){}
+static const struct SQKeyword { const SQChar *name; SQInteger tok; } sq_keywords[] = {
+	{_SC("while"),TK_WHILE}, {_SC("do"),TK_DO}, {_SC("if"),TK_IF}, {_SC("else"),TK_ELSE},
+	{_SC("break"),TK_BREAK}, {_SC("continue"),TK_CONTINUE}, {_SC("return"),TK_RETURN},
+	{_SC("null"),TK_NULL}, {_SC("function"),TK_FUNCTION}, {_SC("local"),TK_LOCAL},
+	{_SC("for"),TK_FOR}, {_SC("foreach"),TK_FOREACH}, {_SC("in"),TK_IN},
+	{_SC("typeof"),TK_TYPEOF}, {_SC("base"),TK_BASE}, {_SC("delete"),TK_DELETE},
+	{_SC("try"),TK_TRY}, {_SC("catch"),TK_CATCH}, {_SC("throw"),TK_THROW},
+	{_SC("clone"),TK_CLONE}, {_SC("yield"),TK_YIELD}, {_SC("resume"),TK_RESUME},
+	{_SC("switch"),TK_SWITCH}, {_SC("case"),TK_CASE}, {_SC("default"),TK_DEFAULT},
+	{_SC("this"),TK_THIS}, {_SC("class"),TK_CLASS}, {_SC("extends"),TK_EXTENDS},
+	{_SC("constructor"),TK_CONSTRUCTOR}, {_SC("instanceof"),TK_INSTANCEOF},
+	{_SC("true"),TK_TRUE}, {_SC("false"),TK_FALSE}, {_SC("static"),TK_STATIC},
+	{_SC("enum"),TK_ENUM}, {_SC("const"),TK_CONST}
+};
+
+SQLexer::SQLexer(SQSharedState *ss) : _longstr(ss) {}
 SQLexer::~SQLexer()
 {
-	_keywords->Release();
 }
 
 void SQLexer::Init(SQSharedState *ss, SQLEXREADFUNC rg, SQUserPointer up,CompilerErrorFunc efunc,void *ed)
+{
+	_readf = rg;
+	_up = up;
+	_bufptr = _bufend = NULL;
+	Start(ss,efunc,ed);
+}
+
+void SQLexer::Init(SQSharedState *ss, const SQChar *buf, SQInteger size,CompilerErrorFunc efunc,void *ed)
+{
+	_readf = NULL;
+	_up = NULL;
+	_bufptr = (const LexChar *)buf;
+	_bufend = _bufptr + (size > 0 ? size : 0);
+	Start(ss,efunc,ed);
+}
+
+void SQLexer::Start(SQSharedState *ss,CompilerErrorFunc efunc,void *ed)
 {
 	_errfunc = efunc;
 	_errtarget = ed;
 	_sharedstate = ss;
-	_keywords = SQTable::Create(ss, 26);
-	ADD_KEYWORD(while, TK_WHILE);
-	ADD_KEYWORD(do, TK_DO);
-	ADD_KEYWORD(if, TK_IF);
-	ADD_KEYWORD(else, TK_ELSE);
-	ADD_KEYWORD(break, TK_BREAK);
-	ADD_KEYWORD(continue, TK_CONTINUE);
-	ADD_KEYWORD(return, TK_RETURN);
-	ADD_KEYWORD(null, TK_NULL);
-	ADD_KEYWORD(function, TK_FUNCTION);
-	ADD_KEYWORD(local, TK_LOCAL);
-	ADD_KEYWORD(for, TK_FOR);
-	ADD_KEYWORD(foreach, TK_FOREACH);
-	ADD_KEYWORD(in, TK_IN);
-	ADD_KEYWORD(typeof, TK_TYPEOF);
-	ADD_KEYWORD(base, TK_BASE);
-	ADD_KEYWORD(delete, TK_DELETE);
-	ADD_KEYWORD(try, TK_TRY);
-	ADD_KEYWORD(catch, TK_CATCH);
-	ADD_KEYWORD(throw, TK_THROW);
-	ADD_KEYWORD(clone, TK_CLONE);
-	ADD_KEYWORD(yield, TK_YIELD);
-	ADD_KEYWORD(resume, TK_RESUME);
-	ADD_KEYWORD(switch, TK_SWITCH);
-	ADD_KEYWORD(case, TK_CASE);
-	ADD_KEYWORD(default, TK_DEFAULT);
-	ADD_KEYWORD(this, TK_THIS);
-	ADD_KEYWORD(class,TK_CLASS);
-	ADD_KEYWORD(extends,TK_EXTENDS);
-	ADD_KEYWORD(constructor,TK_CONSTRUCTOR);
-	ADD_KEYWORD(instanceof,TK_INSTANCEOF);
-	ADD_KEYWORD(true,TK_TRUE);
-	ADD_KEYWORD(false,TK_FALSE);
-	ADD_KEYWORD(static,TK_STATIC);
-	ADD_KEYWORD(enum,TK_ENUM);
-	ADD_KEYWORD(const,TK_CONST);
-
-	_readf = rg;
-	_up = up;
 	_lasttokenline = _currentline = 1;
 	_currentcolumn = 0;
 	_prevtoken = -1;
@@ -82,7 +73,12 @@ void SQLexer::Error(const SQChar *err)
 
 void SQLexer::Next()
 {
-	SQInteger t = _readf(_up);
+	SQInteger t;
+	if(!_readf) {
+		//buffered source: no call per character, a 0 still ends the script as with a read function
+		t = _bufptr < _bufend ? *_bufptr++ : 0;
+	}
+	else t = _readf(_up);
 	if(t > MAX_CHAR) Error(_SC("Invalid character"));
 	if(t != 0) {
 		_currdata = (LexChar)t;
@@ -94,12 +90,9 @@ void SQLexer::Next()
 
 const SQChar *SQLexer::Tok2Str(SQInteger tok)
 {
-	SQObjectPtr itr, key, val;
-	SQInteger nitr;
-	while((nitr = _keywords->Next(false,itr, key, val)) != -1) {
-		itr = (SQInteger)nitr;
-		if(((SQInteger)_integer(val)) == tok)
-			return _stringval(key);
+	for(SQUnsignedInteger i = 0; i < sizeof(sq_keywords)/sizeof(sq_keywords[0]); i++) {
+		if(sq_keywords[i].tok == tok)
+			return sq_keywords[i].name;
 	}
 	return NULL;
 }
@@ -276,15 +269,37 @@ SQInteger SQLexer::Lex()
 	return 0;    
 }
 	
-SQInteger SQLexer::GetIDType(SQChar *s)
+#define KEYWORD(key,id) if(s[0] == _SC(#key)[0] && scstrcmp(s,_SC(#key)) == 0) return id;
+
+//keywords are told apart by length and first character, nothing is interned
+SQInteger SQLexer::GetIDType(const SQChar *s,SQInteger len)
 {
-	SQObjectPtr t;
-	if(_keywords->Get(SQString::Create(_sharedstate, s), t)) {
-		return SQInteger(_integer(t));
+	switch(len) {
+	case 2: KEYWORD(do,TK_DO) KEYWORD(if,TK_IF) KEYWORD(in,TK_IN) break;
+	case 3: KEYWORD(for,TK_FOR) KEYWORD(try,TK_TRY) break;
+	case 4:
+		KEYWORD(else,TK_ELSE) KEYWORD(null,TK_NULL) KEYWORD(base,TK_BASE) KEYWORD(case,TK_CASE)
+		KEYWORD(this,TK_THIS) KEYWORD(true,TK_TRUE) KEYWORD(enum,TK_ENUM)
+		break;
+	case 5:
+		KEYWORD(while,TK_WHILE) KEYWORD(break,TK_BREAK) KEYWORD(local,TK_LOCAL) KEYWORD(catch,TK_CATCH)
+		KEYWORD(throw,TK_THROW) KEYWORD(clone,TK_CLONE) KEYWORD(yield,TK_YIELD) KEYWORD(class,TK_CLASS)
+		KEYWORD(false,TK_FALSE) KEYWORD(const,TK_CONST)
+		break;
+	case 6:
+		KEYWORD(return,TK_RETURN) KEYWORD(typeof,TK_TYPEOF) KEYWORD(delete,TK_DELETE)
+		KEYWORD(resume,TK_RESUME) KEYWORD(switch,TK_SWITCH) KEYWORD(static,TK_STATIC)
+		break;
+	case 7: KEYWORD(foreach,TK_FOREACH) KEYWORD(default,TK_DEFAULT) KEYWORD(extends,TK_EXTENDS) break;
+	case 8: KEYWORD(function,TK_FUNCTION) KEYWORD(continue,TK_CONTINUE) break;
+	case 10: KEYWORD(instanceof,TK_INSTANCEOF) break;
+	case 11: KEYWORD(constructor,TK_CONSTRUCTOR) break;
 	}
 	return TK_IDENTIFIER;
 }
 
+#undef KEYWORD
+
 
 SQInteger SQLexer::ReadString(SQInteger ndelim,bool verbatim)
 {
@@ -481,7 +496,7 @@ SQInteger SQLexer::ReadID()
 		NEXT();
 	} while(scisalnum(CUR_CHAR) || CUR_CHAR == _SC('_'));
 	TERMINATE_BUFFER();
-	res = GetIDType(&_longstr[0]);
+	res = GetIDType(&_longstr[0],_longstr.size() - 1);
 	if(res == TK_IDENTIFIER || res == TK_CONSTRUCTOR) {
 		_svalue = &_longstr[0];
 	}
@@ -10,22 +10,23 @@ typedef	unsigned char LexChar;
 
 struct SQLexer
 {
-	SQLexer();
+	SQLexer(SQSharedState *ss);
 	~SQLexer();
 	void Init(SQSharedState *ss,SQLEXREADFUNC rg,SQUserPointer up,CompilerErrorFunc efunc,void *ed);
+	void Init(SQSharedState *ss,const SQChar *buf,SQInteger size,CompilerErrorFunc efunc,void *ed);
 	void Error(const SQChar *err);
 	SQInteger Lex();
 	const SQChar *Tok2Str(SQInteger tok);
 private:
-	SQInteger GetIDType(SQChar *s);
+	SQInteger GetIDType(const SQChar *s,SQInteger len);
 	SQInteger ReadString(SQInteger ndelim,bool verbatim);
 	SQInteger ReadNumber();
 	void LexBlockComment();
 	void LexLineComment();
 	SQInteger ReadID();
+	void Start(SQSharedState *ss,CompilerErrorFunc efunc,void *ed);
 	void Next();
 	SQInteger _curtoken;
-	SQTable *_keywords;
 	SQBool _reached_eof;
 public:
 	SQInteger _prevtoken;
@@ -37,6 +38,9 @@ public:
 	SQFloat _fvalue;
 	SQLEXREADFUNC _readf;
 	SQUserPointer _up;
+	//buffered source, used instead of _readf when _readf is NULL
+	const LexChar *_bufptr;
+	const LexChar *_bufend;
 	LexChar _currdata;
 	SQSharedState *_sharedstate;
 	sqvector<SQChar> _longstr;
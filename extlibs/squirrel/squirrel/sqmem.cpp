@@ -2,8 +2,197 @@
 	see copyright notice in squirrel.h
 */
 #include "sqpcheader.h"
-void *sq_vm_malloc(SQUnsignedInteger size){	return malloc(size); }
+static void *sq_default_malloc(SQUserPointer up, SQUnsignedInteger size){ return malloc(size); }
 
-void *sq_vm_realloc(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size){ return realloc(p, size); }
+static void *sq_default_realloc(SQUserPointer up, void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size){ return realloc(p, size); }
 
-void sq_vm_free(void *p, SQUnsignedInteger size){	free(p); }
+static void sq_default_free(SQUserPointer up, void *p, SQUnsignedInteger size){ free(p); }
+
+const SQAllocator sq_defaultallocator = { sq_default_malloc, sq_default_realloc, sq_default_free, NULL };
+
+//the VM cannot unwind from the middle of an allocation, so its own allocations never fail
+//because of the memory limit; _memlimitreached is checked at calls and loop back-edges and
+//raises a script error from there (see SQVM::CheckMemory). Allocations whose size comes
+//from a script go through sq_vm_tryrealloc, which refuses them up front instead.
+//the GC pacer is driven from the same safe points through _gcpending.
+static inline void sq_vm_account(SQSharedState *ss, SQUnsignedInteger used)
+{
+	ss->_memused = used;
+	if(used > ss->_mempeak) ss->_mempeak = used;
+	ss->_memlimitreached = ss->_memlimit && used > ss->_memlimit;
+	ss->_gcpending = ss->_gcpause && used >= ss->_gcthreshold;
+}
+
+void *sq_vm_malloc(SQSharedState *ss, SQUnsignedInteger size)
+{
+	void *p = ss->_alloc.mallocfunc(ss->_alloc.up, size);
+	ss->_memallocs++;
+	sq_vm_account(ss, ss->_memused + size);
+	return p;
+}
+
+void *sq_vm_realloc(SQSharedState *ss, void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+	if(!p) ss->_memallocs++;
+	sq_vm_account(ss, ss->_memused - oldsize + size);
+	return ss->_alloc.reallocfunc(ss->_alloc.up, p, oldsize, size);
+}
+
+void sq_vm_free(SQSharedState *ss, void *p, SQUnsignedInteger size)
+{
+	ss->_alloc.freefunc(ss->_alloc.up, p, size);
+	sq_vm_account(ss, ss->_memused - size);
+}
+
+//returns NULL, leaving p as it was, when growing p would take the VM past its limit
+//or the allocator fails
+void *sq_vm_tryrealloc(SQSharedState *ss, void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+	if(ss->_memlimit && size > oldsize
+		&& (ss->_memused >= ss->_memlimit || size - oldsize > ss->_memlimit - ss->_memused))
+		return NULL;
+	void *np = ss->_alloc.reallocfunc(ss->_alloc.up, p, oldsize, size);
+	if(!np && size) return NULL;
+	if(!p) ss->_memallocs++;
+	sq_vm_account(ss, ss->_memused - oldsize + size);
+	return np;
+}
+
+#ifndef SQ_NO_SLAB_ALLOCATOR
+//size-class slab allocator; one instance per VM, not thread safe.
+//classes are tuned for the common object headers (SQWeakRef, SQString, SQArray, SQTable,
+//SQClosure, SQInstance, SQNativeClosure, SQGenerator) and small node/vector buffers.
+//anything bigger than the largest class goes straight to the system allocator.
+#define SQ_SLAB_PAGESIZE 8192
+#define SQ_SLAB_MAXSIZE 256
+
+static const SQUnsignedInteger sq_slab_classsizes[SQ_SLAB_NUMCLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+struct SQSlabBlock { SQSlabBlock *_next; };
+union SQSlabPage { SQSlabPage *_next; double _align[2]; };
+
+struct SQSlabClass {
+	SQSlabBlock *_freelist;
+	SQSlabPage *_pages;
+	SQSlabClassStats _stats;
+};
+
+struct SQSlabAllocator {
+	SQSlabClass _classes[SQ_SLAB_NUMCLASSES];
+	unsigned char _classidx[(SQ_SLAB_MAXSIZE>>4)+1];
+};
+
+static inline SQSlabClass *sq_slab_class(SQSlabAllocator *a, SQUnsignedInteger size)
+{
+	if(size > SQ_SLAB_MAXSIZE) return NULL;
+	return &a->_classes[a->_classidx[(size+15)>>4]];
+}
+
+static bool sq_slab_grow(SQSlabClass *c)
+{
+	SQSlabPage *page = (SQSlabPage *)malloc(SQ_SLAB_PAGESIZE);
+	if(!page) return false;
+	page->_next = c->_pages;
+	c->_pages = page;
+	SQUnsignedInteger bsize = c->_stats.size;
+	SQUnsignedInteger count = (SQ_SLAB_PAGESIZE - sizeof(SQSlabPage)) / bsize;
+	unsigned char *blocks = ((unsigned char *)page) + sizeof(SQSlabPage);
+	for(SQUnsignedInteger i = count; i > 0; i--) {
+		SQSlabBlock *b = (SQSlabBlock *)(blocks + ((i - 1) * bsize));
+		b->_next = c->_freelist;
+		c->_freelist = b;
+	}
+	c->_stats.pages++;
+	c->_stats.free += count;
+	return true;
+}
+
+static void *sq_slab_malloc(SQUserPointer up, SQUnsignedInteger size)
+{
+	SQSlabClass *c = sq_slab_class((SQSlabAllocator *)up, size);
+	if(!c) return malloc(size);
+	if(!c->_freelist && !sq_slab_grow(c)) return NULL;
+	SQSlabBlock *b = c->_freelist;
+	c->_freelist = b->_next;
+	c->_stats.free--;
+	c->_stats.inuse++;
+	c->_stats.allocations++;
+	return b;
+}
+
+static void sq_slab_free(SQUserPointer up, void *p, SQUnsignedInteger size)
+{
+	if(!p) return;
+	SQSlabClass *c = sq_slab_class((SQSlabAllocator *)up, size);
+	if(!c) { free(p); return; }
+	SQSlabBlock *b = (SQSlabBlock *)p;
+	b->_next = c->_freelist;
+	c->_freelist = b;
+	c->_stats.free++;
+	c->_stats.inuse--;
+}
+
+static void *sq_slab_realloc(SQUserPointer up, void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+	SQSlabAllocator *a = (SQSlabAllocator *)up;
+	if(!p) return sq_slab_malloc(up, size);
+	SQSlabClass *oldc = sq_slab_class(a, oldsize);
+	SQSlabClass *newc = sq_slab_class(a, size);
+	if(!oldc && !newc) return realloc(p, size);
+	if(oldc == newc) return p;
+	void *np = sq_slab_malloc(up, size);
+	if(!np) return NULL;
+	memcpy(np, p, oldsize < size ? oldsize : size);
+	sq_slab_free(up, p, oldsize);
+	return np;
+}
+
+bool sq_slab_create(SQAllocator *alloc)
+{
+	SQSlabAllocator *a = (SQSlabAllocator *)malloc(sizeof(SQSlabAllocator));
+	if(!a) return false;
+	memset(a, 0, sizeof(SQSlabAllocator));
+	SQInteger cls = 0;
+	for(SQUnsignedInteger i = 0; i <= (SQ_SLAB_MAXSIZE>>4); i++) {
+		while(sq_slab_classsizes[cls] < (i<<4)) cls++;
+		a->_classidx[i] = (unsigned char)cls;
+	}
+	for(SQInteger n = 0; n < SQ_SLAB_NUMCLASSES; n++)
+		a->_classes[n]._stats.size = sq_slab_classsizes[n];
+	alloc->mallocfunc = sq_slab_malloc;
+	alloc->reallocfunc = sq_slab_realloc;
+	alloc->freefunc = sq_slab_free;
+	alloc->up = a;
+	return true;
+}
+
+void sq_slab_destroy(const SQAllocator *alloc)
+{
+	if(alloc->mallocfunc != sq_slab_malloc) return;
+	SQSlabAllocator *a = (SQSlabAllocator *)alloc->up;
+	for(SQInteger n = 0; n < SQ_SLAB_NUMCLASSES; n++) {
+		SQSlabPage *page = a->_classes[n]._pages;
+		while(page) {
+			SQSlabPage *next = page->_next;
+			free(page);
+			page = next;
+		}
+	}
+	free(a);
+}
+
+SQInteger sq_slab_getstats(const SQAllocator *alloc, SQSlabClassStats *stats)
+{
+	if(alloc->mallocfunc != sq_slab_malloc) return 0;
+	SQSlabAllocator *a = (SQSlabAllocator *)alloc->up;
+	for(SQInteger n = 0; n < SQ_SLAB_NUMCLASSES; n++)
+		stats[n] = a->_classes[n]._stats;
+	return SQ_SLAB_NUMCLASSES;
+}
+#else
+bool sq_slab_create(SQAllocator *alloc) { return false; }
+void sq_slab_destroy(const SQAllocator *alloc) {}
+SQInteger sq_slab_getstats(const SQAllocator *alloc, SQSlabClassStats *stats) { return 0; }
+#endif
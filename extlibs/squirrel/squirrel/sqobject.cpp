@@ -82,12 +82,19 @@ SQUnsignedInteger TranslateIndex(const SQObjectPtr &idx)
 	return 0;
 }
 
-SQWeakRef *SQRefCounted::GetWeakRef(SQObjectType type)
+SQWeakRef *SQRefCounted::GetWeakRef(SQSharedState *ss,SQObjectType type)
 {
 	if(!_weakref) {
-		sq_new(_weakref,SQWeakRef);
+		sq_new(ss,_weakref,SQWeakRef);
+		_weakref->_sharedstate = ss;
 		_weakref->_obj._type = type;
 		_weakref->_obj._unVal.pRefCounted = this;
+#ifndef NO_GARBAGE_COLLECTOR
+		_weakref->_prev = NULL;
+		_weakref->_next = ss->_gc_weakrefs;
+		if(ss->_gc_weakrefs) ss->_gc_weakrefs->_prev = _weakref;
+		ss->_gc_weakrefs = _weakref;
+#endif
 	}
 	return _weakref;
 }
@@ -104,7 +111,12 @@ void SQWeakRef::Release() {
 	if(ISREFCOUNTED(_obj._type)) { 
 		_obj._unVal.pRefCounted->_weakref = NULL;
 	} 
-	sq_delete(this,SQWeakRef);
+#ifndef NO_GARBAGE_COLLECTOR
+	if(_prev) _prev->_next = _next;
+	else _sharedstate->_gc_weakrefs = _next;
+	if(_next) _next->_prev = _prev;
+#endif
+	sq_delete(_sharedstate,this,SQWeakRef);
 }
 
 bool SQDelegable::GetMetaMethod(SQVM *v,SQMetaMethod mm,SQObjectPtr &res) {
@@ -136,7 +148,7 @@ bool SQGenerator::Yield(SQVM *v,SQInteger target)
 	
 	_stack.resize(size);
 	SQObject _this = v->_stack[v->_stackbase];
-	_stack._vals[0] = ISREFCOUNTED(type(_this)) ? SQObjectPtr(_refcounted(_this)->GetWeakRef(type(_this))) : _this;
+	_stack._vals[0] = ISREFCOUNTED(type(_this)) ? SQObjectPtr(_refcounted(_this)->GetWeakRef(_ss(v),type(_this))) : _this;
 	for(SQInteger n =1; n<target; n++) {
 		_stack._vals[n] = v->_stack[v->_stackbase+n];
 	}
@@ -278,6 +290,18 @@ bool SafeRead(HSQUIRRELVM v,SQWRITEFUNC read,SQUserPointer up,SQUserPointer dest
 	return true;
 }
 
+SQInteger SQMemoryReader::Read(SQUserPointer up,SQUserPointer dest,SQInteger size)
+{
+	SQMemoryReader *r = (SQMemoryReader *)up;
+	SQInteger n = r->_size - r->_pos;
+	if(size < n) n = size;
+	if(n > 0) {
+		memcpy(dest,r->_buf + r->_pos,n);
+		r->_pos += n;
+	}
+	return n;
+}
+
 bool WriteTag(HSQUIRRELVM v,SQWRITEFUNC write,SQUserPointer up,SQUnsignedInteger32 tag)
 {
 	return SafeWrite(v,write,up,&tag,sizeof(tag));
@@ -325,6 +349,19 @@ bool ReadObject(HSQUIRRELVM v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &o)
 	case OT_STRING:{
 		SQInteger len;
 		_CHECK_IO(SafeRead(v,read,up,&len,sizeof(SQInteger)));
+#ifndef SQUNICODE
+		if(read == SQMemoryReader::Read) {
+			//intern straight from the buffer, skipping the scratchpad
+			SQMemoryReader *r = (SQMemoryReader *)up;
+			if(len < 0 || len > r->_size - r->_pos) {
+				v->Raise_Error(_SC("io error, read function failure, the origin stream could be corrupted/trucated"));
+				return false;
+			}
+			o=SQString::Create(_ss(v),(const SQChar *)(r->_buf + r->_pos),len);
+			r->_pos += len;
+			break;
+		}
+#endif
 		_CHECK_IO(SafeRead(v,read,up,_ss(v)->GetScratchPad(rsl(len)),rsl(len)));
 		o=SQString::Create(_ss(v),_ss(v)->GetScratchPad(-1),len);
 				   }
@@ -434,7 +471,16 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
 	_CHECK_IO(SafeWrite(v,write,up,_defaultparams,sizeof(SQInteger)*ndefaultparams));
 
 	_CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
-	_CHECK_IO(SafeWrite(v,write,up,_instructions,sizeof(SQInstruction)*ninstructions));
+	//images only carry generic opcodes, the running function keeps its quickened ones
+	SQInstruction chunk[64];
+	for(i=0;i<ninstructions;) {
+		SQInteger n = 0;
+		for(;n<64 && i<ninstructions;n++,i++) {
+			chunk[n] = _instructions[i];
+			sq_dequicken(chunk[n]);
+		}
+		_CHECK_IO(SafeWrite(v,write,up,chunk,sizeof(SQInstruction)*n));
+	}
 
 	_CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
 	for(i=0;i<nfunctions;i++){
@@ -446,6 +492,22 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
 	return true;
 }
 
+SQInteger SQFunctionProto::CountStrings()
+{
+	SQInteger i,count = 0;
+	if(type(_sourcename) == OT_STRING) count++;
+	if(type(_name) == OT_STRING) count++;
+	for(i=0;i<_nliterals;i++) if(type(_literals[i]) == OT_STRING) count++;
+	for(i=0;i<_nparameters;i++) if(type(_parameters[i]) == OT_STRING) count++;
+	for(i=0;i<_noutervalues;i++){
+		if(type(_outervalues[i]._src) == OT_STRING) count++;
+		if(type(_outervalues[i]._name) == OT_STRING) count++;
+	}
+	for(i=0;i<_nlocalvarinfos;i++) if(type(_localvarinfos[i]._name) == OT_STRING) count++;
+	for(i=0;i<_nfunctions;i++) count += _funcproto(_functions[i])->CountStrings();
+	return count;
+}
+
 bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret)
 {
 	SQInteger i, nliterals,nparameters;
@@ -530,126 +592,100 @@ bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr
 
 #ifndef NO_GARBAGE_COLLECTOR
 
-#define START_MARK() 	if(!(_uiRef&MARK_FLAG)){ \
-		_uiRef|=MARK_FLAG;
-
-#define END_MARK() RemoveFromChain(&_sharedstate->_gc_chain, this); \
-		AddToChain(chain, this); }
-
+//Mark() traverses an object that was shaded grey; its children are shaded
+//and traversed later by SQSharedState::GCPropagate
 void SQVM::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		SQSharedState::MarkObject(_lasterror,chain);
-		SQSharedState::MarkObject(_errorhandler,chain);
-		SQSharedState::MarkObject(_debughook_closure,chain);
-		SQSharedState::MarkObject(_roottable, chain);
-		SQSharedState::MarkObject(temp_reg, chain);
-		for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
-		for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::MarkObject(_callsstack[k]._closure, chain);
-	END_MARK()
+	SQSharedState::MarkObject(_lasterror,chain);
+	SQSharedState::MarkObject(_errorhandler,chain);
+	SQSharedState::MarkObject(_debughook_closure,chain);
+	SQSharedState::MarkObject(_roottable, chain);
+	SQSharedState::MarkObject(temp_reg, chain);
+	for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
+	for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::MarkObject(_callsstack[k]._closure, chain);
 }
 
 void SQArray::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		SQInteger len = _values.size();
-		for(SQInteger i = 0;i < len; i++) SQSharedState::MarkObject(_values[i], chain);
-	END_MARK()
+	SQInteger len = _values.size();
+	for(SQInteger i = 0;i < len; i++) SQSharedState::MarkObject(_values[i], chain);
 }
 void SQTable::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		if(_delegate) _delegate->Mark(chain);
-		SQInteger len = _numofnodes;
-		for(SQInteger i = 0; i < len; i++){
-			SQSharedState::MarkObject(_nodes[i].key, chain);
-			SQSharedState::MarkObject(_nodes[i].val, chain);
-		}
-	END_MARK()
+	if(_delegate) _sharedstate->GCShade(_delegate);
+	SQInteger len = _numofnodes;
+	for(SQInteger i = 0; i < len; i++){
+		SQSharedState::MarkObject(_nodes[i].key, chain);
+		SQSharedState::MarkObject(_nodes[i].val, chain);
+	}
 }
 
 void SQClass::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		_members->Mark(chain);
-		if(_base) _base->Mark(chain);
-		SQSharedState::MarkObject(_attributes, chain);
-		for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
-			SQSharedState::MarkObject(_defaultvalues[i].val, chain);
-			SQSharedState::MarkObject(_defaultvalues[i].attrs, chain);
-		}
-		for(SQUnsignedInteger j =0; j< _methods.size(); j++) {
-			SQSharedState::MarkObject(_methods[j].val, chain);
-			SQSharedState::MarkObject(_methods[j].attrs, chain);
-		}
-		for(SQUnsignedInteger k =0; k< MT_LAST; k++) {
-			SQSharedState::MarkObject(_metamethods[k], chain);
-		}
-	END_MARK()
+	_sharedstate->GCShade(_members);
+	if(_base) _sharedstate->GCShade(_base);
+	SQSharedState::MarkObject(_attributes, chain);
+	for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
+		SQSharedState::MarkObject(_defaultvalues[i].val, chain);
+		SQSharedState::MarkObject(_defaultvalues[i].attrs, chain);
+	}
+	for(SQUnsignedInteger j =0; j< _methods.size(); j++) {
+		SQSharedState::MarkObject(_methods[j].val, chain);
+		SQSharedState::MarkObject(_methods[j].attrs, chain);
+	}
+	for(SQUnsignedInteger k =0; k< MT_LAST; k++) {
+		SQSharedState::MarkObject(_metamethods[k], chain);
+	}
 }
 
 void SQInstance::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		_class->Mark(chain);
-		SQUnsignedInteger nvalues = _class->_defaultvalues.size();
-		for(SQUnsignedInteger i =0; i< nvalues; i++) {
-			SQSharedState::MarkObject(_values[i], chain);
-		}
-	END_MARK()
+	_sharedstate->GCShade(_class);
+	SQUnsignedInteger nvalues = _class->_defaultvalues.size();
+	for(SQUnsignedInteger i =0; i< nvalues; i++) {
+		SQSharedState::MarkObject(_values[i], chain);
+	}
 }
 
 void SQGenerator::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
-		SQSharedState::MarkObject(_closure, chain);
-	END_MARK()
+	for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
+	SQSharedState::MarkObject(_closure, chain);
 }
 
 void SQFunctionProto::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		for(SQInteger i = 0; i < _nliterals; i++) SQSharedState::MarkObject(_literals[i], chain);
-		for(SQInteger k = 0; k < _nfunctions; k++) SQSharedState::MarkObject(_functions[k], chain);
-	END_MARK()
+	for(SQInteger i = 0; i < _nliterals; i++) SQSharedState::MarkObject(_literals[i], chain);
+	for(SQInteger k = 0; k < _nfunctions; k++) SQSharedState::MarkObject(_functions[k], chain);
 }
 
 void SQClosure::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		if(_base) _base->Mark(chain);
-		SQFunctionProto *fp = _function;
-		fp->Mark(chain);
-		for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
-		for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::MarkObject(_defaultparams[k], chain);
-	END_MARK()
+	if(_base) _sharedstate->GCShade(_base);
+	SQFunctionProto *fp = _function;
+	_sharedstate->GCShade(fp);
+	for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
+	for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::MarkObject(_defaultparams[k], chain);
 }
 
 void SQNativeClosure::Mark(SQCollectable **chain)
 {
-	START_MARK()
-		for(SQUnsignedInteger i = 0; i < _noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
-	END_MARK()
+	for(SQUnsignedInteger i = 0; i < _noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
 }
 
 void SQOuter::Mark(SQCollectable **chain)
 {
-	START_MARK()
     /* If the valptr points to a closed value, that value is alive */
     if(_valptr == &_value) {
       SQSharedState::MarkObject(_value, chain);
     }
-	END_MARK()
 }
 
 void SQUserData::Mark(SQCollectable **chain){
-	START_MARK()
-		if(_delegate) _delegate->Mark(chain);
-	END_MARK()
+	if(_delegate) _sharedstate->GCShade(_delegate);
 }
 
-void SQCollectable::UnMark() { _uiRef&=~MARK_FLAG; }
+void SQCollectable::UnMark() { _uiRef&=~(MARK_FLAG|GREY_FLAG); }
 
 #endif
 
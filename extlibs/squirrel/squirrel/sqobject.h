@@ -90,7 +90,7 @@ struct SQRefCounted
 	struct SQWeakRef *_weakref;
 	SQRefCounted() { _uiRef = 0; _weakref = NULL; }
 	virtual ~SQRefCounted();
-	SQWeakRef *GetWeakRef(SQObjectType type);
+	SQWeakRef *GetWeakRef(SQSharedState *ss,SQObjectType type);
 	virtual void Release()=0;
 	
 };
@@ -99,15 +99,32 @@ struct SQWeakRef : SQRefCounted
 {
 	void Release();
 	SQObject _obj;
+	SQSharedState *_sharedstate;
+#ifndef NO_GARBAGE_COLLECTOR
+	SQWeakRef *_next;
+	SQWeakRef *_prev;
+#endif
 };
 
 #define _realval(o) (type((o)) != OT_WEAKREF?(SQObject)o:_weakref(o)->_obj)
 
 struct SQObjectPtr;
 
+#ifndef NO_GARBAGE_COLLECTOR
+//every new reference goes through __AddRef/__ObjAddRef, so while an incremental
+//collection is marking, the barrier shades the referenced object (see SQSharedState::GCShade)
+#define SQ_COLLECTABLE_TYPES (_RT_TABLE|_RT_ARRAY|_RT_USERDATA|_RT_CLOSURE|_RT_NATIVECLOSURE|_RT_GENERATOR| \
+	_RT_THREAD|_RT_FUNCPROTO|_RT_CLASS|_RT_INSTANCE|_RT_OUTER)
+inline void sq_gcbarrier(SQObjectType type,SQRefCounted *p);
+#define __GCBarrier(type,unval) sq_gcbarrier((type),(unval).pRefCounted)
+#else
+#define __GCBarrier(type,unval) ((void)0)
+#endif
+
 #define __AddRef(type,unval) if(ISREFCOUNTED(type))	\
 		{ \
 			unval.pRefCounted->_uiRef++; \
+			__GCBarrier(type,unval); \
 		}  
 
 #define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))	\
@@ -126,6 +143,7 @@ struct SQObjectPtr;
 
 #define __ObjAddRef(obj) { \
 	(obj)->_uiRef++; \
+	__ObjGCBarrier(obj); \
 }
 
 #define type(obj) ((obj)._type)
@@ -173,6 +191,7 @@ struct SQObjectPtr;
 		_unVal.sym = x; \
 		assert(_unVal.pTable); \
 		_unVal.pRefCounted->_uiRef++; \
+		__GCBarrier(type,_unVal); \
 	} \
 	inline SQObjectPtr& operator=(_class *x) \
 	{  \
@@ -184,6 +203,7 @@ struct SQObjectPtr;
 		SQ_REFOBJECT_INIT() \
 		_unVal.sym = x; \
 		_unVal.pRefCounted->_uiRef++; \
+		__GCBarrier(type,_unVal); \
 		__Release(tOldType,unOldVal); \
 		return *this; \
 	}
@@ -311,6 +331,7 @@ inline void _Swap(SQObject &a,SQObject &b)
 /////////////////////////////////////////////////////////////////////////////////////
 #ifndef NO_GARBAGE_COLLECTOR
 #define MARK_FLAG 0x80000000
+#define GREY_FLAG 0x40000000
 struct SQCollectable : public SQRefCounted {
 	SQCollectable *_next;
 	SQCollectable *_prev;
@@ -325,16 +346,25 @@ struct SQCollectable : public SQRefCounted {
 };
 
 
+inline void sq_gcobjbarrier(SQCollectable *c);
+inline void sq_gcobjbarrier(SQRefCounted *) {}
+
 #define ADD_TO_CHAIN(chain,obj) AddToChain(chain,obj)
 #define REMOVE_FROM_CHAIN(chain,obj) {if(!(_uiRef&MARK_FLAG))RemoveFromChain(chain,obj);}
 #define CHAINABLE_OBJ SQCollectable
 #define INIT_CHAIN() {_next=NULL;_prev=NULL;_sharedstate=ss;}
+#define __ObjGCBarrier(obj) sq_gcobjbarrier(obj)
 #else
 
+struct SQSharedStateRefCounted : public SQRefCounted {
+	SQSharedState *_sharedstate;
+};
+
 #define ADD_TO_CHAIN(chain,obj) ((void)0)
 #define REMOVE_FROM_CHAIN(chain,obj) ((void)0)
-#define CHAINABLE_OBJ SQRefCounted
-#define INIT_CHAIN() ((void)0)
+#define CHAINABLE_OBJ SQSharedStateRefCounted
+#define INIT_CHAIN() {_sharedstate=ss;}
+#define __ObjGCBarrier(obj) ((void)0)
 #endif
 
 struct SQDelegable : public CHAINABLE_OBJ {
@@ -343,6 +373,19 @@ struct SQDelegable : public CHAINABLE_OBJ {
 	SQTable *_delegate;
 };
 
+//per-instruction record of the table node a key was found in last time (see SQTable::GetCached)
+struct SQInlineCache {
+	SQUserPointer _nodes;
+	SQInteger _idx;
+};
+
+struct SQMemoryReader {
+	const unsigned char *_buf;
+	SQInteger _size;
+	SQInteger _pos;
+	static SQInteger Read(SQUserPointer up,SQUserPointer dest,SQInteger size);
+};
+
 SQUnsignedInteger TranslateIndex(const SQObjectPtr &idx);
 typedef sqvector<SQObjectPtr> SQObjectPtrVec;
 typedef sqvector<SQInteger> SQIntVec;
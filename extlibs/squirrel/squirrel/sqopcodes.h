@@ -36,70 +36,86 @@ enum AppendArrayType {
 	AAT_BOOL = 4
 };
 
+//the opcodes in encoding order; bytecode images depend on it, append new ones at the end
+#define SQ_OPCODES(_) \
+	_(_OP_LINE)				/* 0x00 */ \
+	_(_OP_LOAD)				/* 0x01 */ \
+	_(_OP_LOADINT)			/* 0x02 */ \
+	_(_OP_LOADFLOAT)		/* 0x03 */ \
+	_(_OP_DLOAD)			/* 0x04 */ \
+	_(_OP_TAILCALL)			/* 0x05 */ \
+	_(_OP_CALL)				/* 0x06 */ \
+	_(_OP_PREPCALL)			/* 0x07 */ \
+	_(_OP_PREPCALLK)		/* 0x08 */ \
+	_(_OP_GETK)				/* 0x09 */ \
+	_(_OP_MOVE)				/* 0x0A */ \
+	_(_OP_NEWSLOT)			/* 0x0B */ \
+	_(_OP_DELETE)			/* 0x0C */ \
+	_(_OP_SET)				/* 0x0D */ \
+	_(_OP_GET)				/* 0x0E */ \
+	_(_OP_EQ)				/* 0x0F */ \
+	_(_OP_NE)				/* 0x10 */ \
+	_(_OP_ADD)				/* 0x11 */ \
+	_(_OP_SUB)				/* 0x12 */ \
+	_(_OP_MUL)				/* 0x13 */ \
+	_(_OP_DIV)				/* 0x14 */ \
+	_(_OP_MOD)				/* 0x15 */ \
+	_(_OP_BITW)				/* 0x16 */ \
+	_(_OP_RETURN)			/* 0x17 */ \
+	_(_OP_LOADNULLS)		/* 0x18 */ \
+	_(_OP_LOADROOT)			/* 0x19 */ \
+	_(_OP_LOADBOOL)			/* 0x1A */ \
+	_(_OP_DMOVE)			/* 0x1B */ \
+	_(_OP_JMP)				/* 0x1C */ \
+	_(_OP_JCMP)				/* 0x1D */ \
+	_(_OP_JZ)				/* 0x1E */ \
+	_(_OP_SETOUTER)			/* 0x1F */ \
+	_(_OP_GETOUTER)			/* 0x20 */ \
+	_(_OP_NEWOBJ)			/* 0x21 */ \
+	_(_OP_APPENDARRAY)		/* 0x22 */ \
+	_(_OP_COMPARITH)		/* 0x23 */ \
+	_(_OP_INC)				/* 0x24 */ \
+	_(_OP_INCL)				/* 0x25 */ \
+	_(_OP_PINC)				/* 0x26 */ \
+	_(_OP_PINCL)			/* 0x27 */ \
+	_(_OP_CMP)				/* 0x28 */ \
+	_(_OP_EXISTS)			/* 0x29 */ \
+	_(_OP_INSTANCEOF)		/* 0x2A */ \
+	_(_OP_AND)				/* 0x2B */ \
+	_(_OP_OR)				/* 0x2C */ \
+	_(_OP_NEG)				/* 0x2D */ \
+	_(_OP_NOT)				/* 0x2E */ \
+	_(_OP_BWNOT)			/* 0x2F */ \
+	_(_OP_CLOSURE)			/* 0x30 */ \
+	_(_OP_YIELD)			/* 0x31 */ \
+	_(_OP_RESUME)			/* 0x32 */ \
+	_(_OP_FOREACH)			/* 0x33 */ \
+	_(_OP_POSTFOREACH)		/* 0x34 */ \
+	_(_OP_CLONE)			/* 0x35 */ \
+	_(_OP_TYPEOF)			/* 0x36 */ \
+	_(_OP_PUSHTRAP)			/* 0x37 */ \
+	_(_OP_POPTRAP)			/* 0x38 */ \
+	_(_OP_THROW)			/* 0x39 */ \
+	_(_OP_NEWSLOTA)			/* 0x3A */ \
+	_(_OP_GETBASE)			/* 0x3B */ \
+	_(_OP_CLOSE)			/* 0x3C */ \
+	_(_OP_ADDI)				/* 0x3D */ \
+	_(_OP_SUBI)				/* 0x3E */ \
+	_(_OP_MULI)				/* 0x3F */ \
+	_(_OP_ADDF)				/* 0x40 */ \
+	_(_OP_SUBF)				/* 0x41 */ \
+	_(_OP_MULF)				/* 0x42 */ \
+	_(_OP_JCMPI)			/* 0x43 */ \
+	_(_OP_CALLK)			/* 0x44 */ \
+	_(_OP_GETKADD)			/* 0x45 */ \
+	_(_OP_GETADD)			/* 0x46 */
+
 enum SQOpcode
 {
-	_OP_LINE=				0x00,	
-	_OP_LOAD=				0x01,
-	_OP_LOADINT=			0x02,
-	_OP_LOADFLOAT=			0x03,
-	_OP_DLOAD=				0x04,
-	_OP_TAILCALL=			0x05,	
-	_OP_CALL=				0x06,	
-	_OP_PREPCALL=			0x07,	
-	_OP_PREPCALLK=			0x08,	
-	_OP_GETK=				0x09,	
-	_OP_MOVE=				0x0A,	
-	_OP_NEWSLOT=			0x0B,	
-	_OP_DELETE=				0x0C,	
-	_OP_SET=				0x0D,	
-	_OP_GET=				0x0E,
-	_OP_EQ=					0x0F,
-	_OP_NE=					0x10,
-	_OP_ADD=				0x11,
-	_OP_SUB=				0x12,
-	_OP_MUL=				0x13,
-	_OP_DIV=				0x14,
-	_OP_MOD=				0x15,
-	_OP_BITW=				0x16,
-	_OP_RETURN=				0x17,	
-	_OP_LOADNULLS=			0x18,	
-	_OP_LOADROOT=			0x19,
-	_OP_LOADBOOL=			0x1A,
-	_OP_DMOVE=				0x1B,	
-	_OP_JMP=				0x1C,	
-	//_OP_JNZ=				0x1D,
-	_OP_JCMP=				0x1D,
-	_OP_JZ=					0x1E,	
-	_OP_SETOUTER=			0x1F,	
-	_OP_GETOUTER=			0x20,	
-	_OP_NEWOBJ=				0x21,
-	_OP_APPENDARRAY=		0x22,	
-	_OP_COMPARITH=			0x23,	
-	_OP_INC=				0x24,	
-	_OP_INCL=				0x25,	
-	_OP_PINC=				0x26,	
-	_OP_PINCL=				0x27,	
-	_OP_CMP=				0x28,
-	_OP_EXISTS=				0x29,	
-	_OP_INSTANCEOF=			0x2A,
-	_OP_AND=				0x2B,
-	_OP_OR=					0x2C,
-	_OP_NEG=				0x2D,
-	_OP_NOT=				0x2E,
-	_OP_BWNOT=				0x2F,	
-	_OP_CLOSURE=			0x30,	
-	_OP_YIELD=				0x31,	
-	_OP_RESUME=				0x32,
-	_OP_FOREACH=			0x33,
-	_OP_POSTFOREACH=		0x34,
-	_OP_CLONE=				0x35,
-	_OP_TYPEOF=				0x36,
-	_OP_PUSHTRAP=			0x37,
-	_OP_POPTRAP=			0x38,
-	_OP_THROW=				0x39,
-	_OP_NEWSLOTA=			0x3A,
-	_OP_GETBASE=			0x3B,
-	_OP_CLOSE=				0x3C,
+#define SQ_OPENUM(op) op,
+	SQ_OPCODES(SQ_OPENUM)
+#undef SQ_OPENUM
+	_OP_COUNT
 };							  
 
 struct SQInstructionDesc {	  
@@ -123,6 +139,31 @@ struct SQInstruction
 	unsigned char _arg3;
 };
 
+//_OP_ADD/_OP_SUB/_OP_MUL quicken themselves at run time into the int/float variants,
+//arg3 counts how often a variant fell back to the generic opcode (see SQVM::Execute)
+#define SQ_QUICKEN_LIMIT 4
+
+inline void sq_dequicken(SQInstruction &i)
+{
+	switch(i.op) {
+	case _OP_ADDI: case _OP_ADDF: i.op = _OP_ADD; break;
+	case _OP_SUBI: case _OP_SUBF: i.op = _OP_SUB; break;
+	case _OP_MULI: case _OP_MULF: i.op = _OP_MUL; break;
+	case _OP_ADD: case _OP_SUB: case _OP_MUL: break;
+	default: return;
+	}
+	i._arg3 = 0;
+}
+
+//superinstructions: the peephole renames the head of a common sequence and leaves its
+//tail in place. the head runs the tail inline and skips it, falling back to executing
+//the tail normally when its fast path does not apply, so the pair stays valid bytecode.
+//	_OP_JCMPI	_OP_LOADINT followed by the _OP_JCMP reading it
+//	_OP_CALLK	_OP_PREPCALLK followed by the _OP_CALL of the fetched closure, the compiler
+//			moves the fetch past argument loads and copies of locals to pair them
+//	_OP_GETKADD	_OP_GETK followed by the _OP_ADD of the fetched value
+//	_OP_GETADD	_OP_GET followed by the _OP_ADD of the fetched value
+
 #include "squtils.h"
 typedef sqvector<SQInstruction> SQInstructionVec;
 
@@ -18,7 +18,7 @@
 //SQObjectPtr _one_((SQInteger)1);
 //SQObjectPtr _minusone_((SQInteger)-1);
 
-SQSharedState::SQSharedState()
+SQSharedState::SQSharedState(const SQAllocator &alloc) : _alloc(alloc), _memused(0), _mempeak(0), _memallocs(0), _memlimit(0), _memlimitreached(false), _gcpause(0), _gcstepsize(0), _gcthreshold(0), _gcpending(false), _refs_table(this)
 {
 	_compilererrorhandler = NULL;
 	_printfunc = NULL;
@@ -101,12 +101,23 @@ void SQSharedState::Init()
 	_scratchpadsize=0;
 #ifndef NO_GARBAGE_COLLECTOR
 	_gc_chain=NULL;
+	_gc_grey=NULL;
+	_gc_black=NULL;
+	_gc_blackthreads=NULL;
+	_gc_sweep=NULL;
+	_gc_weakrefs=NULL;
+	_gc_phase=GCP_IDLE;
+	_gc_sweeping=false;
+	_gc_collected=0;
 #endif
-	_stringtable = (SQStringTable*)SQ_MALLOC(sizeof(SQStringTable));
+	_stringtable = (SQStringTable*)SQ_MALLOC(this,sizeof(SQStringTable));
 	new (_stringtable) SQStringTable(this);
-	sq_new(_metamethods,SQObjectPtrVec);
-	sq_new(_systemstrings,SQObjectPtrVec);
-	sq_new(_types,SQObjectPtrVec);
+	_metamethods = (SQObjectPtrVec*)SQ_MALLOC(this,sizeof(SQObjectPtrVec));
+	new (_metamethods) SQObjectPtrVec(this);
+	_systemstrings = (SQObjectPtrVec*)SQ_MALLOC(this,sizeof(SQObjectPtrVec));
+	new (_systemstrings) SQObjectPtrVec(this);
+	_types = (SQObjectPtrVec*)SQ_MALLOC(this,sizeof(SQObjectPtrVec));
+	new (_types) SQObjectPtrVec(this);
 	_metamethodsmap = SQTable::Create(this,MT_LAST-1);
 	//adding type strings to avoid memory trashing
 	//types names
@@ -163,6 +174,15 @@ void SQSharedState::Init()
 
 SQSharedState::~SQSharedState()
 {
+#ifndef NO_GARBAGE_COLLECTOR
+	//drop a pending incremental cycle, everything goes back to _gc_chain
+	if(_gc_sweep) {
+		_gc_sweep->_uiRef--;
+		_gc_sweep = NULL;
+	}
+	GCUnmark(GC_UNBOUNDED,false);
+	_gc_phase = GCP_IDLE;
+#endif
 	_constructoridx.Null();
 	_table(_registry)->Finalize();
 	_table(_consts)->Finalize();
@@ -208,11 +228,11 @@ SQSharedState::~SQSharedState()
 	}
 #endif
 
-	sq_delete(_types,SQObjectPtrVec);
-	sq_delete(_systemstrings,SQObjectPtrVec);
-	sq_delete(_metamethods,SQObjectPtrVec);
-	sq_delete(_stringtable,SQStringTable);
-	if(_scratchpad)SQ_FREE(_scratchpad,_scratchpadsize);
+	sq_delete(this,_types,SQObjectPtrVec);
+	sq_delete(this,_systemstrings,SQObjectPtrVec);
+	sq_delete(this,_metamethods,SQObjectPtrVec);
+	sq_delete(this,_stringtable,SQStringTable);
+	if(_scratchpad)SQ_FREE(this,_scratchpad,_scratchpadsize);
 }
 
 
@@ -231,28 +251,23 @@ SQInteger SQSharedState::GetMetaMethodIdxByName(const SQObjectPtr &name)
 
 void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **chain)
 {
-	switch(type(o)){
-	case OT_TABLE:_table(o)->Mark(chain);break;
-	case OT_ARRAY:_array(o)->Mark(chain);break;
-	case OT_USERDATA:_userdata(o)->Mark(chain);break;
-	case OT_CLOSURE:_closure(o)->Mark(chain);break;
-	case OT_NATIVECLOSURE:_nativeclosure(o)->Mark(chain);break;
-	case OT_GENERATOR:_generator(o)->Mark(chain);break;
-	case OT_THREAD:_thread(o)->Mark(chain);break;
-	case OT_CLASS:_class(o)->Mark(chain);break;
-	case OT_INSTANCE:_instance(o)->Mark(chain);break;
-	case OT_OUTER:_outer(o)->Mark(chain);break;
-	case OT_FUNCPROTO:_funcproto(o)->Mark(chain);break;
-	default: break; //shutup compiler
+	if(type(o) & SQ_COLLECTABLE_TYPES) {
+		SQCollectable *c = static_cast<SQCollectable *>(_refcounted(o));
+		c->_sharedstate->GCShade(c);
 	}
 }
 
+void SQSharedState::GCShade(SQCollectable *c)
+{
+	if(c->_uiRef & MARK_FLAG) return;
+	c->_uiRef |= MARK_FLAG|GREY_FLAG;
+	SQCollectable::RemoveFromChain(&_gc_chain,c);
+	SQCollectable::AddToChain(&_gc_grey,c);
+}
 
 void SQSharedState::RunMark(SQVM *vm,SQCollectable **tchain)
 {
-	SQVM *vms = _thread(_root_vm);
-	
-	vms->Mark(tchain);
+	MarkObject(_root_vm,tchain);
 	
 	_refs_table.Mark(tchain);
 	MarkObject(_registry,tchain);
@@ -271,18 +286,98 @@ void SQSharedState::RunMark(SQVM *vm,SQCollectable **tchain)
 
 }
 
+//traverses up to budget grey objects, returns the number traversed
+SQInteger SQSharedState::GCPropagate(SQInteger budget)
+{
+	SQInteger work = 0;
+	while(_gc_grey && work < budget) {
+		SQCollectable *c = _gc_grey;
+		SQCollectable::RemoveFromChain(&_gc_grey,c);
+		c->_uiRef &= ~GREY_FLAG;
+		SQCollectable::AddToChain(c->GetType() == OT_THREAD ? &_gc_blackthreads : &_gc_black,c);
+		c->Mark(&_gc_grey);
+		work++;
+	}
+	return work;
+}
+
+//atomic end of the mark phase; VM stacks have no write barrier so every
+//thread that was already traversed is traversed again
+void SQSharedState::GCFinishMark(SQVM *vm)
+{
+	RunMark(vm,&_gc_grey);
+	for(SQCollectable *t = _gc_blackthreads; t; t = t->_next)
+		t->Mark(&_gc_grey);
+	GCPropagate(GC_UNBOUNDED);
+}
+
+//the unreachable stay in _gc_chain until they are swept, their weak
+//references are cleared up front so the program never sees them again
+void SQSharedState::GCClearWeakRefs()
+{
+	for(SQWeakRef *w = _gc_weakrefs; w; w = w->_next) {
+		if((type(w->_obj) & SQ_COLLECTABLE_TYPES) && !(w->_obj._unVal.pRefCounted->_uiRef & MARK_FLAG)) {
+			w->_obj._unVal.pRefCounted->_weakref = NULL;
+			w->_obj._type = OT_NULL;
+			w->_obj._unVal.pRefCounted = NULL;
+		}
+	}
+}
+
+//finalizes up to budget unreachable objects; _gc_sweep is the next one and is
+//pinned so it cannot go away while the ones before it are released. Objects
+//born meanwhile go to the head of _gc_chain, behind the cursor
+SQInteger SQSharedState::GCSweep(SQInteger budget)
+{
+	SQInteger work = 0;
+	while(_gc_sweep && work < budget) {
+		SQCollectable *t = _gc_sweep;
+		t->Finalize();
+		SQCollectable *nx = t->_next;
+		if(nx) nx->_uiRef++;
+		_gc_sweep = nx;
+		if(--t->_uiRef == 0)
+			t->Release();
+		work++;
+	}
+	return work;
+}
+
+//moves up to budget marked objects back to _gc_chain; objects whose last
+//reference went away while they were marked are released when release is true
+SQInteger SQSharedState::GCUnmark(SQInteger budget,bool release)
+{
+	SQInteger work = 0;
+	SQCollectable **chains[] = { &_gc_grey, &_gc_black, &_gc_blackthreads };
+	for(SQInteger i = 0; i < 3; i++) {
+		SQCollectable **chain = chains[i];
+		while(*chain && work < budget) {
+			SQCollectable *c = *chain;
+			SQCollectable::RemoveFromChain(chain,c);
+			c->UnMark();
+			SQCollectable::AddToChain(&_gc_chain,c);
+			work++;
+			if(release && c->_uiRef == 0)
+				c->Release();
+		}
+	}
+	return work;
+}
+
 SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
 {
 	SQInteger n=0;
-	SQCollectable *tchain=NULL;
 
-	RunMark(vm,&tchain);
+	if(_gc_phase != GCP_IDLE) CollectGarbageStep(vm,GC_UNBOUNDED);
+	_gc_phase = GCP_MARK;
+	GCFinishMark(vm);
+	_gc_phase = GCP_UNMARK;
 
 	SQCollectable *resurrected = _gc_chain;
 	SQCollectable *t = resurrected;
 	//SQCollectable *nx = NULL;
 
-	_gc_chain = tchain;
+	_gc_chain = NULL;
 
 	SQArray *ret = NULL;
 	if(resurrected) {
@@ -310,11 +405,8 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
 		_gc_chain = resurrected;
 	}
 
-	t = _gc_chain;
-	while(t) {
-		t->UnMark();
-		t = t->_next;
-	}
+	GCUnmark(GC_UNBOUNDED,true);
+	_gc_phase = GCP_IDLE;
 
 	if(ret) {
 		SQObjectPtr temp = ret;
@@ -326,36 +418,79 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
 	return n;
 }
 
-SQInteger SQSharedState::CollectGarbage(SQVM *vm)
+//runs the collector for about budget objects of work; returns true when a cycle completed
+bool SQSharedState::CollectGarbageStep(SQVM *vm,SQInteger budget)
 {
-	SQInteger n = 0;
-	SQCollectable *tchain = NULL;
+	do {
+		switch(_gc_phase) {
+		case GCP_IDLE:
+			_gc_phase = GCP_MARK;
+			RunMark(vm,&_gc_grey);
+			break;
+		case GCP_MARK:
+			budget -= GCPropagate(budget);
+			if(!_gc_grey) {
+				GCFinishMark(vm);
+				GCClearWeakRefs();
+				_gc_phase = GCP_SWEEP;
+				_gc_collected = 0;
+				_gc_sweep = _gc_chain;
+				if(_gc_sweep) _gc_sweep->_uiRef++;
+			}
+			break;
+		case GCP_SWEEP: {
+			if(_gc_sweeping) return false; //called back from a finalizer
+			_gc_sweeping = true;
+			SQInteger work = GCSweep(budget);
+			_gc_sweeping = false;
+			_gc_collected += work;
+			budget -= work;
+			if(!_gc_sweep) _gc_phase = GCP_UNMARK;
+			}
+			break;
+		case GCP_UNMARK:
+			budget -= GCUnmark(budget,true);
+			if(!_gc_black && !_gc_blackthreads) {
+				_gc_phase = GCP_IDLE;
+				GCSetThreshold();
+				return true;
+			}
+			break;
+		}
+	} while(budget > 0);
+	return false;
+}
 
-	RunMark(vm,&tchain);
+void SQSharedState::GCSetThreshold()
+{
+	SQUnsignedInteger growth = (_memused / 100) * _gcpause;
+	_gcthreshold = _memused + (growth > GC_MIN_GROWTH ? growth : GC_MIN_GROWTH);
+	_gcpending = _gcpause && _memused >= _gcthreshold;
+}
 
-	SQCollectable *t = _gc_chain;
-	SQCollectable *nx = NULL;
-	if(t) {
-		t->_uiRef++;
-		while(t) {
-			t->Finalize();
-			nx = t->_next;
-			if(nx) nx->_uiRef++;
-			if(--t->_uiRef == 0)
-				t->Release();
-			t = nx;
-			n++;
-		}
+void SQSharedState::GCPace(SQVM *vm)
+{
+	if(!_gcstepsize) {
+		CollectGarbage(vm);
+		return;
+	}
+	//a cycle in progress is owed another step once the program has allocated enough
+	if(!CollectGarbageStep(vm,_gcstepsize)) {
+		_gcthreshold = _memused + _gcstepsize * GC_STEP_BYTES;
+		_gcpending = false;
 	}
+}
 
-	t = tchain;
-	while(t) {
-		t->UnMark();
-		t = t->_next;
+SQInteger SQSharedState::CollectGarbage(SQVM *vm)
+{
+	SQInteger n = 0;
+	//finish a pending incremental cycle, then run a complete one
+	if(_gc_phase != GCP_IDLE) {
+		CollectGarbageStep(vm,GC_UNBOUNDED);
+		n += _gc_collected;
 	}
-	_gc_chain = tchain;
-	
-	return n;
+	CollectGarbageStep(vm,GC_UNBOUNDED);
+	return n + _gc_collected;
 }
 #endif
 
@@ -385,20 +520,21 @@ SQChar* SQSharedState::GetScratchPad(SQInteger size)
 	if(size>0) {
 		if(_scratchpadsize < size) {
 			newsize = size + (size>>1);
-			_scratchpad = (SQChar *)SQ_REALLOC(_scratchpad,_scratchpadsize,newsize);
+			_scratchpad = (SQChar *)SQ_REALLOC(this,_scratchpad,_scratchpadsize,newsize);
 			_scratchpadsize = newsize;
 
 		}else if(_scratchpadsize >= (size<<5)) {
 			newsize = _scratchpadsize >> 1;
-			_scratchpad = (SQChar *)SQ_REALLOC(_scratchpad,_scratchpadsize,newsize);
+			_scratchpad = (SQChar *)SQ_REALLOC(this,_scratchpad,_scratchpadsize,newsize);
 			_scratchpadsize = newsize;
 		}
 	}
 	return _scratchpad;
 }
 
-RefTable::RefTable()
+RefTable::RefTable(SQSharedState *ss)
 {
+	_ss = ss;
 	AllocNodes(4);
 }
 
@@ -413,7 +549,7 @@ void RefTable::Finalize()
 
 RefTable::~RefTable()
 {
-	SQ_FREE(_buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
+	SQ_FREE(_ss,_buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
 }
 
 #ifndef NO_GARBAGE_COLLECTOR
@@ -494,7 +630,7 @@ void RefTable::Resize(SQUnsignedInteger size)
 		t++;
 	}
 	assert(nfound == oldnumofslots);
-	SQ_FREE(oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
+	SQ_FREE(_ss,oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
 }
 
 RefTable::RefNode *RefTable::Add(SQHash mainpos,SQObject &obj)
@@ -536,7 +672,7 @@ void RefTable::AllocNodes(SQUnsignedInteger size)
 {
 	RefNode **bucks;
 	RefNode *nodes;
-	bucks = (RefNode **)SQ_MALLOC((size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
+	bucks = (RefNode **)SQ_MALLOC(_ss,(size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
 	nodes = (RefNode *)&bucks[size];
 	RefNode *temp = nodes;
 	SQUnsignedInteger n;
@@ -574,14 +710,14 @@ SQStringTable::SQStringTable(SQSharedState *ss)
 
 SQStringTable::~SQStringTable()
 {
-	SQ_FREE(_strings,sizeof(SQString*)*_numofslots);
+	SQ_FREE(_sharedstate,_strings,sizeof(SQString*)*_numofslots);
 	_strings = NULL;
 }
 
 void SQStringTable::AllocNodes(SQInteger size)
 {
 	_numofslots = size;
-	_strings = (SQString**)SQ_MALLOC(sizeof(SQString*)*_numofslots);
+	_strings = (SQString**)SQ_MALLOC(_sharedstate,sizeof(SQString*)*_numofslots);
 	memset(_strings,0,sizeof(SQString*)*_numofslots);
 }
 
@@ -597,7 +733,7 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
 			return s; //found
 	}
 
-	SQString *t = (SQString *)SQ_MALLOC(rsl(len)+sizeof(SQString));
+	SQString *t = (SQString *)SQ_MALLOC(_sharedstate,rsl(_strcapacity(len))+sizeof(SQString));
 	new (t) SQString;
 	t->_sharedstate = _sharedstate;
 	memcpy(t->_val,news,rsl(len));
@@ -612,6 +748,76 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
 	return t;
 }
 
+//appends to a string that str holds the only reference to, reusing its slack or
+//reallocating it instead of copying it, unless the result is already interned
+void SQStringTable::Append(SQObjectPtr &str,const SQChar *news,SQInteger len)
+{
+	SQString *s = _string(str);
+	SQInteger oldlen = s->_len, newlen = oldlen + len;
+	SQInteger oldcap = _strcapacity(oldlen), newcap = _strcapacity(newlen);
+	Unlink(s);
+	if(newcap != oldcap)
+		s = (SQString *)SQ_REALLOC(_sharedstate,s,sizeof(SQString)+rsl(oldcap),sizeof(SQString)+rsl(newcap));
+	memcpy(s->_val+oldlen,news,rsl(len));
+	SQHash newhash = ::_hashstr(s->_val,newlen);
+	for (SQString *t = _strings[newhash&(_numofslots-1)]; t; t = t->_next){
+		if(t->_len == newlen && (!memcmp(s->_val,t->_val,rsl(newlen)))) {
+			if(newcap != oldcap)
+				s = (SQString *)SQ_REALLOC(_sharedstate,s,sizeof(SQString)+rsl(newcap),sizeof(SQString)+rsl(oldcap));
+			s->_val[oldlen] = _SC('\0');
+			Link(s);
+			str._unVal.pString = s;
+			str = t;
+			return;
+		}
+	}
+	s->_val[newlen] = _SC('\0');
+	s->_len = newlen;
+	s->_hash = newhash;
+	Link(s);
+	str._unVal.pString = s;
+}
+
+void SQStringTable::Link(SQString *s)
+{
+	SQHash h = s->_hash&(_numofslots-1);
+	s->_next = _strings[h];
+	_strings[h] = s;
+}
+
+void SQStringTable::Unlink(SQString *s)
+{
+	SQString **p = &_strings[s->_hash&(_numofslots-1)];
+	while(*p != s)
+		p = &(*p)->_next;
+	*p = s->_next;
+}
+
+void SQStringTable::Reserve(SQInteger count)
+{
+	SQUnsignedInteger needed = _slotused + (SQUnsignedInteger)count;
+	SQUnsignedInteger size = _numofslots;
+	while(size < needed)
+		size *= 2;
+	if(size != _numofslots)
+		Resize(size);
+}
+
+void SQStringTable::GetStats(SQStringTableStats *stats)
+{
+	stats->strings = _slotused;
+	stats->slots = _numofslots;
+	stats->usedslots = 0;
+	stats->longestchain = 0;
+	for (SQUnsignedInteger i=0; i<_numofslots; i++){
+		SQUnsignedInteger chain = 0;
+		for (SQString *s = _strings[i]; s; s = s->_next)
+			chain++;
+		if(chain) stats->usedslots++;
+		if(chain > stats->longestchain) stats->longestchain = chain;
+	}
+}
+
 void SQStringTable::Resize(SQInteger size)
 {
 	SQInteger oldsize=_numofslots;
@@ -627,7 +833,7 @@ void SQStringTable::Resize(SQInteger size)
 			p = next;
 		}
 	}
-	SQ_FREE(oldtable,oldsize*sizeof(SQString*));
+	SQ_FREE(_sharedstate,oldtable,oldsize*sizeof(SQString*));
 }
 
 void SQStringTable::Remove(SQString *bs)
@@ -645,7 +851,7 @@ void SQStringTable::Remove(SQString *bs)
 			_slotused--;
 			SQInteger slen = s->_len;
 			s->~SQString();
-			SQ_FREE(s,sizeof(SQString) + rsl(slen));
+			SQ_FREE(_sharedstate,s,sizeof(SQString) + rsl(_strcapacity(slen)));
 			return;
 		}
 		prev = s;
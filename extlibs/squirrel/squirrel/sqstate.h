@@ -14,10 +14,15 @@ struct SQStringTable
 	SQStringTable(SQSharedState*ss);
 	~SQStringTable();
 	SQString *Add(const SQChar *,SQInteger len);
+	void Append(SQObjectPtr &str,const SQChar *news,SQInteger len);
 	void Remove(SQString *);
+	void Reserve(SQInteger count);
+	void GetStats(SQStringTableStats *stats);
 private:
 	void Resize(SQInteger size);
 	void AllocNodes(SQInteger size);
+	void Link(SQString *s);
+	void Unlink(SQString *s);
 	SQString **_strings;
 	SQUnsignedInteger _numofslots;
 	SQUnsignedInteger _slotused;
@@ -30,7 +35,7 @@ struct RefTable {
 		SQUnsignedInteger refs;
 		struct RefNode *next;
 	};
-	RefTable();
+	RefTable(SQSharedState *ss);
 	~RefTable();
 	void AddRef(SQObject &obj);
 	SQBool Release(SQObject &obj);
@@ -44,6 +49,7 @@ private:
 	RefNode *Add(SQHash mainpos,SQObject &obj);
 	void Resize(SQUnsignedInteger size);
 	void AllocNodes(SQUnsignedInteger size);
+	SQSharedState *_ss;
 	SQUnsignedInteger _numofslots;
 	SQUnsignedInteger _slotused;
 	RefNode *_nodes;
@@ -56,9 +62,21 @@ private:
 
 struct SQObjectPtr;
 
+enum SQGCPhase { GCP_IDLE, GCP_MARK, GCP_SWEEP, GCP_UNMARK };
+#define GC_UNBOUNDED ((SQInteger)(((SQUnsignedInteger)-1)>>1))
+//bytes the program may allocate per object of incremental work before the next paced step
+#define GC_STEP_BYTES 16
+//smallest growth allowed between paced cycles, keeps tiny heaps from collecting constantly
+#define GC_MIN_GROWTH (64*1024)
+
+extern const SQAllocator sq_defaultallocator;
+bool sq_slab_create(SQAllocator *alloc);
+void sq_slab_destroy(const SQAllocator *alloc);
+SQInteger sq_slab_getstats(const SQAllocator *alloc,SQSlabClassStats *stats);
+
 struct SQSharedState
 {
-	SQSharedState();
+	SQSharedState(const SQAllocator &alloc);
 	~SQSharedState();
 	void Init();
 public:
@@ -66,10 +84,31 @@ public:
 	SQInteger GetMetaMethodIdxByName(const SQObjectPtr &name);
 #ifndef NO_GARBAGE_COLLECTOR
 	SQInteger CollectGarbage(SQVM *vm);
+	bool CollectGarbageStep(SQVM *vm,SQInteger budget);
 	void RunMark(SQVM *vm,SQCollectable **tchain);
 	SQInteger ResurrectUnreachable(SQVM *vm);
 	static void MarkObject(SQObjectPtr &o,SQCollectable **chain);
+	void GCShade(SQCollectable *c);
+	void GCPace(SQVM *vm);
+	void GCSetThreshold();
+private:
+	SQInteger GCPropagate(SQInteger budget);
+	void GCFinishMark(SQVM *vm);
+	SQInteger GCSweep(SQInteger budget);
+	void GCClearWeakRefs();
+	SQInteger GCUnmark(SQInteger budget,bool release);
+public:
 #endif
+	SQAllocator _alloc;
+	SQUnsignedInteger _memused;
+	SQUnsignedInteger _mempeak;
+	SQUnsignedInteger _memallocs;
+	SQUnsignedInteger _memlimit;
+	bool _memlimitreached;
+	SQUnsignedInteger _gcpause;
+	SQUnsignedInteger _gcstepsize;
+	SQUnsignedInteger _gcthreshold;
+	bool _gcpending;
 	SQObjectPtrVec *_metamethods;
 	SQObjectPtr _metamethodsmap;
 	SQObjectPtrVec *_systemstrings;
@@ -81,6 +120,14 @@ public:
 	SQObjectPtr _constructoridx;
 #ifndef NO_GARBAGE_COLLECTOR
 	SQCollectable *_gc_chain;
+	SQCollectable *_gc_grey;
+	SQCollectable *_gc_black;
+	SQCollectable *_gc_blackthreads;
+	SQCollectable *_gc_sweep;
+	SQWeakRef *_gc_weakrefs;
+	SQGCPhase _gc_phase;
+	bool _gc_sweeping;
+	SQInteger _gc_collected;
 #endif
 	SQObjectPtr _root_vm;
 	SQObjectPtr _table_default_delegate;
@@ -138,5 +185,18 @@ private:
 
 bool CompileTypemask(SQIntVec &res,const SQChar *typemask);
 
+#ifndef NO_GARBAGE_COLLECTOR
+inline void sq_gcobjbarrier(SQCollectable *c)
+{
+	SQSharedState *ss = c->_sharedstate;
+	if(ss->_gc_phase == GCP_MARK && !(c->_uiRef & MARK_FLAG)) ss->GCShade(c);
+}
+
+inline void sq_gcbarrier(SQObjectType type,SQRefCounted *p)
+{
+	if(type & SQ_COLLECTABLE_TYPES) sq_gcobjbarrier(static_cast<SQCollectable *>(p));
+}
+#endif
+
 
 #endif //_SQSTATE_H_
@@ -2,6 +2,33 @@
 #ifndef _SQSTRING_H_
 #define _SQSTRING_H_
 
+#ifdef SQ_FULL_STRING_HASH
+inline unsigned long long _hashmix (unsigned long long k)
+{
+		k ^= k >> 33;
+		k *= 0xFF51AFD7ED558CCDULL;
+		k ^= k >> 33;
+		return k;
+}
+
+/* hashes every byte, 8 at a time, so keys sharing long prefixes and suffixes don't collide */
+inline SQHash _hashstr (const SQChar *s, size_t l)
+{
+		const unsigned char *p = (const unsigned char *)s;
+		size_t n = l * sizeof(SQChar);
+		unsigned long long h = 0x9E3779B97F4A7C15ULL ^ (unsigned long long)n;
+		unsigned long long k;
+		for (; n>=8; n-=8, p+=8) {
+			memcpy(&k,p,8);
+			h = (h ^ _hashmix(k)) * 0x9FB21C651E98DF25ULL;
+			h = (h << 29) | (h >> 35);
+		}
+		k = 0;
+		memcpy(&k,p,n);
+		h = _hashmix((h ^ _hashmix(k)) * 0x9FB21C651E98DF25ULL);
+		return (SQHash)(h ^ (h >> 32));
+}
+#else
 inline SQHash _hashstr (const SQChar *s, size_t l)
 {
 		SQHash h = (SQHash)l;  /* seed */
@@ -10,6 +37,16 @@ inline SQHash _hashstr (const SQChar *s, size_t l)
 			h = h ^ ((h<<5)+(h>>2)+(unsigned short)*(s++));
 		return h;
 }
+#endif
+
+/* long strings get up to 1/8 of slack, so appending to one only reallocates it every so often */
+inline SQInteger _strcapacity (SQInteger len)
+{
+		if(len < 64) return len;
+		SQInteger g = 8;
+		while((g << 4) <= len) g <<= 1;
+		return (len + g - 1) & ~(g - 1);
+}
 
 struct SQString : public SQRefCounted
 {
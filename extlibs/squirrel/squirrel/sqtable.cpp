@@ -11,10 +11,10 @@ SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
 {
 	SQInteger pow2size=MINPOWER2;
 	while(nInitialSize>pow2size)pow2size=pow2size<<1;
+	INIT_CHAIN();
 	AllocNodes(pow2size);
 	_usednodes = 0;
 	_delegate = NULL;
-	INIT_CHAIN();
 	ADD_TO_CHAIN(&_sharedstate->_gc_chain,this);
 }
 
@@ -32,7 +32,7 @@ void SQTable::Remove(const SQObjectPtr &key)
 
 void SQTable::AllocNodes(SQInteger nSize)
 {
-	_HashNode *nodes=(_HashNode *)SQ_MALLOC(sizeof(_HashNode)*nSize);
+	_HashNode *nodes=(_HashNode *)SQ_MALLOC(_sharedstate,sizeof(_HashNode)*nSize);
 	for(SQInteger i=0;i<nSize;i++){
 		_HashNode &n = nodes[i];
 		new (&n) _HashNode;
@@ -67,7 +67,7 @@ void SQTable::Rehash(bool force)
 	}
 	for(SQInteger k=0;k<oldsize;k++) 
 		nold[k].~_HashNode();
-	SQ_FREE(nold,oldsize*sizeof(_HashNode));
+	SQ_FREE(_sharedstate,nold,oldsize*sizeof(_HashNode));
 }
 
 SQTable *SQTable::Clone()
@@ -45,7 +45,7 @@ private:
 public:
 	static SQTable* Create(SQSharedState *ss,SQInteger nInitialSize)
 	{
-		SQTable *newtable = (SQTable*)SQ_MALLOC(sizeof(SQTable));
+		SQTable *newtable = (SQTable*)SQ_MALLOC(ss,sizeof(SQTable));
 		new (newtable) SQTable(ss, nInitialSize);
 		newtable->_delegate = NULL;
 		return newtable;
@@ -57,7 +57,7 @@ public:
 		SetDelegate(NULL);
 		REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
 		for (SQInteger i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
-		SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+		SQ_FREE(_sharedstate,_nodes, _numofnodes * sizeof(_HashNode));
 	}
 #ifndef NO_GARBAGE_COLLECTOR 
 	void Mark(SQCollectable **chain);
@@ -74,6 +74,19 @@ public:
 		return NULL;
 	}
 	bool Get(const SQObjectPtr &key,SQObjectPtr &val);
+	//looks up an own slot, trying the node remembered in c before hashing and updating c on a hit
+	inline SQObjectPtr *GetCached(const SQObjectPtr &key,SQInlineCache &c)
+	{
+		_HashNode *n;
+		if(c._nodes == _nodes && c._idx < _numofnodes) {
+			n = &_nodes[c._idx];
+			if(_rawval(n->key) == _rawval(key) && type(n->key) == type(key)) return &n->val;
+		}
+		if(type(key) == OT_NULL || !(n = _Get(key, HashObj(key) & (_numofnodes - 1)))) return NULL;
+		c._nodes = _nodes;
+		c._idx = n - _nodes;
+		return &n->val;
+	}
 	void Remove(const SQObjectPtr &key);
 	bool Set(const SQObjectPtr &key, const SQObjectPtr &val);
 	//returns true if a new slot has been created false if it was already present
@@ -84,7 +97,7 @@ public:
 	void Clear();
 	void Release()
 	{
-		sq_delete(this, SQTable);
+		sq_delete(_sharedstate, this, SQTable);
 	}
 	
 };
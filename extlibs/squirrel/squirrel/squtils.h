@@ -2,15 +2,18 @@
 #ifndef _SQUTILS_H_
 #define _SQUTILS_H_
 
-void *sq_vm_malloc(SQUnsignedInteger size);
-void *sq_vm_realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
-void sq_vm_free(void *p,SQUnsignedInteger size);
+struct SQSharedState;
 
-#define sq_new(__ptr,__type) {__ptr=(__type *)sq_vm_malloc(sizeof(__type));new (__ptr) __type;}
-#define sq_delete(__ptr,__type) {__ptr->~__type();sq_vm_free(__ptr,sizeof(__type));}
-#define SQ_MALLOC(__size) sq_vm_malloc((__size));
-#define SQ_FREE(__ptr,__size) sq_vm_free((__ptr),(__size));
-#define SQ_REALLOC(__ptr,__oldsize,__size) sq_vm_realloc((__ptr),(__oldsize),(__size));
+void *sq_vm_malloc(SQSharedState *ss,SQUnsignedInteger size);
+void *sq_vm_realloc(SQSharedState *ss,void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
+void sq_vm_free(SQSharedState *ss,void *p,SQUnsignedInteger size);
+void *sq_vm_tryrealloc(SQSharedState *ss,void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
+
+#define sq_new(__ss,__ptr,__type) {__ptr=(__type *)sq_vm_malloc((__ss),sizeof(__type));new (__ptr) __type;}
+#define sq_delete(__ss,__ptr,__type) {SQSharedState *__s=(__ss);__ptr->~__type();sq_vm_free(__s,__ptr,sizeof(__type));}
+#define SQ_MALLOC(__ss,__size) sq_vm_malloc((__ss),(__size));
+#define SQ_FREE(__ss,__ptr,__size) sq_vm_free((__ss),(__ptr),(__size));
+#define SQ_REALLOC(__ss,__ptr,__oldsize,__size) sq_vm_realloc((__ss),(__ptr),(__oldsize),(__size));
 
 #define sq_aligning(v) (((size_t)(v) + (SQ_ALIGNMENT-1)) & (~(SQ_ALIGNMENT-1)))
 
@@ -18,14 +21,19 @@ void sq_vm_free(void *p,SQUnsignedInteger size);
 template<typename T> class sqvector
 {
 public:
-	sqvector()
+	sqvector(SQSharedState *ss)
 	{
+		_ss = ss;
 		_vals = NULL;
 		_size = 0;
 		_allocated = 0;
 	}
 	sqvector(const sqvector<T>& v)
 	{
+		_ss = v._ss;
+		_vals = NULL;
+		_size = 0;
+		_allocated = 0;
 		copy(v);
 	}
 	void copy(const sqvector<T>& v)
@@ -47,7 +55,7 @@ public:
 		if(_allocated) {
 			for(SQUnsignedInteger i = 0; i < _size; i++)
 				_vals[i].~T();
-			SQ_FREE(_vals, (_allocated * sizeof(T)));
+			SQ_FREE(_ss, _vals, (_allocated * sizeof(T)));
 		}
 	}
 	void reserve(SQUnsignedInteger newsize) { _realloc(newsize); }
@@ -68,6 +76,20 @@ public:
 			_size = newsize;
 		}
 	}
+	//like resize() but leaves the vector as it is and returns false when the
+	//memory for it would take the VM past its limit
+	bool tryresize(SQUnsignedInteger newsize, const T& fill = T())
+	{
+		if(newsize > _allocated) {
+			if(newsize > ((SQUnsignedInteger)-1) / sizeof(T)) return false;
+			T *vals = (T*)sq_vm_tryrealloc(_ss, _vals, _allocated * sizeof(T), newsize * sizeof(T));
+			if(!vals) return false;
+			_vals = vals;
+			_allocated = newsize;
+		}
+		resize(newsize, fill);
+		return true;
+	}
 	void shrinktofit() { if(_size > 4) { _realloc(_size); } }
 	T& top() const { return _vals[_size - 1]; }
 	inline SQUnsignedInteger size() const { return _size; }
@@ -106,9 +128,10 @@ private:
 	void _realloc(SQUnsignedInteger newsize)
 	{
 		newsize = (newsize > 0)?newsize:4;
-		_vals = (T*)SQ_REALLOC(_vals, _allocated * sizeof(T), newsize * sizeof(T));
+		_vals = (T*)SQ_REALLOC(_ss, _vals, _allocated * sizeof(T), newsize * sizeof(T));
 		_allocated = newsize;
 	}
+	SQSharedState *_ss;
 	SQUnsignedInteger _size;
 	SQUnsignedInteger _allocated;
 };
@@ -48,6 +48,32 @@ bool SQVM::BW_OP(SQUnsignedInteger op,SQObjectPtr &trg,const SQObjectPtr &o1,con
 	} \
 }
 
+//generic arithmetic that quickens the instruction on int/int or float/float operands
+#define _QUICKEN_ARITH_(sym,iop,fop) \
+{ \
+	SQInteger tmask = type(STK(arg2))|type(STK(arg1)); \
+	if(arg3 < SQ_QUICKEN_LIMIT) { \
+		if(tmask == OT_INTEGER) _i_->op = iop; \
+		else if(tmask == OT_FLOAT) _i_->op = fop; \
+	} \
+	_ARITH_(sym,TARGET,STK(arg2),STK(arg1)); \
+}
+
+//quickened arithmetic, rewrites the instruction back to gop when the operand types change
+#define _ARITH_INT_(sym,gop) \
+{ \
+	const SQObjectPtr &o1 = STK(arg2), &o2 = STK(arg1); \
+	if((type(o1)|type(o2)) == OT_INTEGER) TARGET = _integer(o1) sym _integer(o2); \
+	else { _i_->op = gop; _i_->_arg3++; _ARITH_(sym,TARGET,o1,o2); } \
+}
+
+#define _ARITH_FLOAT_(sym,gop) \
+{ \
+	const SQObjectPtr &o1 = STK(arg2), &o2 = STK(arg1); \
+	if((type(o1)|type(o2)) == OT_FLOAT) TARGET = _float(o1) sym _float(o2); \
+	else { _i_->op = gop; _i_->_arg3++; _ARITH_(sym,TARGET,o1,o2); } \
+}
+
 #define _ARITH_NOZERO(op,trg,o1,o2,err) \
 { \
 	SQInteger tmask = type(o1)|type(o2); \
@@ -103,7 +129,7 @@ bool SQVM::ARITH_OP(SQUnsignedInteger op,SQObjectPtr &trg,const SQObjectPtr &o1,
 	return true;
 }
 
-SQVM::SQVM(SQSharedState *ss)
+SQVM::SQVM(SQSharedState *ss) : _stack(ss), _callstackdata(ss), _etraps(ss)
 {
 	_sharedstate=ss;
 	_suspended = SQFalse;
@@ -317,6 +343,14 @@ bool SQVM::ToString(const SQObjectPtr &o,SQObjectPtr &res)
 bool SQVM::StringCat(const SQObjectPtr &str,const SQObjectPtr &obj,SQObjectPtr &dest)
 {
 	SQObjectPtr a, b;
+	if(&dest == &str && type(str) == OT_STRING && _string(str)->_uiRef == 1 && !_string(str)->_weakref
+		&& (type(obj) == OT_INTEGER || type(obj) == OT_FLOAT || type(obj) == OT_BOOL
+			|| (type(obj) == OT_STRING && _string(obj) != _string(str)))) {
+		//s += x where nothing else holds s, append to it instead of building a new string
+		ToString(obj, b);
+		_ss(this)->_stringtable->Append(dest, _stringval(b), _string(b)->_len);
+		return true;
+	}
 	if(!ToString(str, a)) return false;
 	if(!ToString(obj, b)) return false;
 	SQInteger l = _string(a)->_len , ol = _string(b)->_len;
@@ -412,6 +446,12 @@ bool SQVM::StartCall(SQClosure *closure,SQInteger target,SQInteger args,SQIntege
 
 	if(!EnterFrame(stackbase, newtop, tailcall)) return false;
 
+	if(!func->_inlinecaches) {
+		SQInteger size = func->_ninstructions*sizeof(SQInlineCache);
+		func->_inlinecaches = (SQInlineCache *)SQ_MALLOC(_ss(this),size);
+		memset(func->_inlinecaches,0,size);
+	}
+
 	ci->_closure  = closure;
 	ci->_literals = func->_literals;
 	ci->_ip       = func->_instructions;
@@ -488,13 +528,13 @@ bool SQVM::DerefInc(SQInteger op,SQObjectPtr &target, SQObjectPtr &self, SQObjec
 	return true;
 }
 
-#define arg0 (_i_._arg0)
-#define sarg0 ((SQInteger)*((signed char *)&_i_._arg0))
-#define arg1 (_i_._arg1)
-#define sarg1 (*((SQInt32 *)&_i_._arg1))
-#define arg2 (_i_._arg2)
-#define arg3 (_i_._arg3)
-#define sarg3 ((SQInteger)*((signed char *)&_i_._arg3))
+#define arg0 (_i_->_arg0)
+#define sarg0 ((SQInteger)*((signed char *)&_i_->_arg0))
+#define arg1 (_i_->_arg1)
+#define sarg1 (*((SQInt32 *)&_i_->_arg1))
+#define arg2 (_i_->_arg2)
+#define arg3 (_i_->_arg3)
+#define sarg3 ((SQInteger)*((signed char *)&_i_->_arg3))
 
 SQRESULT SQVM::Suspend()
 {
@@ -573,6 +613,33 @@ bool SQVM::FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr
 
 #define _GUARD(exp) { if(!exp) { SQ_THROW();} }
 
+#define _INLINE_CACHE() (_closure(ci->_closure)->_function->_inlinecaches[_i_ - _closure(ci->_closure)->_function->_instructions])
+
+#ifdef SQ_COMPUTED_GOTO
+//threaded dispatch, every handler ends in its own indirect jump to the next one
+#define SQ_OPLABEL(op) &&L##op,
+#define SQ_DISPATCH() goto *optable[_i_->op];
+#define SQ_OPCASE(op) L##op
+#define SQ_NEXT() { _i_ = ci->_ip++; SQ_DISPATCH() }
+#else
+#define SQ_DISPATCH() switch(_i_->op)
+#define SQ_OPCASE(op) case op
+#define SQ_NEXT() continue
+#endif
+
+#define _CHECK_MEMORY() { if((_sharedstate->_memlimitreached || _sharedstate->_gcpending) && !CheckMemory()) { SQ_THROW(); } }
+
+bool SQVM::CheckMemory()
+{
+#ifndef NO_GARBAGE_COLLECTOR
+	if(_sharedstate->_gcpending) _sharedstate->GCPace(this);
+	if(_sharedstate->_memlimitreached) _sharedstate->CollectGarbage(this);
+#endif
+	if(!_sharedstate->_memlimitreached) return true;
+	Raise_Error(_SC("memory limit exceeded"));
+	return false;
+}
+
 bool SQVM::CLOSURE_OP(SQObjectPtr &target, SQFunctionProto *func)
 {
 	SQInteger nouters;
@@ -693,24 +760,29 @@ bool SQVM::Execute(SQObjectPtr &closure, SQInteger nargs, SQInteger stackbase,SQ
 exception_restore:
 	//
 	{
+#ifdef SQ_COMPUTED_GOTO
+		static void *const optable[_OP_COUNT] = { SQ_OPCODES(SQ_OPLABEL) };
+#endif
+		SQInstruction *_i_;
 		for(;;)
 		{
-			const SQInstruction &_i_ = *ci->_ip++;
+			_i_ = ci->_ip++;
 			//dumpstack(_stackbase);
-			//scprintf("\n[%d] %s %d %d %d %d\n",ci->_ip-ci->_iv->_vals,g_InstrDesc[_i_.op].name,arg0,arg1,arg2,arg3);
-			switch(_i_.op)
+			//scprintf("\n[%d] %s %d %d %d %d\n",ci->_ip-ci->_iv->_vals,g_InstrDesc[_i_->op].name,arg0,arg1,arg2,arg3);
+			SQ_DISPATCH()
 			{
-			case _OP_LINE: if (_debughook) CallDebugHook(_SC('l'),arg1); continue;
-			case _OP_LOAD: TARGET = ci->_literals[arg1]; continue;
-			case _OP_LOADINT: 
+			SQ_OPCASE(_OP_LINE): if (_debughook) CallDebugHook(_SC('l'),arg1); SQ_NEXT();
+			SQ_OPCASE(_OP_LOAD): TARGET = ci->_literals[arg1]; SQ_NEXT();
+			SQ_OPCASE(_OP_LOADINT): 
 #ifndef _SQ64
-				TARGET = (SQInteger)arg1; continue;
+				TARGET = (SQInteger)arg1; SQ_NEXT();
 #else
-				TARGET = (SQInteger)((SQUnsignedInteger32)arg1); continue;
+				TARGET = (SQInteger)((SQUnsignedInteger32)arg1); SQ_NEXT();
 #endif
-			case _OP_LOADFLOAT: TARGET = *((SQFloat *)&arg1); continue;
-			case _OP_DLOAD: TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];continue;
-			case _OP_TAILCALL:{
+			SQ_OPCASE(_OP_LOADFLOAT): TARGET = *((SQFloat *)&arg1); SQ_NEXT();
+			SQ_OPCASE(_OP_DLOAD): TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];SQ_NEXT();
+			SQ_OPCASE(_OP_TAILCALL):{
+				_CHECK_MEMORY();
 				SQObjectPtr &t = STK(arg1);
 				if (type(t) == OT_CLOSURE 
 					&& (!_closure(t)->_function->_bgenerator)){
@@ -718,15 +790,16 @@ exception_restore:
 					if(_openouters) CloseOuters(&(_stack._vals[_stackbase]));
 					for (SQInteger i = 0; i < arg3; i++) STK(i) = STK(arg2 + i);
 					_GUARD(StartCall(_closure(clo), ci->_target, arg3, _stackbase, true));
-					continue;
+					continue; //not SQ_NEXT(), a computed goto would skip clo's destructor
 				}
 							  }
-			case _OP_CALL: {
+			SQ_OPCASE(_OP_CALL): {
+					_CHECK_MEMORY();
 					SQObjectPtr clo = STK(arg1);
 					switch (type(clo)) {
 					case OT_CLOSURE:
 						_GUARD(StartCall(_closure(clo), sarg0, arg3, _stackbase+arg2, false));
-						continue;
+						continue; //see _OP_TAILCALL
 					case OT_NATIVECLOSURE: {
 						bool suspend;
 						_GUARD(CallNative(_nativeclosure(clo), arg3, _stackbase+arg2, clo,suspend));
@@ -742,7 +815,7 @@ exception_restore:
 							STK(arg0) = clo;
 						}
 										   }
-						continue;
+						continue; //see _OP_TAILCALL
 					case OT_CLASS:{
 						SQObjectPtr inst;
 						_GUARD(CreateClassInstance(_class(clo),inst,clo));
@@ -788,53 +861,87 @@ exception_restore:
 						SQ_THROW();
 					}
 				}
-				  continue;
-			case _OP_PREPCALL:
-			case _OP_PREPCALLK:	{
-					SQObjectPtr &key = _i_.op == _OP_PREPCALLK?(ci->_literals)[arg1]:STK(arg1);
+				  SQ_NEXT();
+			SQ_OPCASE(_OP_PREPCALL):
+			SQ_OPCASE(_OP_PREPCALLK):	{
+					SQObjectPtr &key = _i_->op == _OP_PREPCALLK?(ci->_literals)[arg1]:STK(arg1);
 					SQObjectPtr &o = STK(arg2);
-					if (!Get(o, key, temp_reg,false,arg2)) {
+					if (!GetCached(o, key, temp_reg, arg2, _INLINE_CACHE())) {
 						SQ_THROW();
 					}
 					STK(arg3) = o;
 					_Swap(TARGET,temp_reg);//TARGET = temp_reg;
 				}
-				continue;
-			case _OP_GETK:
-				if (!Get(STK(arg2), ci->_literals[arg1], temp_reg, false,arg2)) { SQ_THROW();}
+				SQ_NEXT();
+			SQ_OPCASE(_OP_GETK):
+				if (!GetCached(STK(arg2), ci->_literals[arg1], temp_reg, arg2, _INLINE_CACHE())) { SQ_THROW();}
 				_Swap(TARGET,temp_reg);//TARGET = temp_reg;
-				continue;
-			case _OP_MOVE: TARGET = STK(arg1); continue;
-			case _OP_NEWSLOT:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_CALLK):	{
+					SQObjectPtr &o = STK(arg2);
+					if (!GetCached(o, ci->_literals[arg1], temp_reg, arg2, _INLINE_CACHE())) {
+						SQ_THROW();
+					}
+					STK(arg3) = o;
+					_Swap(TARGET,temp_reg);
+				}
+				if(type(TARGET) == OT_CLOSURE) { //call it here, anything else goes through the _OP_CALL
+					_i_ = ci->_ip++;
+					_CHECK_MEMORY();
+					SQObjectPtr clo = STK(arg1);
+					_GUARD(StartCall(_closure(clo), sarg0, arg3, _stackbase+arg2, false));
+					continue; //see _OP_TAILCALL
+				}
+				SQ_NEXT();
+			SQ_OPCASE(_OP_GETKADD):
+				if (!GetCached(STK(arg2), ci->_literals[arg1], temp_reg, arg2, _INLINE_CACHE())) { SQ_THROW();}
+				_Swap(TARGET,temp_reg);
+				_i_ = ci->_ip++; //the _OP_ADD
+				_ARITH_(+,TARGET,STK(arg2),STK(arg1));
+				SQ_NEXT();
+			SQ_OPCASE(_OP_MOVE): TARGET = STK(arg1); SQ_NEXT();
+			SQ_OPCASE(_OP_NEWSLOT):
 				_GUARD(NewSlot(STK(arg1), STK(arg2), STK(arg3),false));
 				if(arg0 != 0xFF) TARGET = STK(arg3);
-				continue;
-			case _OP_DELETE: _GUARD(DeleteSlot(STK(arg1), STK(arg2), TARGET)); continue;
-			case _OP_SET:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_DELETE): _GUARD(DeleteSlot(STK(arg1), STK(arg2), TARGET)); SQ_NEXT();
+			SQ_OPCASE(_OP_SET):
 				if (!Set(STK(arg1), STK(arg2), STK(arg3),arg1)) { SQ_THROW(); }
 				if (arg0 != 0xFF) TARGET = STK(arg3);
-				continue;
-			case _OP_GET:
-				if (!Get(STK(arg1), STK(arg2), temp_reg, false,arg1)) { SQ_THROW(); }
+				SQ_NEXT();
+			SQ_OPCASE(_OP_GET):
+				if (!GetCached(STK(arg1), STK(arg2), temp_reg, arg1, _INLINE_CACHE())) { SQ_THROW(); }
 				_Swap(TARGET,temp_reg);//TARGET = temp_reg;
-				continue;
-			case _OP_EQ:{
+				SQ_NEXT();
+			SQ_OPCASE(_OP_GETADD):
+				if (!GetCached(STK(arg1), STK(arg2), temp_reg, arg1, _INLINE_CACHE())) { SQ_THROW(); }
+				_Swap(TARGET,temp_reg);
+				_i_ = ci->_ip++; //the _OP_ADD
+				_ARITH_(+,TARGET,STK(arg2),STK(arg1));
+				SQ_NEXT();
+			SQ_OPCASE(_OP_EQ):{
 				bool res;
 				if(!IsEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
 				TARGET = res?true:false;
-				}continue;
-			case _OP_NE:{ 
+				}SQ_NEXT();
+			SQ_OPCASE(_OP_NE):{ 
 				bool res;
 				if(!IsEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
 				TARGET = (!res)?true:false;
-				} continue;
-			case _OP_ADD: _ARITH_(+,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_SUB: _ARITH_(-,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_MUL: _ARITH_(*,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_DIV: _ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),_SC("division by zero")); continue;
-			case _OP_MOD: ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_BITW:	_GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); continue;
-			case _OP_RETURN:
+				} SQ_NEXT();
+			SQ_OPCASE(_OP_ADD): _QUICKEN_ARITH_(+,_OP_ADDI,_OP_ADDF); SQ_NEXT();
+			SQ_OPCASE(_OP_SUB): _QUICKEN_ARITH_(-,_OP_SUBI,_OP_SUBF); SQ_NEXT();
+			SQ_OPCASE(_OP_MUL): _QUICKEN_ARITH_(*,_OP_MULI,_OP_MULF); SQ_NEXT();
+			SQ_OPCASE(_OP_ADDI): _ARITH_INT_(+,_OP_ADD); SQ_NEXT();
+			SQ_OPCASE(_OP_SUBI): _ARITH_INT_(-,_OP_SUB); SQ_NEXT();
+			SQ_OPCASE(_OP_MULI): _ARITH_INT_(*,_OP_MUL); SQ_NEXT();
+			SQ_OPCASE(_OP_ADDF): _ARITH_FLOAT_(+,_OP_ADD); SQ_NEXT();
+			SQ_OPCASE(_OP_SUBF): _ARITH_FLOAT_(-,_OP_SUB); SQ_NEXT();
+			SQ_OPCASE(_OP_MULF): _ARITH_FLOAT_(*,_OP_MUL); SQ_NEXT();
+			SQ_OPCASE(_OP_DIV): _ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),_SC("division by zero")); SQ_NEXT();
+			SQ_OPCASE(_OP_MOD): ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); SQ_NEXT();
+			SQ_OPCASE(_OP_BITW):	_GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); SQ_NEXT();
+			SQ_OPCASE(_OP_RETURN):
 				if((ci)->_generator) {
 					(ci)->_generator->Kill();
 				}
@@ -844,25 +951,49 @@ exception_restore:
 					_Swap(outres,temp_reg);
 					return true;
 				}
-				continue;
-			case _OP_LOADNULLS:{ for(SQInt32 n=0; n < arg1; n++) STK(arg0+n).Null(); }continue;
-			case _OP_LOADROOT:	TARGET = _roottable; continue;
-			case _OP_LOADBOOL: TARGET = arg1?true:false; continue;
-			case _OP_DMOVE: STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); continue;
-			case _OP_JMP: ci->_ip += (sarg1); continue;
-			//case _OP_JNZ: if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-			case _OP_JCMP: 
+				SQ_NEXT();
+			SQ_OPCASE(_OP_LOADNULLS):{ for(SQInt32 n=0; n < arg1; n++) STK(arg0+n).Null(); }SQ_NEXT();
+			SQ_OPCASE(_OP_LOADROOT):	TARGET = _roottable; SQ_NEXT();
+			SQ_OPCASE(_OP_LOADBOOL): TARGET = arg1?true:false; SQ_NEXT();
+			SQ_OPCASE(_OP_DMOVE): STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); SQ_NEXT();
+			SQ_OPCASE(_OP_JMP): if(sarg1 < 0) _CHECK_MEMORY(); ci->_ip += (sarg1); SQ_NEXT();
+			//SQ_OPCASE(_OP_JNZ): if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); SQ_NEXT();
+			SQ_OPCASE(_OP_JCMP): 
 				_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
 				if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
-				continue;
-			case _OP_JZ: if(IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-			case _OP_GETOUTER: {
+				SQ_NEXT();
+			SQ_OPCASE(_OP_JCMPI): {
+#ifndef _SQ64
+				SQInteger i2 = (SQInteger)arg1;
+#else
+				SQInteger i2 = (SQInteger)((SQUnsignedInteger32)arg1);
+#endif
+				SQInstruction *j = ci->_ip; //the _OP_JCMP
+				if(type(STK(j->_arg2)) != OT_INTEGER) {
+					TARGET = i2;
+					SQ_NEXT();
+				}
+				SQInteger i1 = _integer(STK(j->_arg2));
+				bool res;
+				switch(j->_arg3) {
+					case CMP_G: res = i1 > i2; break;
+					case CMP_GE: res = i1 >= i2; break;
+					case CMP_L: res = i1 < i2; break;
+					case CMP_LE: res = i1 <= i2; break;
+					default: res = i1 != i2; break; //CMP_3W
+				}
+				_i_ = ci->_ip++;
+				if(!res) ci->_ip+=(sarg1);
+				}
+				SQ_NEXT();
+			SQ_OPCASE(_OP_JZ): if(IsFalse(STK(arg0))) ci->_ip+=(sarg1); SQ_NEXT();
+			SQ_OPCASE(_OP_GETOUTER): {
 				SQClosure *cur_cls = _closure(ci->_closure);
 				SQOuter *otr = _outer(cur_cls->_outervalues[arg1]);
 				TARGET = *(otr->_valptr);
 				}
-			continue;
-			case _OP_SETOUTER: {
+			SQ_NEXT();
+			SQ_OPCASE(_OP_SETOUTER): {
 				SQClosure *cur_cls = _closure(ci->_closure);
 				SQOuter   *otr = _outer(cur_cls->_outervalues[arg1]);
 				*(otr->_valptr) = STK(arg2);
@@ -870,15 +1001,15 @@ exception_restore:
 					TARGET = STK(arg2);
 				}
 				}
-			continue;
-			case _OP_NEWOBJ: 
+			SQ_NEXT();
+			SQ_OPCASE(_OP_NEWOBJ): 
 				switch(arg3) {
-					case NOT_TABLE: TARGET = SQTable::Create(_ss(this), arg1); continue;
-					case NOT_ARRAY: TARGET = SQArray::Create(_ss(this), 0); _array(TARGET)->Reserve(arg1); continue;
-					case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); continue;
-					default: assert(0); continue;
+					case NOT_TABLE: TARGET = SQTable::Create(_ss(this), arg1); SQ_NEXT();
+					case NOT_ARRAY: TARGET = SQArray::Create(_ss(this), 0); _array(TARGET)->Reserve(arg1); SQ_NEXT();
+					case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); SQ_NEXT();
+					default: assert(0); SQ_NEXT();
 				}
-			case _OP_APPENDARRAY: 
+			SQ_OPCASE(_OP_APPENDARRAY): 
 				{
 					SQObject val;
 					val._unVal.raw = 0;
@@ -906,15 +1037,15 @@ exception_restore:
 				default: assert(0); break;
 
 				}
-				_array(STK(arg0))->Append(val);	continue;
+				_array(STK(arg0))->Append(val);	SQ_NEXT();
 				}
-			case _OP_COMPARITH: {
+			SQ_OPCASE(_OP_COMPARITH): {
 				SQInteger selfidx = (((SQUnsignedInteger)arg1&0xFFFF0000)>>16);
 				_GUARD(DerefInc(arg3, TARGET, STK(selfidx), STK(arg2), STK(arg1&0x0000FFFF), false, selfidx)); 
 								}
-				continue;
-			case _OP_INC: {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} continue;
-			case _OP_INCL: {
+				SQ_NEXT();
+			SQ_OPCASE(_OP_INC): {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} SQ_NEXT();
+			SQ_OPCASE(_OP_INCL): {
 				SQObjectPtr &a = STK(arg1);
 				if(type(a) == OT_INTEGER) {
 					a._unVal.nInteger = _integer(a) + sarg3;
@@ -923,9 +1054,9 @@ exception_restore:
 					SQObjectPtr o(sarg3); //_GUARD(LOCAL_INC('+',TARGET, STK(arg1), o));
 					_ARITH_(+,a,a,o);
 				}
-						   } continue;
-			case _OP_PINC: {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} continue;
-			case _OP_PINCL:	{
+						   } SQ_NEXT();
+			SQ_OPCASE(_OP_PINC): {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} SQ_NEXT();
+			SQ_OPCASE(_OP_PINCL):	{
 				SQObjectPtr &a = STK(arg1);
 				if(type(a) == OT_INTEGER) {
 					TARGET = a;
@@ -935,43 +1066,43 @@ exception_restore:
 					SQObjectPtr o(sarg3); _GUARD(PLOCAL_INC('+',TARGET, STK(arg1), o));
 				}
 				
-						} continue;
-			case _OP_CMP:	_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))	continue;
-			case _OP_EXISTS: TARGET = Get(STK(arg1), STK(arg2), temp_reg, true,DONT_FALL_BACK)?true:false;continue;
-			case _OP_INSTANCEOF: 
+						} SQ_NEXT();
+			SQ_OPCASE(_OP_CMP):	_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))	SQ_NEXT();
+			SQ_OPCASE(_OP_EXISTS): TARGET = Get(STK(arg1), STK(arg2), temp_reg, true,DONT_FALL_BACK)?true:false;SQ_NEXT();
+			SQ_OPCASE(_OP_INSTANCEOF): 
 				if(type(STK(arg1)) != OT_CLASS)
 				{Raise_Error(_SC("cannot apply instanceof between a %s and a %s"),GetTypeName(STK(arg1)),GetTypeName(STK(arg2))); SQ_THROW();}
 				TARGET = (type(STK(arg2)) == OT_INSTANCE) ? (_instance(STK(arg2))->InstanceOf(_class(STK(arg1)))?true:false) : false;
-				continue;
-			case _OP_AND: 
+				SQ_NEXT();
+			SQ_OPCASE(_OP_AND): 
 				if(IsFalse(STK(arg2))) {
 					TARGET = STK(arg2);
 					ci->_ip += (sarg1);
 				}
-				continue;
-			case _OP_OR:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_OR):
 				if(!IsFalse(STK(arg2))) {
 					TARGET = STK(arg2);
 					ci->_ip += (sarg1);
 				}
-				continue;
-			case _OP_NEG: _GUARD(NEG_OP(TARGET,STK(arg1))); continue;
-			case _OP_NOT: TARGET = IsFalse(STK(arg1)); continue;
-			case _OP_BWNOT:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_NEG): _GUARD(NEG_OP(TARGET,STK(arg1))); SQ_NEXT();
+			SQ_OPCASE(_OP_NOT): TARGET = IsFalse(STK(arg1)); SQ_NEXT();
+			SQ_OPCASE(_OP_BWNOT):
 				if(type(STK(arg1)) == OT_INTEGER) {
 					SQInteger t = _integer(STK(arg1));
 					TARGET = SQInteger(~t);
-					continue;
+					SQ_NEXT();
 				}
 				Raise_Error(_SC("attempt to perform a bitwise op on a %s"), GetTypeName(STK(arg1)));
 				SQ_THROW();
-			case _OP_CLOSURE: {
+			SQ_OPCASE(_OP_CLOSURE): {
 				SQClosure *c = ci->_closure._unVal.pClosure;
 				SQFunctionProto *fp = c->_function;
 				if(!CLOSURE_OP(TARGET,fp->_functions[arg1]._unVal.pFunctionProto)) { SQ_THROW(); }
-				continue;
+				SQ_NEXT();
 			}
-			case _OP_YIELD:{
+			SQ_OPCASE(_OP_YIELD):{
 				if(ci->_generator) {
 					if(sarg1 != MAX_FUNC_STACKSIZE) temp_reg = STK(arg1);
 					_GUARD(ci->_generator->Yield(this,arg2));
@@ -986,41 +1117,41 @@ exception_restore:
 				}
 					
 				}
-				continue;
-			case _OP_RESUME:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_RESUME):
 				if(type(STK(arg1)) != OT_GENERATOR){ Raise_Error(_SC("trying to resume a '%s',only genenerator can be resumed"), GetTypeName(STK(arg1))); SQ_THROW();}
 				_GUARD(_generator(STK(arg1))->Resume(this, TARGET));
 				traps += ci->_etraps;
-                continue;
-			case _OP_FOREACH:{ int tojump;
+                SQ_NEXT();
+			SQ_OPCASE(_OP_FOREACH):{ int tojump;
 				_GUARD(FOREACH_OP(STK(arg0),STK(arg2),STK(arg2+1),STK(arg2+2),arg2,sarg1,tojump));
 				ci->_ip += tojump; }
-				continue;
-			case _OP_POSTFOREACH:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_POSTFOREACH):
 				assert(type(STK(arg0)) == OT_GENERATOR);
 				if(_generator(STK(arg0))->_state == SQGenerator::eDead) 
 					ci->_ip += (sarg1 - 1);
-				continue;
-			case _OP_CLONE: _GUARD(Clone(STK(arg1), TARGET)); continue;
-			case _OP_TYPEOF: _GUARD(TypeOf(STK(arg1), TARGET)) continue;
-			case _OP_PUSHTRAP:{
+				SQ_NEXT();
+			SQ_OPCASE(_OP_CLONE): _GUARD(Clone(STK(arg1), TARGET)); SQ_NEXT();
+			SQ_OPCASE(_OP_TYPEOF): _GUARD(TypeOf(STK(arg1), TARGET)) SQ_NEXT();
+			SQ_OPCASE(_OP_PUSHTRAP):{
 				SQInstruction *_iv = _closure(ci->_closure)->_function->_instructions;
 				_etraps.push_back(SQExceptionTrap(_top,_stackbase, &_iv[(ci->_ip-_iv)+arg1], arg0)); traps++;
 				ci->_etraps++;
 							  }
-				continue;
-			case _OP_POPTRAP: {
+				SQ_NEXT();
+			SQ_OPCASE(_OP_POPTRAP): {
 				for(SQInteger i = 0; i < arg0; i++) {
 					_etraps.pop_back(); traps--;
 					ci->_etraps--;
 				}
 							  }
-				continue;
-			case _OP_THROW:	Raise_Error(TARGET); SQ_THROW(); continue;
-			case _OP_NEWSLOTA:
+				SQ_NEXT();
+			SQ_OPCASE(_OP_THROW):	Raise_Error(TARGET); SQ_THROW(); SQ_NEXT();
+			SQ_OPCASE(_OP_NEWSLOTA):
 				_GUARD(NewSlotA(STK(arg1),STK(arg2),STK(arg3),(arg0&NEW_SLOT_ATTRIBUTES_FLAG) ? STK(arg2-1) : SQObjectPtr(),(arg0&NEW_SLOT_STATIC_FLAG)?true:false,false));
-				continue;
-			case _OP_GETBASE:{
+				SQ_NEXT();
+			SQ_OPCASE(_OP_GETBASE):{
 				SQClosure *clo = _closure(ci->_closure);
 				if(clo->_base) {
 					TARGET = clo->_base;
@@ -1028,11 +1159,11 @@ exception_restore:
 				else {
 					TARGET.Null();
 				}
-				continue;
+				SQ_NEXT();
 			}
-			case _OP_CLOSE:
+			SQ_OPCASE(_OP_CLOSE):
 				if(_openouters) CloseOuters(&(STK(arg1)));
-				continue;
+				SQ_NEXT();
 			}
 			
 		}
@@ -1212,6 +1343,39 @@ bool SQVM::Get(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest,
 		break;
 	default:break; //shut up compiler
 	}
+	return GetMissing(self,key,dest,raw,selfidx);
+}
+
+//Get for the instructions that read a slot (_OP_GET/_OP_GETK/_OP_PREPCALL/_OP_PREPCALLK).
+//own table slots and instance members are looked up through the instruction's inline cache,
+//instances go through the member table of their class so the cache follows the class.
+bool SQVM::GetCached(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest,SQInteger selfidx,SQInlineCache &cache)
+{
+	SQObjectPtr *v;
+	switch(type(self)){
+	case OT_TABLE:
+		if((v = _table(self)->GetCached(key,cache))) {
+			dest = _realval(*v);
+			return true;
+		}
+		break;
+	case OT_INSTANCE: {
+		SQInstance *inst = _instance(self);
+		if((v = inst->_class->_members->GetCached(key,cache))) {
+			if(_isfield(*v)) dest = _realval(inst->_values[_member_idx(*v)]);
+			else dest = inst->_class->_methods[_member_idx(*v)].val;
+			return true;
+		}
+		}
+		break;
+	default:
+		return Get(self,key,dest,false,selfidx);
+	}
+	return GetMissing(self,key,dest,false,selfidx);
+}
+
+bool SQVM::GetMissing(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest,bool raw,SQInteger selfidx)
+{
 	if(!raw) {
 		switch(FallBackGet(self,key,dest)) {
 			case FALLBACK_OK: return true; //okie
@@ -66,6 +66,8 @@ public:
 	void CallDebugHook(SQInteger type,SQInteger forcedline=0);
 	void CallErrorHandler(SQObjectPtr &e);
 	bool Get(const SQObjectPtr &self, const SQObjectPtr &key, SQObjectPtr &dest, bool raw, SQInteger selfidx);
+	bool GetCached(const SQObjectPtr &self, const SQObjectPtr &key, SQObjectPtr &dest, SQInteger selfidx, SQInlineCache &cache);
+	bool GetMissing(const SQObjectPtr &self, const SQObjectPtr &key, SQObjectPtr &dest, bool raw, SQInteger selfidx);
 	SQInteger FallBackGet(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest);
 	bool InvokeDefaultDelegate(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest);
 	bool Set(const SQObjectPtr &self, const SQObjectPtr &key, const SQObjectPtr &val, SQInteger selfidx);
@@ -101,6 +103,7 @@ public:
 	_INLINE bool NEG_OP(SQObjectPtr &trg,const SQObjectPtr &o1);
 	_INLINE bool CMP_OP(CmpOP op, const SQObjectPtr &o1,const SQObjectPtr &o2,SQObjectPtr &res);
 	bool CLOSURE_OP(SQObjectPtr &target, SQFunctionProto *func);
+	bool CheckMemory();
 	bool CLASS_OP(SQObjectPtr &target,SQInteger base,SQInteger attrs);
 	//return true if the loop is finished
 	bool FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr &o3,SQObjectPtr &o4,SQInteger arg_2,int exitpos,int &jump);
@@ -124,7 +127,7 @@ public:
 	}
 	bool EnterFrame(SQInteger newbase, SQInteger newtop, bool tailcall);
 	void LeaveFrame();
-	void Release(){ sq_delete(this,SQVM); }
+	void Release(){ sq_delete(_sharedstate,this,SQVM); }
 ////////////////////////////////////////////////////////////////////////////
 	//stack functions for the api
 	void Remove(SQInteger n);
@@ -164,8 +167,6 @@ public:
 	ExceptionsTraps _etraps;
 	CallInfo *ci;
 	void *_foreignptr;
-	//VMs sharing the same state
-	SQSharedState *_sharedstate;
 	SQInteger _nnativecalls;
 	SQInteger _nmetamethodscall;
 	//suspend infos
@@ -185,11 +186,7 @@ inline SQObjectPtr &stack_get(HSQUIRRELVM v,SQInteger idx){return ((idx>=0)?(v->
 
 #define _ss(_vm_) (_vm_)->_sharedstate
 
-#ifndef NO_GARBAGE_COLLECTOR
 #define _opt_ss(_vm_) (_vm_)->_sharedstate
-#else
-#define _opt_ss(_vm_) NULL
-#endif
 
 #define PUSH_CALLINFO(v,nci){ \
 	SQInteger css = v->_callsstacksize; \
@@ -0,0 +1,226 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2014 Zachary Mulgrew, ZackTheHuman
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef MARMOT_BOUNDFUNCTION_HPP
+#define MARMOT_BOUNDFUNCTION_HPP
+
+#include "marmot/Error.hpp"
+#include "marmot/Stack.hpp"
+#include <squirrel.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace marmot {
+
+  namespace detail {
+    /**
+     * Reads the error left behind by a failed sq_call and throws it. This is
+     * kept out of line so that the successful call path stays small.
+     */
+    [[noreturn]] inline void throwCallError(HSQUIRRELVM vm) {
+      sq_getlasterror(vm);
+      sq_tostring(vm, -1); // Pushes the error object as a string
+      std::string error = stack::get<std::string>(vm, -1);
+      sq_pop(vm, 3); // Pops the error string, the error object and the closure
+      throw MarmotError("Error calling the function, reason: " + error);
+    }
+
+    template<typename Ret>
+    struct BoundReturn {
+      static Ret apply(HSQUIRRELVM vm) {
+        // The return value is at the top, the closure at -2
+        Ret value = stack::get<Ret>(vm, -1);
+        sq_pop(vm, 2);
+        return value;
+      }
+    };
+
+    template<>
+    struct BoundReturn<void> {
+      static void apply(HSQUIRRELVM vm) {
+        // The closure is at the top of the stack
+        sq_poptop(vm);
+      }
+    };
+  } // detail
+
+  // Forward declaration
+  template<typename Signature>
+  class BoundFunction;
+
+  /**
+   * A prepared call to a Squirrel function with a fixed signature. The arity
+   * of the closure is checked once when the BoundFunction is created, so each
+   * call only pushes the closure, its environment and the arguments.
+   *
+   * Closures with default parameters or varargs must be bound with the exact
+   * number of declared parameters; use Function::call for anything else.
+   */
+  template<typename Ret, typename... Args>
+  class BoundFunction<Ret(Args...)> {
+  private:
+    HSQUIRRELVM vm = nullptr; // Non-owning pointer
+    HSQOBJECT fnObj;
+    HSQOBJECT environment;
+
+    // The closure, its environment and each argument; the return value
+    // replaces the environment and arguments once the call completes.
+    static const SQInteger stackSize = sizeof...(Args) + 2;
+
+    void addref() {
+      if(vm) {
+        sq_addref(vm, &fnObj);
+        sq_addref(vm, &environment);
+      }
+    }
+
+    void release() {
+      if(vm) {
+        sq_release(vm, &fnObj);
+        sq_release(vm, &environment);
+      }
+    }
+
+    void checkArity() {
+      SQUnsignedInteger nparams = 0;
+      SQUnsignedInteger nfreevars = 0;
+
+      sq_pushobject(vm, fnObj);
+      SQRESULT result = sq_getclosureinfo(vm, -1, &nparams, &nfreevars);
+      SQObjectType type = sq_gettype(vm, -1);
+      sq_pop(vm, 1);
+
+      if(SQ_FAILED(result)) {
+        throw MarmotError("Cannot bind an object that is not a closure.");
+      }
+
+      // Squirrel counts the environment ("this") as a parameter
+      const SQInteger expected = static_cast<SQInteger>(sizeof...(Args)) + 1;
+      const SQInteger declared = static_cast<SQInteger>(nparams);
+
+      if(type == OT_NATIVECLOSURE) {
+        // Native closures store their parameter check: zero means unchecked,
+        // negative means "at least" that many.
+        if((declared > 0 && declared != expected) || (declared < 0 && expected < -declared)) {
+          throw MarmotError("Bound signature does not match the native closure's parameter count.");
+        }
+      } else if(declared != expected) {
+        throw MarmotError("Bound signature does not match the closure's parameter count.");
+      }
+    }
+
+  public:
+    BoundFunction() noexcept
+      : vm(nullptr)
+    {
+      sq_resetobject(&fnObj);
+      sq_resetobject(&environment);
+    }
+
+    BoundFunction(HSQUIRRELVM vm, const HSQOBJECT & fn, const HSQOBJECT & env)
+      : vm(vm)
+      , fnObj(fn)
+      , environment(env)
+    {
+      if(!vm) {
+        throw MarmotError("Cannot bind function without a VM.");
+      }
+
+      if(sq_isnull(environment) || sq_isnull(fnObj)) {
+        throw MarmotError("Cannot bind function without an environment and stack object.");
+      }
+
+      checkArity();
+      addref();
+
+      if(SQ_FAILED(sq_reservestack(vm, stackSize))) {
+        release();
+        throw MarmotError("Cannot reserve stack space for the bound function.");
+      }
+    }
+
+    BoundFunction(const BoundFunction & other) noexcept
+      : vm(other.vm)
+      , fnObj(other.fnObj)
+      , environment(other.environment)
+    {
+      addref();
+    }
+
+    BoundFunction(BoundFunction && other) noexcept
+      : vm(other.vm)
+      , fnObj(other.fnObj)
+      , environment(other.environment)
+    {
+      other.vm = nullptr;
+    }
+
+    BoundFunction& operator=(BoundFunction other) noexcept {
+      std::swap(vm, other.vm);
+      std::swap(fnObj, other.fnObj);
+      std::swap(environment, other.environment);
+      return *this;
+    }
+
+    ~BoundFunction() {
+      release();
+    }
+
+    /**
+     * Calls the bound function. Arguments are forwarded straight to
+     * stack::push, so strings and references are never copied.
+     */
+    template<typename... Ts>
+    Ret operator()(Ts&&... args) {
+      static_assert(sizeof...(Ts) == sizeof...(Args), "Wrong number of arguments for bound function.");
+
+      if(!vm) {
+        throw MarmotError("Cannot call function without a VM.");
+      }
+
+      // Only grows the stack if the caller has used up the space reserved
+      // when the function was bound.
+      sq_reservestack(vm, stackSize);
+
+      sq_pushobject(vm, fnObj);
+      sq_pushobject(vm, environment);
+
+      // Expands to one push per argument, in order
+      int expand[] = { 0, (stack::push(vm, std::forward<Ts>(args)), 0)... };
+      (void)expand;
+
+      if(SQ_FAILED(sq_call(vm, stackSize - 1, std::is_void<Ret>::value ? SQFalse : SQTrue, SQTrue))) {
+        detail::throwCallError(vm);
+      }
+
+      return detail::BoundReturn<Ret>::apply(vm);
+    }
+
+    template<typename... Ts>
+    Ret call(Ts&&... args) {
+      return (*this)(std::forward<Ts>(args)...);
+    }
+  };
+
+} // marmot
+
+#endif // MARMOT_BOUNDFUNCTION_HPP
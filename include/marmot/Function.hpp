@@ -22,6 +22,7 @@
 #ifndef MARMOT_FUNCTION_HPP
 #define MARMOT_FUNCTION_HPP
 
+#include "marmot/BoundFunction.hpp"
 #include "marmot/Reference.hpp"
 #include "marmot/Proxy.hpp"
 #include "marmot/Stack.hpp"
@@ -99,6 +100,16 @@ namespace marmot {
 
       return stack::pop<Ret>(vm);
     }
+
+    /**
+     * Prepares a call with a fixed signature, checking the closure's arity
+     * once up front. Use this for functions that are called repeatedly.
+     * @return a callable object for this function
+     */
+    template <typename Signature>
+    BoundFunction<Signature> bind() const {
+      return BoundFunction<Signature>(vm, fnObj, environment);
+    }
   };
 
 } // marmot
@@ -0,0 +1,125 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2014 Zachary Mulgrew, ZackTheHuman
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef MARMOT_MAPPEDFILE_HPP
+#define MARMOT_MAPPEDFILE_HPP
+
+#include "marmot/Error.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace marmot {
+
+  /**
+   * A read-only view of a whole file. On POSIX systems the file is mapped
+   * into memory, so opening it costs a single mmap regardless of its size.
+   * Elsewhere the file is read into memory in one go.
+   */
+  class MappedFile {
+  private:
+#ifdef _WIN32
+    std::vector<std::uint8_t> buffer;
+#endif
+    const std::uint8_t * bytes = nullptr;
+    std::size_t length = 0;
+
+  public:
+    explicit MappedFile(const std::string & path) {
+#ifdef _WIN32
+      std::ifstream file(path, std::ios::binary);
+
+      if(!file) {
+        throw MarmotError("Cannot open file: " + path);
+      }
+
+      buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      bytes = buffer.data();
+      length = buffer.size();
+#else
+      int fd = ::open(path.c_str(), O_RDONLY);
+
+      if(fd < 0) {
+        throw MarmotError("Cannot open file: " + path);
+      }
+
+      struct stat info;
+
+      if(::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw MarmotError("Cannot read file size: " + path);
+      }
+
+      length = static_cast<std::size_t>(info.st_size);
+
+      if(length > 0) {
+        void * mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(mapping == MAP_FAILED) {
+          ::close(fd);
+          throw MarmotError("Cannot map file: " + path);
+        }
+
+#ifdef MADV_SEQUENTIAL
+        ::madvise(mapping, length, MADV_SEQUENTIAL);
+#endif
+        bytes = static_cast<const std::uint8_t*>(mapping);
+      }
+
+      // The mapping stays valid after the descriptor is closed
+      ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+      if(bytes) {
+        ::munmap(const_cast<std::uint8_t*>(bytes), length);
+      }
+#endif
+    }
+
+    const std::uint8_t * data() const noexcept {
+      return bytes;
+    }
+
+    std::size_t size() const noexcept {
+      return length;
+    }
+  };
+
+} // marmot
+
+#endif // MARMOT_MAPPEDFILE_HPP
@@ -0,0 +1,183 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2014 Zachary Mulgrew, ZackTheHuman
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef MARMOT_SCRIPTCACHE_HPP
+#define MARMOT_SCRIPTCACHE_HPP
+
+#include "marmot/Reference.hpp"
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace marmot {
+
+  /**
+   * Counters describing how well a ScriptCache is doing.
+   */
+  struct ScriptCacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+  };
+
+  /**
+   * Keeps compiled closures around so that running the same script text more
+   * than once skips the lexer and compiler. Entries are keyed by a hash of the
+   * source text and source name, and are evicted least-recently-used first
+   * once the byte budget is exceeded. The size of an entry is the size of its
+   * source text, which is what the cache has to keep to rule out collisions.
+   */
+  class ScriptCache {
+  private:
+    struct Entry {
+      std::size_t hash;
+      std::string name;
+      std::string source;
+      Reference closure;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    EntryList entries; // Most recently used first
+    std::unordered_multimap<std::size_t, EntryList::iterator> index;
+    std::size_t budget;
+    ScriptCacheStats stats;
+
+    static std::size_t hashOf(const std::string & source, const std::string & name) {
+      std::hash<std::string> hasher;
+      std::size_t seed = hasher(source);
+      seed ^= hasher(name) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+      return seed;
+    }
+
+    static std::size_t sizeOf(const Entry & entry) {
+      return entry.source.size() + entry.name.size();
+    }
+
+    void erase(EntryList::iterator it) {
+      auto range = index.equal_range(it->hash);
+
+      for(auto i = range.first; i != range.second; ++i) {
+        if(i->second == it) {
+          index.erase(i);
+          break;
+        }
+      }
+
+      stats.bytes -= sizeOf(*it);
+      stats.entries -= 1;
+      entries.erase(it);
+    }
+
+    void trim() {
+      while(!entries.empty() && stats.bytes > budget) {
+        erase(std::prev(entries.end()));
+        stats.evictions += 1;
+      }
+    }
+
+  public:
+    explicit ScriptCache(std::size_t budget = 1024 * 1024)
+      : budget(budget)
+    {
+
+    }
+
+    /**
+     * Looks up the compiled closure for a script, marking it as recently used.
+     * @return a pointer to the closure, or nullptr on a miss
+     */
+    const Reference * find(const std::string & source, const std::string & name) {
+      if(budget == 0) {
+        return nullptr;
+      }
+
+      auto range = index.equal_range(hashOf(source, name));
+
+      for(auto i = range.first; i != range.second; ++i) {
+        Entry & entry = *i->second;
+
+        if(entry.name == name && entry.source == source) {
+          entries.splice(entries.begin(), entries, i->second);
+          stats.hits += 1;
+          return &entry.closure;
+        }
+      }
+
+      stats.misses += 1;
+      return nullptr;
+    }
+
+    /**
+     * Adds a compiled closure for a script. Scripts larger than the whole
+     * budget are not cached.
+     */
+    void insert(const std::string & source, const std::string & name, const Reference & closure) {
+      if(source.size() + name.size() > budget) {
+        return;
+      }
+
+      const std::size_t hash = hashOf(source, name);
+      entries.push_front(Entry{hash, name, source, closure});
+      index.emplace(hash, entries.begin());
+
+      stats.bytes += sizeOf(entries.front());
+      stats.entries += 1;
+
+      trim();
+    }
+
+    /**
+     * Removes every entry. The counters are kept.
+     */
+    void clear() {
+      index.clear();
+      entries.clear();
+      stats.bytes = 0;
+      stats.entries = 0;
+    }
+
+    /**
+     * Sets the byte budget, evicting entries if it shrank. A budget of zero
+     * disables the cache.
+     */
+    void setBudget(std::size_t bytes) {
+      budget = bytes;
+      trim();
+    }
+
+    std::size_t getBudget() const noexcept {
+      return budget;
+    }
+
+    const ScriptCacheStats & getStats() const noexcept {
+      return stats;
+    }
+  };
+
+} // marmot
+
+#endif // MARMOT_SCRIPTCACHE_HPP
@@ -23,14 +23,24 @@
 #define MARMOT_STATE_HPP
 
 #include "marmot/Error.hpp"
+#include "marmot/MappedFile.hpp"
 #include "marmot/Reference.hpp"
 #include "marmot/Proxy.hpp"
+#include "marmot/ScriptCache.hpp"
 #include "marmot/Table.hpp"
 #include "marmot/Stack.hpp"
 #include <squirrel.h>
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace marmot {
   namespace detail {
@@ -50,6 +60,158 @@ namespace marmot {
       va_end(vl);
       printf("\n");
     }
+
+    inline SQInteger writeBytecode(SQUserPointer up, SQUserPointer src, SQInteger size) {
+      std::vector<std::uint8_t> * buffer = static_cast<std::vector<std::uint8_t>*>(up);
+      const std::uint8_t * bytes = static_cast<const std::uint8_t*>(src);
+
+      buffer->insert(buffer->end(), bytes, bytes + size);
+
+      return size;
+    }
+
+    /**
+     * Header written in front of the closure stream by saveBytecodeImage.
+     * The string count lets the loader size the string table up front.
+     */
+    struct BytecodeImageHeader {
+      std::uint32_t magic;
+      std::uint32_t version;
+      std::uint32_t stringCount;
+    };
+
+    const std::uint32_t bytecodeImageMagic = 0x544d524d; // "MRMT"
+    const std::uint32_t bytecodeImageVersion = 1;
+
+    /**
+     * A constant value copied out of a VM, so it can be rebuilt in another.
+     */
+    struct ConstantValue {
+      SQObjectType type;
+      SQInteger integer;
+      SQFloat real;
+      std::string string;
+    };
+
+    /**
+     * A named entry of a constants table: either a single value or an enum.
+     */
+    struct Constant {
+      std::string name;
+      ConstantValue value;
+      std::vector<std::pair<std::string, ConstantValue>> members;
+    };
+
+    inline bool readConstantValue(HSQUIRRELVM vm, SQInteger idx, ConstantValue & out) {
+      out.type = sq_gettype(vm, idx);
+
+      switch(out.type) {
+        case OT_INTEGER:
+          sq_getinteger(vm, idx, &out.integer);
+          return true;
+        case OT_BOOL: {
+          SQBool b = SQFalse;
+          sq_getbool(vm, idx, &b);
+          out.integer = b;
+          return true;
+        }
+        case OT_FLOAT:
+          sq_getfloat(vm, idx, &out.real);
+          return true;
+        case OT_STRING: {
+          const SQChar * s = nullptr;
+          sq_getstring(vm, idx, &s);
+          out.string.assign(s, static_cast<std::size_t>(sq_getsize(vm, idx)));
+          return true;
+        }
+        default:
+          return false;
+      }
+    }
+
+    inline void pushConstantValue(HSQUIRRELVM vm, const ConstantValue & value) {
+      switch(value.type) {
+        case OT_INTEGER: sq_pushinteger(vm, value.integer); break;
+        case OT_BOOL: sq_pushbool(vm, static_cast<SQBool>(value.integer)); break;
+        case OT_FLOAT: sq_pushfloat(vm, value.real); break;
+        default: sq_pushstring(vm, value.string.data(), static_cast<SQInteger>(value.string.size())); break;
+      }
+    }
+
+    /**
+     * Copies the constants table of a VM. Only values the compiler can inline
+     * are kept: integers, floats, bools, strings and enum tables of those.
+     */
+    inline std::vector<Constant> snapshotConstants(HSQUIRRELVM vm) {
+      std::vector<Constant> constants;
+      SQInteger top = sq_gettop(vm);
+
+      sq_pushconsttable(vm);
+      sq_pushnull(vm);
+
+      while(SQ_SUCCEEDED(sq_next(vm, -2))) {
+        Constant constant;
+        const SQChar * name = nullptr;
+
+        if(SQ_SUCCEEDED(sq_getstring(vm, -2, &name))) {
+          constant.name = name;
+
+          if(sq_gettype(vm, -1) == OT_TABLE) {
+            constant.value.type = OT_TABLE;
+            sq_pushnull(vm);
+
+            while(SQ_SUCCEEDED(sq_next(vm, -2))) {
+              ConstantValue member;
+              const SQChar * memberName = nullptr;
+
+              if(SQ_SUCCEEDED(sq_getstring(vm, -2, &memberName)) && readConstantValue(vm, -1, member)) {
+                constant.members.emplace_back(memberName, member);
+              }
+
+              sq_pop(vm, 2);
+            }
+
+            sq_poptop(vm);
+            constants.push_back(constant);
+          } else if(readConstantValue(vm, -1, constant.value)) {
+            constants.push_back(constant);
+          }
+        }
+
+        sq_pop(vm, 2);
+      }
+
+      sq_settop(vm, top);
+
+      return constants;
+    }
+
+    /**
+     * Replaces the constants table of a VM with a fresh one holding the given constants.
+     */
+    inline void loadConstants(HSQUIRRELVM vm, const std::vector<Constant> & constants) {
+      sq_newtable(vm);
+
+      for(const auto & constant : constants) {
+        sq_pushstring(vm, constant.name.c_str(), -1);
+
+        if(constant.value.type == OT_TABLE) {
+          sq_newtable(vm);
+
+          for(const auto & member : constant.members) {
+            sq_pushstring(vm, member.first.c_str(), -1);
+            pushConstantValue(vm, member.second);
+            sq_newslot(vm, -3, SQFalse);
+          }
+        } else {
+          pushConstantValue(vm, constant.value);
+        }
+
+        sq_newslot(vm, -3, SQFalse);
+      }
+
+      sq_setconsttable(vm);
+    }
   } // detail
 
   class State {
@@ -58,41 +220,86 @@ namespace marmot {
     Table root;
     Table constants;
     Table registry;
+    ScriptCache scriptCache;
 
     /**
      * Returns a Table object to the root table.
      * @return a Table object to the root table.
      */
-    Table && _getRootTable() {
+    Table _getRootTable() {
       sq_pushroottable(vm.get());
       auto result = Table(vm.get(), -1);
       sq_pop(vm.get(), 1);
 
-      return std::move(result);
+      return result;
     }
 
     /**
      * Returns a Table object to the constants table.
      * @return a Table object to the constants table.
      */
-    Table && _getConstTable() {
+    Table _getConstTable() {
       sq_pushconsttable(vm.get());
       auto result = Table(vm.get(), -1);
       sq_pop(vm.get(), 1);
 
-      return std::move(result);
+      return result;
     }
 
     /**
      * Returns a Table object to the registry table.
      * @return a Table object to the registry table.
      */
-    Table && _getRegistryTable() {
+    Table _getRegistryTable() {
       sq_pushregistrytable(vm.get());
       auto result = Table(vm.get(), -1);
       sq_pop(vm.get(), 1);
 
-      return std::move(result);
+      return result;
+    }
+
+    /**
+     * Converts the last error of the VM to a string and throws it.
+     */
+    [[noreturn]] void _throwLastError() {
+      sq_getlasterror(getVM());
+      sq_tostring(getVM(), -1); // Convert the error object to a string
+      std::string error = stack::get<std::string>(getVM(), -1);
+      sq_pop(getVM(), 2); // Pop the error string and the error object
+      throw MarmotError(error);
+    }
+
+    /**
+     * Compiles a string of Squirrel code, leaving the closure on the stack.
+     */
+    void _compile(const std::string & script, const std::string & sourceName) {
+      SQRESULT compileResult = sq_compilebuffer(
+        getVM(),
+        script.c_str(),
+        static_cast<SQInteger>(script.size() * sizeof(SQChar)), sourceName.c_str(),
+        true
+      );
+
+      if(SQ_FAILED(compileResult)) {
+        _throwLastError();
+      }
+    }
+
+    /**
+     * Calls the closure at the top of the stack with the root table as its
+     * environment, then removes it from the stack.
+     */
+    void _runClosure(bool pushReturnValue) {
+      sq_pushroottable(getVM());
+      SQRESULT callResult = sq_call(getVM(), 1, pushReturnValue, true);
+
+      if(SQ_FAILED(callResult)) {
+        sq_poptop(getVM()); // A failed call leaves only the closure behind
+        _throwLastError();
+      }
+
+      // Remove the closure from the stack, reatining the return value if specified
+      sq_remove(getVM(), pushReturnValue ? -2 : -1);
     }
 
   public:
@@ -105,6 +312,21 @@ namespace marmot {
       sq_setprintfunc(vm.get(), detail::print, detail::error);
     }
 
+    /**
+     * Creates a state whose VM allocates all of its memory through the given
+     * allocator. The allocator must outlive the state.
+     * @param allocator the allocation hooks and their user pointer
+     * @param stackSize the initial stack size of the VM
+     */
+    State(const SQAllocator & allocator, const unsigned int stackSize = 1024)
+      : vm(sq_openwithallocator(stackSize, &allocator), sq_close)
+      , root(_getRootTable())
+      , constants(_getConstTable())
+      , registry(_getRegistryTable())
+    {
+      sq_setprintfunc(vm.get(), detail::print, detail::error);
+    }
+
     ~State() {
     }
 
@@ -117,38 +339,328 @@ namespace marmot {
     }
 
     /**
-     * Compiles and executes a string of Squirrel code.
-     * @param script [description]
+     * Compiles and executes a string of Squirrel code. Compiled scripts are
+     * kept in the script cache, so running the same string again only calls
+     * the cached closure.
+     * @param script the Squirrel source code to run
+     * @param pushReturnValue whether to leave the return value on the stack
+     * @param sourceName the name reported in errors and stack traces
      */
-    void runString(const std::string & script, bool pushReturnValue = false) {
-      SQRESULT compileResult = sq_compilebuffer(
-        getVM(),
-        script.c_str(),
-        static_cast<SQInteger>(script.size() * sizeof(SQChar)), _SC(""),
-        true
-      );
+    void runString(const std::string & script, bool pushReturnValue = false, const std::string & sourceName = "") {
+      const Reference * cached = scriptCache.find(script, sourceName);
 
-      if(SQ_FAILED(compileResult)) {
-        sq_getlasterror(getVM());
-        sq_tostring(getVM(), -1);
-        std::string error = stack::get<std::string>(getVM(), -1);
-        sq_pop(getVM(), 1); // Pop the error
-        throw MarmotError(error);
+      if(cached) {
+        cached->push();
+      } else {
+        _compile(script, sourceName);
+        scriptCache.insert(script, sourceName, Reference(getVM(), -1));
+      }
+
+      // The closure is on the stack at position -1
+      _runClosure(pushReturnValue);
+    }
+
+    /**
+     * Compiles a string of Squirrel code to bytecode without running it.
+     * @param script the Squirrel source code to compile
+     * @param sourceName the name reported in errors and stack traces
+     * @return the serialized closure, suitable for loadBytecode
+     */
+    std::vector<std::uint8_t> compileToBytecode(const std::string & script, const std::string & sourceName = "") {
+      std::vector<std::uint8_t> bytecode;
+
+      _compile(script, sourceName);
+
+      if(SQ_FAILED(sq_writeclosure(getVM(), detail::writeBytecode, &bytecode))) {
+        sq_poptop(getVM()); // Pop the closure
+        _throwLastError();
+      }
+
+      sq_poptop(getVM()); // Pop the closure
+
+      return bytecode;
+    }
+
+    /**
+     * Loads a closure from bytecode produced by compileToBytecode. Bytecode is
+     * trusted input: it is not validated beyond its header.
+     * @param data the start of the bytecode
+     * @param size the number of bytes of bytecode
+     * @return a reference to the loaded closure
+     */
+    Reference loadBytecode(const std::uint8_t * data, std::size_t size) {
+      if(SQ_FAILED(sq_readclosurebuffer(getVM(), data, static_cast<SQInteger>(size)))) {
+        _throwLastError();
+      }
+
+      Reference closure(getVM(), -1);
+      sq_poptop(getVM()); // Pop the closure
+
+      return closure;
+    }
+
+    Reference loadBytecode(const std::vector<std::uint8_t> & bytecode) {
+      return loadBytecode(bytecode.data(), bytecode.size());
+    }
+
+    /**
+     * Loads and executes bytecode produced by compileToBytecode.
+     * @param data the start of the bytecode
+     * @param size the number of bytes of bytecode
+     * @param pushReturnValue whether to leave the return value on the stack
+     */
+    void runBytecode(const std::uint8_t * data, std::size_t size, bool pushReturnValue = false) {
+      loadBytecode(data, size).push();
+      _runClosure(pushReturnValue);
+    }
+
+    void runBytecode(const std::vector<std::uint8_t> & bytecode, bool pushReturnValue = false) {
+      runBytecode(bytecode.data(), bytecode.size(), pushReturnValue);
+    }
+
+    /**
+     * Compiles a string of Squirrel code and writes it to a bytecode image
+     * file that loadBytecodeImage can map back in.
+     * @param path the file to write
+     * @param script the Squirrel source code to compile
+     * @param sourceName the name reported in errors and stack traces
+     */
+    void saveBytecodeImage(const std::string & path, const std::string & script, const std::string & sourceName = "") {
+      detail::BytecodeImageHeader header;
+      std::vector<std::uint8_t> bytecode;
+      SQInteger stringCount = 0;
+
+      _compile(script, sourceName);
+
+      if(SQ_FAILED(sq_getclosurestringcount(getVM(), -1, &stringCount)) ||
+         SQ_FAILED(sq_writeclosure(getVM(), detail::writeBytecode, &bytecode))) {
+        sq_poptop(getVM()); // Pop the closure
+        _throwLastError();
+      }
+
+      sq_poptop(getVM()); // Pop the closure
+
+      header.magic = detail::bytecodeImageMagic;
+      header.version = detail::bytecodeImageVersion;
+      header.stringCount = static_cast<std::uint32_t>(stringCount);
+
+      std::ofstream file(path, std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(bytecode.data()), bytecode.size());
+
+      if(!file) {
+        throw MarmotError("Cannot write bytecode image: " + path);
+      }
+    }
+
+    /**
+     * Maps a bytecode image written by saveBytecodeImage and loads the
+     * closure from it in place. The string table is grown once for every
+     * string in the image before any of them are interned.
+     * @param path the file to load
+     * @return a reference to the loaded closure
+     */
+    Reference loadBytecodeImage(const std::string & path) {
+      MappedFile image(path);
+      detail::BytecodeImageHeader header;
+
+      if(image.size() < sizeof(header)) {
+        throw MarmotError("Bytecode image is truncated: " + path);
+      }
+
+      std::memcpy(&header, image.data(), sizeof(header));
+
+      if(header.magic != detail::bytecodeImageMagic || header.version != detail::bytecodeImageVersion) {
+        throw MarmotError("Not a bytecode image: " + path);
+      }
+
+      sq_reservestrings(getVM(), static_cast<SQInteger>(header.stringCount));
+
+      return loadBytecode(image.data() + sizeof(header), image.size() - sizeof(header));
+    }
+
+    /**
+     * Compiles many source files concurrently and loads them into this state.
+     * Each worker thread compiles into a scratch state of its own and hands
+     * back bytecode, so only the final loads touch this state's VM. Every
+     * file is compiled on its own: constants and enums declared in one file
+     * are not visible to the others. Every file does see a copy of this
+     * state's constants as they were when the call was made, limited to the
+     * integers, floats, bools, strings and enums of those the compiler inlines.
+     * @param paths the source files to compile, also used as source names
+     * @param threads the number of worker threads, or 0 to use one per core
+     * @return references to the loaded closures, in the same order as paths
+     */
+    std::vector<Reference> compileFiles(const std::vector<std::string> & paths, unsigned int threads = 0) {
+      std::vector<std::vector<std::uint8_t>> bytecode(paths.size());
+      std::vector<std::string> errors(paths.size());
+      std::atomic<std::size_t> next(0);
+
+      // Workers never touch this VM, so they share a copy of its constants
+      const std::vector<detail::Constant> constants = detail::snapshotConstants(getVM());
+
+      auto worker = [&]() {
+        State scratch;
+
+        for(std::size_t i = next++; i < paths.size(); i = next++) {
+          std::ifstream file(paths[i], std::ios::binary);
+
+          if(!file) {
+            errors[i] = "Cannot open script: " + paths[i];
+            continue;
+          }
+
+          std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+          // Constants are inlined at compile time, so each file starts from the snapshot
+          detail::loadConstants(scratch.getVM(), constants);
+
+          try {
+            bytecode[i] = scratch.compileToBytecode(source, paths[i]);
+          } catch(const MarmotError & e) {
+            errors[i] = "Cannot compile " + paths[i] + ": " + e.what();
+          }
+        }
+      };
+
+      if(threads == 0) {
+        threads = std::thread::hardware_concurrency();
+      }
+
+      if(threads > paths.size()) {
+        threads = static_cast<unsigned int>(paths.size());
+      }
+
+      if(threads <= 1) {
+        worker();
       } else {
-        // The closure is on the stack at position -1
-        sq_pushroottable(getVM());
-        SQRESULT callResult = sq_call(getVM(), 1, pushReturnValue, true);
-         // Remove the closure from the stack, reatining the return value if specified
-        sq_remove(getVM(), pushReturnValue ? -2 : -1);
-
-        if(SQ_FAILED(callResult)) {
-          sq_getlasterror(getVM());
-          sq_tostring(getVM(), -1); // Convert the error object to a string
-          std::string error = stack::get<std::string>(getVM(), -1);
-          sq_pop(getVM(), 1); // Pop the error
+        std::vector<std::thread> workers;
+
+        for(unsigned int i = 0; i < threads; ++i) {
+          workers.emplace_back(worker);
+        }
+
+        for(auto & thread : workers) {
+          thread.join();
+        }
+      }
+
+      for(const auto & error : errors) {
+        if(!error.empty()) {
           throw MarmotError(error);
         }
       }
+
+      std::vector<Reference> closures;
+      closures.reserve(paths.size());
+
+      for(const auto & code : bytecode) {
+        closures.push_back(loadBytecode(code));
+      }
+
+      return closures;
+    }
+
+    /**
+     * Runs a complete garbage collection, finishing any incremental cycle
+     * that is in progress first.
+     * @return the number of unreachable objects that were collected
+     */
+    std::size_t collectGarbage() {
+      return static_cast<std::size_t>(sq_collectgarbage(vm.get()));
+    }
+
+    /**
+     * Advances the incremental garbage collector by about budget objects of
+     * work, so a large heap can be collected a little at a time.
+     * @param budget the number of objects to process in this step
+     * @return true if this step completed a collection cycle
+     */
+    bool collectGarbageStep(std::size_t budget) {
+      return sq_collectgarbage_step(vm.get(), static_cast<SQInteger>(budget)) == SQTrue;
+    }
+
+    /**
+     * Makes the state collect garbage on its own. A collection cycle starts
+     * once the heap has grown by growth percent since the previous cycle
+     * ended. With a step size the cycle runs incrementally, one step of about
+     * stepSize objects for every few bytes the scripts allocate; without one
+     * each cycle is a complete collection. A growth of zero turns pacing off.
+     * @param growth the heap growth, in percent, that triggers a cycle
+     * @param stepSize the number of objects to process per incremental step
+     */
+    void setGarbageCollectorPacing(unsigned int growth, std::size_t stepSize = 0) {
+      sq_setgcpacing(vm.get(), static_cast<SQInteger>(growth), static_cast<SQInteger>(stepSize));
+    }
+
+    /**
+     * Gets the number of bytes this state currently holds, the highest number
+     * it has held, the number of allocations it has made and its limit.
+     * @return the memory statistics of the state
+     */
+    SQMemoryStats memoryStats() const {
+      SQMemoryStats stats;
+      sq_getmemorystats(vm.get(), &stats);
+      return stats;
+    }
+
+    /**
+     * Sets a hard limit on the number of bytes this state may hold. Scripts
+     * that go over it fail with a MarmotError once a garbage collection can
+     * not bring the state back under the limit, and allocations sized by a
+     * script, like array(n) or blob(n), are refused up front when they would
+     * not fit. A limit of zero disables it.
+     * @param bytes the limit in bytes
+     */
+    void setMemoryLimit(std::size_t bytes) {
+      sq_setmemorylimit(vm.get(), bytes);
+    }
+
+    /**
+     * Gets the per-size-class statistics of the built-in slab allocator. The
+     * result is empty when the state was opened with a custom allocator.
+     * @return one entry per slab size class
+     */
+    std::vector<SQSlabClassStats> slabStats() const {
+      std::vector<SQSlabClassStats> stats(SQ_SLAB_NUMCLASSES);
+      stats.resize(sq_getslabstats(vm.get(), stats.data()));
+      return stats;
+    }
+
+    /**
+     * Gets the number of interned strings, the number of string table slots,
+     * how many of them are in use and the longest collision chain. The load
+     * factor of the table is strings / slots.
+     * @return the string table statistics
+     */
+    SQStringTableStats stringTableStats() const {
+      SQStringTableStats stats;
+      sq_getstringtablestats(vm.get(), &stats);
+      return stats;
+    }
+
+    /**
+     * Gets the hit, miss and eviction counters of the script cache.
+     * @return the script cache statistics
+     */
+    const ScriptCacheStats & scriptCacheStats() const noexcept {
+      return scriptCache.getStats();
+    }
+
+    /**
+     * Sets how many bytes of source the script cache may hold. A budget of
+     * zero disables caching.
+     * @param bytes the new budget
+     */
+    void setScriptCacheBudget(std::size_t bytes) {
+      scriptCache.setBudget(bytes);
+    }
+
+    /**
+     * Drops every compiled closure held by the script cache.
+     */
+    void clearScriptCache() {
+      scriptCache.clear();
     }
 
     /**
@@ -0,0 +1,124 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2014 Zachary Mulgrew, ZackTheHuman
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// These tests look at the instructions the compiler emits, so they reach into
+// Squirrel's internal headers.
+
+#include "marmot/State.hpp"
+#include <catch/catch.hpp>
+#include <sqpcheader.h>
+#include <sqvm.h>
+#include <sqfuncproto.h>
+#include <sqclosure.h>
+#include <vector>
+
+namespace {
+
+  // Copies the instructions of the Squirrel function stored in a root table slot.
+  std::vector<SQInstruction> instructionsOf(marmot::State & sq, const char * name) {
+    HSQUIRRELVM vm = sq.getVM();
+    HSQOBJECT closure;
+
+    sq_pushroottable(vm);
+    sq_pushstring(vm, name, -1);
+    REQUIRE(SQ_SUCCEEDED(sq_get(vm, -2)));
+    sq_getstackobj(vm, -1, &closure);
+    REQUIRE(sq_isclosure(closure));
+
+    SQFunctionProto * proto = _closure(closure)->_function;
+    std::vector<SQInstruction> code(proto->_instructions, proto->_instructions + proto->_ninstructions);
+    sq_pop(vm, 2); // Pop the closure and the root table
+    return code;
+  }
+
+  std::size_t countOpcode(const std::vector<SQInstruction> & code, SQOpcode op) {
+    std::size_t n = 0;
+
+    for(const auto & i : code) {
+      if(i.op == op) {
+        ++n;
+      }
+    }
+
+    return n;
+  }
+
+  SQInteger discardBytecode(SQUserPointer, SQUserPointer, SQInteger size) {
+    return size;
+  }
+
+}
+
+TEST_CASE( "Writing bytecode leaves the running function quickened", "[marmot::Bytecode]" ) {
+  marmot::State sq;
+  HSQUIRRELVM vm = sq.getVM();
+
+  sq.runString(
+    "function f(a, b) { return a * b + a; }"
+    "for(local i = 0; i < 16; i++) f(i, 3);");
+
+  const std::vector<SQInstruction> before = instructionsOf(sq, "f");
+  REQUIRE(countOpcode(before, _OP_MULI) == 1);
+  REQUIRE(countOpcode(before, _OP_ADDI) == 1);
+
+  sq_pushroottable(vm);
+  sq_pushstring(vm, "f", -1);
+  REQUIRE(SQ_SUCCEEDED(sq_get(vm, -2)));
+  REQUIRE(SQ_SUCCEEDED(sq_writeclosure(vm, discardBytecode, nullptr)));
+  sq_pop(vm, 2); // Pop the closure and the root table
+
+  const std::vector<SQInstruction> after = instructionsOf(sq, "f");
+  REQUIRE(after.size() == before.size());
+
+  for(std::size_t i = 0; i < after.size(); ++i) {
+    REQUIRE(after[i].op == before[i].op);
+    REQUIRE(after[i]._arg3 == before[i]._arg3);
+  }
+}
+
+TEST_CASE( "Compiler fuses method calls that take arguments", "[marmot::Bytecode]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "function plain(o, x) { o.f(); o.f(x); o.f(1, \"s\", x); return o.f(x, 2.5) + 1; }"
+    "function captured(o, x) { o.f(x); o.f(1); local h = function() { return x; }; o.f(x); }"
+    "function nested(o, x) { o.f(o.g(x), 1); o.f(o = x); }");
+
+  const std::vector<SQInstruction> plain = instructionsOf(sq, "plain");
+  REQUIRE(countOpcode(plain, _OP_CALLK) == 4);
+  REQUIRE(countOpcode(plain, _OP_PREPCALLK) == 0);
+
+  for(std::size_t i = 0; i < plain.size(); ++i) {
+    if(plain[i].op == _OP_CALLK) {
+      REQUIRE(plain[i + 1].op == _OP_CALL);
+    }
+  }
+
+  // A local captured by a closure may change while the method is fetched
+  const std::vector<SQInstruction> captured = instructionsOf(sq, "captured");
+  REQUIRE(countOpcode(captured, _OP_CALLK) == 1);
+  REQUIRE(countOpcode(captured, _OP_PREPCALLK) == 2);
+
+  // Arguments that make calls or assign to the object keep the fetch in front of them
+  const std::vector<SQInstruction> nested = instructionsOf(sq, "nested");
+  REQUIRE(countOpcode(nested, _OP_CALLK) == 1);
+  REQUIRE(countOpcode(nested, _OP_PREPCALLK) == 2);
+}
@@ -23,6 +23,9 @@
 #include "marmot/State.hpp"
 #include "marmot/Function.hpp"
 #include <catch/catch.hpp>
+#include <chrono>
+#include <functional>
+#include <iostream>
 
 //
 // Tests for marmot::stack
@@ -101,3 +104,92 @@ TEST_CASE( "Functions are called with the correct environment", "[marmot::Functi
   REQUIRE(printSkullyFn.call<std::string>() == "Skully");
 }
 
+
+TEST_CASE( "Functions can be bound to a fixed signature", "[marmot::Function]" ) {
+  marmot::State sq;
+  marmot::Table root = sq.getRootTable();
+
+  sq.runString("function add(a, b) { return a + b; }");
+
+  root.push();
+  marmot::stack::push(sq.getVM(), "add");
+  sq_get(sq.getVM(), -2);
+
+  marmot::Function addFn{sq.getVM(), -2, -1};
+
+  sq_pop(sq.getVM(), 2); // Pops the closure and the root table
+
+  const int top = sq_gettop(sq.getVM());
+
+  REQUIRE_THROWS(addFn.bind<int()>()); // ::add() Expects two arguments
+  REQUIRE_THROWS(addFn.bind<int(int)>()); // ::add() Expects two arguments
+  REQUIRE_THROWS(addFn.bind<int(int, int, int)>()); // ::add() Expects two arguments
+
+  auto add = addFn.bind<int(int, int)>();
+  REQUIRE(add(2, 3) == 5);
+  REQUIRE(add.call(40, 2) == 42);
+
+  auto concat = addFn.bind<std::string(std::string, std::string)>();
+  const std::string first = "it ";
+  REQUIRE(concat(first, "worked") == "it worked");
+
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+}
+
+TEST_CASE( "Bound functions propogate Squirrel exceptions as C++ exceptions", "[marmot::Function]" ) {
+  marmot::State sq;
+  marmot::Table root = sq.getRootTable();
+
+  sq.runString("function fail(reason) { throw reason; }");
+
+  root.push();
+  marmot::stack::push(sq.getVM(), "fail");
+  sq_get(sq.getVM(), -2);
+
+  marmot::Function failFn{sq.getVM(), -2, -1};
+
+  sq_pop(sq.getVM(), 2); // Pops the closure and the root table
+
+  const int top = sq_gettop(sq.getVM());
+  auto fail = failFn.bind<void(const char*)>();
+
+  REQUIRE_THROWS(fail("The system is down."));
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+}
+
+TEST_CASE( "Bound functions are faster than unbound calls", "[marmot::Function][.][benchmark]" ) {
+  marmot::State sq;
+  marmot::Table root = sq.getRootTable();
+
+  sq.runString("function add(a, b) { return a + b; }");
+
+  root.push();
+  marmot::stack::push(sq.getVM(), "add");
+  sq_get(sq.getVM(), -2);
+
+  marmot::Function addFn{sq.getVM(), -2, -1};
+
+  sq_pop(sq.getVM(), 2); // Pops the closure and the root table
+
+  const int iterations = 1000000;
+  auto add = addFn.bind<int(int, int)>();
+
+  auto measure = [&](const char * name, std::function<int(int)> fn) {
+    long long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < iterations; ++i) {
+      checksum += fn(i);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << static_cast<long>(iterations / elapsed.count()) << " calls/s" << std::endl;
+
+    return checksum;
+  };
+
+  const long long unbound = measure("Function::call", [&](int i) { return addFn.call<int>(i, 1); });
+  const long long bound = measure("BoundFunction", [&](int i) { return add(i, 1); });
+
+  REQUIRE(unbound == bound);
+}
@@ -0,0 +1,690 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2014 Zachary Mulgrew, ZackTheHuman
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "marmot/State.hpp"
+#include <catch/catch.hpp>
+#include <sqstdblob.h>
+#include <sqstdio.h>
+#include <sqstdstring.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+  //
+  // Runs a script that leaves an integer named `result` in the root table,
+  // printing how many iterations of its main loop ran per second.
+  //
+  int benchmark(const char * name, const char * script, int iterations) {
+    marmot::State sq;
+    sq["iterations"] = iterations;
+
+    auto start = std::chrono::steady_clock::now();
+    sq.runString(script);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+#ifdef SQ_COMPUTED_GOTO
+    const char * dispatch = "computed goto";
+#else
+    const char * dispatch = "switch";
+#endif
+
+    std::cout << name << " (" << dispatch << "): "
+              << static_cast<long>(iterations / elapsed.count()) << " iterations/s" << std::endl;
+
+    return sq["result"].get<int>();
+  }
+
+  int releasedViews = 0;
+
+  SQInteger releaseView(SQUserPointer, SQInteger) {
+    ++releasedViews;
+    return 1;
+  }
+
+}
+
+TEST_CASE( "Interpreter runs control flow, calls and exceptions", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "local total = 0;"
+    "function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }"
+    "function tail(n, acc) { if(n == 0) return acc; return tail(n - 1, acc + n); }"
+    "local gen = (function() { for(local i = 0; i < 5; i++) yield i; })();"
+    "foreach(v in gen) total += v;"
+    "foreach(k, v in { a = 1, b = 2 }) total += v;"
+    "try { throw 3; } catch(e) { total += e; }"
+    "local i = 0; while(true) { if(++i > 10) break; if(i % 2) continue; total += i; }"
+    "result <- total + fib(10) + tail(100, 0) + (\"x\" in { x = 1 } ? 1 : 0);");
+
+  REQUIRE(sq["result"].get<int>() == 10 + 3 + 3 + 30 + 55 + 5050 + 1);
+}
+
+TEST_CASE( "Interpreter arithmetic follows operand type changes", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "function mad(a, b) { return a * b + a - b; }"
+    "function add(a, b) { return a + b; }"
+    "local total = 0;"
+    "for(local round = 0; round < 8; round++) {"
+    "  for(local i = 0; i < 4; i++) total += mad(i, 2);"
+    "  assert(mad(1.5, 2.0) == 2.5);"
+    "  assert(mad(2, 0.5) == 2.5);"
+    "  assert(add(\"a\", \"b\") == \"ab\");"
+    "  assert(add(0.25, 0.5) == 0.75);"
+    "  assert(add(round, 1) == round + 1);"
+    "}"
+    "result <- total;");
+
+  REQUIRE(sq["result"].get<int>() == 8 * (-2 + 1 + 4 + 7));
+}
+
+TEST_CASE( "Interpreter writes unquickened bytecode", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  HSQUIRRELVM vm = sq.getVM();
+
+  const auto bytecode = sq.compileToBytecode(
+    "function f(a, b) { return a * b - a + b; }"
+    "for(local i = 0; i < 16; i++) { f(i, 1); f(i * 0.5, 1.5); }");
+
+  marmot::Reference closure = sq.loadBytecode(bytecode);
+  closure.push();
+  sq_pushroottable(vm);
+  REQUIRE(SQ_SUCCEEDED(sq_call(vm, 1, SQFalse, SQTrue)));
+
+  std::vector<std::uint8_t> rewritten;
+  REQUIRE(SQ_SUCCEEDED(sq_writeclosure(vm, marmot::detail::writeBytecode, &rewritten)));
+  sq_poptop(vm);
+
+  REQUIRE(rewritten == bytecode);
+}
+
+TEST_CASE( "Interpreter slot reads follow table and class changes", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "class A { x = 1; function get() { return x; } }"
+    "class B { y = 0; x = 2; function get() { return x * 10; } }"
+    "local objs = [A(), B(), A()];"
+    "local sum = 0;"
+    "for(local i = 0; i < 30; i++) { local o = objs[i % 3]; sum += o.x + o.get(); }"
+    "assert(sum == 10 * (1 + 1) + 10 * (2 + 20) + 10 * (1 + 1));"
+    "A.get <- function() { return -x; };"
+    "assert(A().get() == -1);"
+    "local proto = { v = \"delegate\" };"
+    "local t = { v = \"own\" }.setdelegate(proto);"
+    "local seen = [];"
+    "for(local i = 0; i < 6; i++) {"
+    "  seen.append(t.v);"
+    "  if(i == 1) delete t.v;"
+    "  if(i == 3) { for(local k = 0; k < 64; k++) t[\"k\" + k] <- k; t.v <- \"grown\"; }"
+    "}"
+    "assert(seen[0] == \"own\" && seen[1] == \"own\" && seen[2] == \"delegate\");"
+    "assert(seen[3] == \"delegate\" && seen[4] == \"grown\" && seen[5] == \"grown\");"
+    "local keys = [\"a\", \"b\"]; local u = { a = 1, b = 2 };"
+    "local ksum = 0; for(local i = 0; i < 10; i++) ksum += u[keys[i % 2]];"
+    "result <- ksum;");
+
+  REQUIRE(sq["result"].get<int>() == 15);
+}
+
+TEST_CASE( "Interpreter loops", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("Integer loop",
+    "local sum = 0;"
+    "for(local i = 0; i < iterations; i++) { sum += i & 7; if(i % 3 == 0) sum -= 1; }"
+    "result <- sum;", 10000000);
+
+  REQUIRE(result > 0);
+}
+
+TEST_CASE( "Interpreter arithmetic", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("Numeric arithmetic",
+    "local x = 0.0, v = 1.0, dt = 0.001, n = 0;"
+    "for(local i = 0; i < iterations; i++) { local a = -x * 4.0; v = v + a * dt; x = x + v * dt; n = n + i * 3 - i * 2; }"
+    "result <- n > 0 && x < 2.0 ? 1 : 0;", 5000000);
+
+  REQUIRE(result == 1);
+}
+
+TEST_CASE( "Interpreter calls", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("Script calls",
+    "function add(a, b) { return a + b; }"
+    "local sum = 0;"
+    "for(local i = 0; i < iterations; i++) sum = add(sum, 1);"
+    "result <- sum;", 5000000);
+
+  REQUIRE(result == 5000000);
+}
+
+TEST_CASE( "Interpreter method calls", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("Instance method calls",
+    "class Counter { n = 0; step = 1; function tick() { n += step; return n; } }"
+    "local c = Counter();"
+    "for(local i = 0; i < iterations; i++) c.tick();"
+    "result <- c.n;", 5000000);
+
+  REQUIRE(result == 5000000);
+}
+
+TEST_CASE( "Interpreter table access", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("Table access",
+    "local t = { x = 0, y = 1, z = 2 };"
+    "local keys = [\"x\", \"y\", \"z\"];"
+    "for(local i = 0; i < iterations; i++) { t.x = t.y + t.z; t[keys[i % 3]] = i & 3; }"
+    "result <- t.x + t.y + t.z;", 5000000);
+
+  REQUIRE(result >= 0);
+}
+
+TEST_CASE( "Interpreter string building", "[marmot::Interpreter][.][benchmark]" ) {
+  const int result = benchmark("String building",
+    "local s = \"\";"
+    "for(local i = 0; i < iterations; i++) { s += \"<li>\"; s += i; s += \"</li>\"; }"
+    "result <- s.len();", 200000);
+
+  REQUIRE(result > 0);
+}
+
+TEST_CASE( "Interpreter superinstructions keep the semantics of the sequences they fuse", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "local hits = 0;"
+    "for(local i = 0; i < 5; i++) hits++;"
+    "for(local f = 0.5; f < 3; f += 1.0) hits++;"
+    "for(local i = 0; i < 5; i++) if(i <=> 3) hits++;"
+    "local s = \"b\"; if(s < \"c\") hits++;"
+    "local c = false; if(hits > (c ? 1 : 20)) hits++;"
+    "assert(hits == 5 + 3 + 4 + 1 + 0);"
+    "local failed = false; try { if(s < 3) hits++; } catch(e) { failed = true; }"
+    "assert(failed);"
+    "class R { n = 0; function down() { if(n == 0) return \"done\"; n--; return this.down(); } }"
+    "local r = R(); r.n = 100000;"
+    "assert(r.down() == \"done\");"
+    "class V { v = 0; constructor(x) { v = x; } function _add(o) { return V(v + o.v); } }"
+    "local t = { x = 1, s = \"t\", p = V(2) };"
+    "local k = \"x\";"
+    "assert(\"a\" + t.s == \"at\" && t.s + \"a\" == \"ta\");"
+    "assert(t.x + 0.5 == 1.5 && 2 + t[k] == 3);"
+    "assert((V(3) + t.p).v == 5 && (t.p + V(3)).v == 5);"
+    "class P { start = 10; function add(a, b) { return start + a + b; } }"
+    "local p = P(), one = 1, parts = [];"
+    "assert(p.add(one, 2) == 13 && p.add(one, 2.5) == 13.5);"
+    "parts.append(one); parts.push(\"x\");"
+    "local q = p;"
+    "assert(parts.len() == 2 && q.add(q = 5, 1) == 16 && q == 5);"
+    "local seen = 0, hook = { bump = null };"
+    "local lazy = {}.setdelegate({ _get = function(key) { if(hook.bump) hook.bump(); return function(v) { return v; }; } });"
+    "hook.bump = function() { seen++; };"
+    "assert(lazy.f(seen) == 1 && seen == 1);"
+    "local late = 0, got = [];"
+    "for(local i = 0; i < 2; i++) { got.append(lazy.g(late)); hook.bump = function() { late++; }; }"
+    "assert(got[0] == 0 && got[1] == 1 && late == 1);"
+    "local arr = [1, 2, 3];"
+    "result <- arr.len() + t.x + t[k] + (hits < 13 ? 100 : 0);");
+
+  REQUIRE(sq["result"].get<int>() == 5);
+}
+
+TEST_CASE( "Compiler folds constant expressions", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "const SCALE = 4;"
+    "enum Bits { LOW = 1, HIGH = 8 }"
+    "assert(SCALE * 1024 + 3 == 4099 && 7 / 2 == 3 && 7 % 4 == 3 && -(2 * 3) == -6);"
+    "assert(1.5 * 2 == 3.0 && 1 / 2.0 == 0.5 && typeof(2 * 1.0) == \"float\");"
+    "assert(\"ab\" + \"cd\" == \"abcd\" && \"v\" + SCALE == \"v4\" && 1 + \"x\" == \"1x\");"
+    "assert((Bits.LOW | Bits.HIGH) == 9 && (1 << 4) == 16 && ~0 == -1 && (-16 >> 2) == -4);"
+    "assert((1 < 2) == true && (2 <=> 1) == 1 && (\"a\" < \"b\") && 1 == 1.0 && \"a\" != \"b\" && !0);"
+    "local c = false;"
+    "assert(-(c ? 1 : 2) == -2 && 1 + (c ? 2 : 3) == 4 && (c ? 1 : 2) * 3 == 6);"
+    "local raised = false;"
+    "try { local z = 1 / 0; } catch(e) { raised = true; }"
+    "assert(raised);"
+    "result <- SCALE * SCALE;");
+
+  REQUIRE(sq["result"].get<int>() == 16);
+  REQUIRE(sq.compileToBytecode("return (1 + 2) * 4 - 5;").size() == sq.compileToBytecode("return 7;").size());
+}
+
+TEST_CASE( "Compiler drops branches on constant conditions", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "const DEBUG = 0;"
+    "local n = 0, a = 1;"
+    "if(DEBUG) { n += 100; } else { n += 1; }\n"
+    "if(!DEBUG) n += 2; else n += 100;\n"
+    "if(a) n += 4; if(DEBUG) n += 100;"
+    "while(false) { n += 100; break; }"
+    "while(true) { n += 8; break; }"
+    "for(local i = 0; i < 3; i++) { if(DEBUG) continue; if(!DEBUG) { local f = function() { return i; }; n += 16 * f(); } }"
+    "n += DEBUG ? 100 : 64;"
+    "n += 1 < 2 ? 128 : 100;"
+    "result <- n;");
+
+  REQUIRE(sq["result"].get<int>() == 1 + 2 + 4 + 8 + 16 * 3 + 64 + 128);
+  REQUIRE(sq.compileToBytecode("const OFF = 0; if(OFF) { local q = 1 + 2; }\n return 7;").size()
+    == sq.compileToBytecode("const OFF = 0; return 7;").size());
+}
+
+TEST_CASE( "Compiler reads scripts from memory buffers and files", "[marmot::Interpreter]" ) {
+  const char * path = "marmot-test-buffered.nut";
+  const std::string script =
+    "local s = \"caf\xc3\xa9\";\n"
+    "\n"
+    "line <- getstackinfos(1).line;\n"
+    "result <- s.len();";
+
+  marmot::State sq;
+  sq.runString(script);
+  REQUIRE(sq["line"].get<int>() == 3);
+  REQUIRE(sq["result"].get<int>() == 5);
+
+  // A null character ends the script, as it did when buffers were read a character at a time
+  sq.runString(std::string("result <- 1;\0result <- 2;", 25));
+  REQUIRE(sq["result"].get<int>() == 1);
+
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "\xef\xbb\xbf" << script;
+  }
+
+  sq_pushroottable(sq.getVM());
+  REQUIRE(SQ_SUCCEEDED(sqstd_dofile(sq.getVM(), path, SQFalse, SQTrue)));
+  REQUIRE(sq["line"].get<int>() == 3);
+  REQUIRE(sq["result"].get<int>() == 5);
+
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "\xef\xbb\xbfresult <- \"caf\xc3\xa9\".len();";
+  }
+
+  sq.runString("result <- 0;");
+  REQUIRE(SQ_SUCCEEDED(sqstd_dofile(sq.getVM(), path, SQFalse, SQTrue)));
+  REQUIRE(sq["result"].get<int>() == 5);
+
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "result <- 6;\n\nresult <- ;";
+  }
+
+  const int top = sq_gettop(sq.getVM());
+  REQUIRE(SQ_FAILED(sqstd_loadfile(sq.getVM(), path, SQFalse)));
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+  REQUIRE(sq["result"].get<int>() == 5);
+
+  {
+    std::ofstream out(path, std::ios::binary);
+  }
+
+  REQUIRE(SQ_SUCCEEDED(sqstd_dofile(sq.getVM(), path, SQFalse, SQTrue)));
+  sq_poptop(sq.getVM()); // Pop the root table
+  std::remove(path);
+}
+
+TEST_CASE( "Lexer tells keywords from identifiers", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "local iff = 1, dO = 2, fore = 3, classes = 4, constructors = 5, instanceOf = 6, returned = 7, _this = 8;"
+    "local t = { foreachs = 9, defaults = 10 };"
+    "class C { value = 0; constructor(v) { value = v; } function get() { return this.value; } static kind = \"c\"; }"
+    "local n = 0;"
+    "foreach(k, v in t) { n += v; }"
+    "do { n += 1; } while(false)\n"
+    "if(typeof n == \"integer\" && !(null) && true != false && (C(3) instanceof C)) n += C(3).get();"
+    "result <- iff + dO + fore + classes + constructors + instanceOf + returned + _this + n;");
+
+  REQUIRE(sq["result"].get<int>() == 36 + 19 + 1 + 3);
+
+  std::string error;
+  try {
+    sq.runString("foreach(k, v of t) {}");
+  } catch(const marmot::MarmotError & e) {
+    error = e.what();
+  }
+  REQUIRE(error.find("expected 'in'") != std::string::npos);
+}
+
+TEST_CASE( "Interpreter appends to strings without changing their semantics", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "local s = \"\";"
+    "for(local i = 0; i < 20000; i++) { s += \"<\"; s = s + i; s += 0.5; s += true; }"
+    "assert(s.slice(0, 18) == \"<00.5true<10.5true\" && s.slice(-13) == \"<199990.5true\");"
+    "local a = \"ab\"; a += \"c\"; local b = a; a += \"d\";"
+    "assert(b == \"abc\" && a == \"abcd\");"
+    "local t = {}; local k = \"ke\"; k += \"y\"; t[k] <- 1; k += \"z\";"
+    "assert(t.key == 1 && !(\"keyz\" in t) && k == \"keyz\");"
+    "local h = \"hel\"; h += \"lo\";"
+    "assert(h == \"hello\" && { hello = 2 }[h] == 2);"
+    "local long = \"\"; for(local i = 0; i < 63; i++) long += \"x\";"
+    "long += \"y\";"
+    "assert(long == \"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxy\" && { xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxy = 3 }[long] == 3);"
+    "long += \"z\"; assert(long.len() == 65);"
+    "local w = \"we\"; w += \"ak\"; local r = w.weakref(); w += \"er\";"
+    "assert(r.ref() == \"weak\" && w == \"weaker\");"
+    "local o = \"out\"; o += \"er\"; local f = function() { return o; }; o += \"s\";"
+    "assert(f() == \"outers\");"
+    "local self = \"x\"; self += \"y\"; self += self;"
+    "assert(self == \"xyxy\");"
+    "result <- s.len();");
+
+  REQUIRE(sq["result"].get<int>() == 20000 * 8 + 88890); // 88890 digits in 0..19999
+}
+
+TEST_CASE( "String library builds strings with a stringbuilder", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_stringlib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  sq.runString(
+    "class Point { x = 1; y = 2; function _tostring() { return \"(\" + x + \",\" + y + \")\"; } }"
+    "local b = stringbuilder();"
+    "assert(typeof b == \"stringbuilder\" && b.len() == 0 && b.tostring() == \"\");"
+    "b.append(\"n=\").append(42).append(\" f=\").append(0.5).append(\" \").append(true).append(\" \").append(Point());"
+    "assert(b.tostring() == \"n=42 f=0.5 true (1,2)\");"
+    "b.clear().appendf(\"%s:%04d:%.2f\", \"id\", 7, 1.5);"
+    "assert(b.tostring() == \"id:0007:1.50\" && b.len() == 12 && (\"\" + b) == \"id:0007:1.50\");"
+    "local big = stringbuilder(16);"
+    "for(local i = 0; i < 10000; i++) big.append(\"<li>\").append(i).append(\"</li>\");"
+    "local s = big.tostring();"
+    "assert(s.len() == big.len() && s.slice(0, 11) == \"<li>0</li><\" && s.slice(-13) == \"<li>9999</li>\");"
+    "result <- s.len();");
+
+  REQUIRE(sq["result"].get<int>() == 10000 * 9 + 38890);
+  REQUIRE_THROWS_AS(sq.runString("stringbuilder(-1);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("stringbuilder().appendf(\"%d\", \"x\");"), const marmot::MarmotError &);
+
+  // Methods called on something that is not a built stringbuilder throw.
+  sq_pushroottable(sq.getVM());
+  sqstd_register_bloblib(sq.getVM());
+  sq_poptop(sq.getVM());
+  REQUIRE_THROWS_AS(sq.runString(
+    "class X extends stringbuilder { constructor() {} }"
+    "X().append(\"a\");"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("stringbuilder.append.call(blob(8), \"...\");"), const marmot::MarmotError &);
+}
+
+TEST_CASE( "String library counts stringbuilders against the memory limit", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_stringlib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  const std::size_t limit = sq.memoryStats().used + 8 * 1024 * 1024;
+  sq.setMemoryLimit(limit);
+
+  REQUIRE_THROWS_AS(sq.runString("stringbuilder(50000000);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString(
+    "local b = stringbuilder(); local s = \"0123456789abcdef\";"
+    "for(local i = 0; i < 16; i++) s += s;"
+    "while(true) b.append(s);"), const marmot::MarmotError &);
+  REQUIRE(sq.memoryStats().peak < limit);
+
+  sq.runString("result <- stringbuilder(16).append(\"abc\").len();");
+  REQUIRE(sq["result"].get<int>() == 3);
+}
+
+TEST_CASE( "String library matches regular expressions in linear time", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_stringlib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  sq.runString(
+    "assert(regexp(\"a\").mode() == \"nfa\" && regexp(\"a\", \"backtrack\").mode() == \"backtrack\");"
+    "assert(regexp(\"a{1,3000}\").mode() == \"backtrack\");"
+    "foreach(mode in [\"nfa\", \"backtrack\"]) {"
+    "  local r = regexp(@\"(\\w+)@(\\w+)\\.com\", mode);"
+    "  local c = r.capture(\"mail: bob@example.com!\");"
+    "  assert(c.len() == 3 && c[0].begin == 6 && c[0].end == 21 && c[1].end == 9 && c[2].begin == 10);"
+    "  assert(regexp(@\"\\d+\", mode).search(\"ab 1234 c\").begin == 3);"
+    "  assert(regexp(@\"\\d+\", mode).search(\"ab 1234 c\").end == 7);"
+    "  assert(regexp(\"^abc$\", mode).match(\"abc\") && !regexp(\"^abc$\", mode).match(\"abcd\"));"
+    "  assert(regexp(\"cat|dog\", mode).search(\"hotdog\").begin == 3);"
+    "  assert(regexp(@\"s\\b\", mode).search(\"this is\").begin == 3);"
+    "  assert(regexp(\"[^0-9]+\", mode).search(\"123abc\").begin == 3);"
+    "  assert(regexp(\"x{2,3}\", mode).search(\"axxxxb\").end == 4);"
+    "  assert(regexp(\"b\", mode).search(\"abc\", 2) == null);"
+    "}"
+    "local m = regexp(\"a.*b\").search(\"a1b2b\");"
+    "assert(m.begin == 0 && m.end == 5);"
+    "assert(regexp(\"a.*b\").match(\"a1b2b\") && !regexp(\"a.*b\", \"backtrack\").match(\"a1b2b\"));"
+    "local s = \"\";"
+    "for(local i = 0; i < 5000; i++) s += \"a\";"
+    "assert(regexp(\"(a|aa)*b\").search(s) == null);"
+    "assert(regexp(\"(a*)*c\").match(s) == false);"
+    "result <- regexp(\"(a|aa)*$\").search(s).end;");
+
+  REQUIRE(sq["result"].get<int>() == 5000);
+  REQUIRE_THROWS_AS(sq.runString("regexp(\"a{1,3000}\", \"nfa\");"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("regexp(\"a\", \"lazy\");"), const marmot::MarmotError &);
+}
+
+TEST_CASE( "String library reuses compiled regular expressions and skips to literals", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_stringlib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  sq.runString(
+    "assert(regexp(\"ab+c\", \"backtrack\").mode() == \"backtrack\" && regexp(\"ab+c\").mode() == \"nfa\");"
+    "local kept = [];"
+    "for(local i = 0; i < 100; i++) kept.append(regexp(\"k\" + (i % 40) + \"=(\\\\d+)\"));"
+    "assert(kept[3].capture(\"x k3=17\")[1].begin == 5 && kept[44].search(\"k3=1\") == null && kept[43].search(\"k3=1\").end == 4);"
+    "kept = null;"
+    "foreach(mode in [\"nfa\", \"backtrack\"]) {"
+    "  local line = \"\";"
+    "  for(local i = 0; i < 500; i++) line += \"lorem ipsum \";"
+    "  local r = regexp(@\"ERROR (\\d+)\", mode);"
+    "  assert(r.search(line) == null);"
+    "  local c = r.capture(line + \"ERRO ERROR 42 ERROR 7\");"
+    "  assert(c[0].begin == 6005 && c[0].end == 6013 && c[1].begin == 6011);"
+    "  assert(r.search(\"ERROR 1 ERROR 2\", 1).begin == 8);"
+    "  assert(regexp(@\"\\w+@example\\.com\", mode).search(\"mail bob@example.com\").begin == 5);"
+    "  assert(regexp(\"x(ab){2}y\", mode).search(\"xaby xababy\").begin == 5);"
+    "  assert(regexp(\"^abc\", mode).search(\"xabc\") == null && regexp(\"^abc\", mode).search(\"xabc\", 1).end == 4);"
+    "  assert(regexp(\"ab|cd\", mode).search(\"xxcd\").begin == 2);"
+    "  assert(regexp(\"a*bc\", mode).search(\"aaxaabc\").begin == 3);"
+    "  assert(regexp(\"abc\", mode).match(\"abc\") && !regexp(\"abd.*\", mode).match(\"abc\"));"
+    "}"
+    "result <- regexp(\"o{2}k\").search(\"ok ook\").begin;");
+
+  REQUIRE(sq["result"].get<int>() == 3);
+}
+
+TEST_CASE( "Streams read and write whole arrays of numbers", "[marmot::Interpreter]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_bloblib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  sq.runString(
+    "local b = blob(0);"
+    "assert(b.writearray('i', [1, -2, 300000, 4.75]) == 16 && b.len() == 16);"
+    "assert(b.writearray('w', [1, 0xABCD], true) == 4 && b.writearray('d', [0.5, -2]) == 16);"
+    "b.seek(0);"
+    "local ints = b.readarray('i', 4);"
+    "assert(ints.len() == 4 && ints[0] == 1 && ints[1] == -2 && ints[2] == 300000 && ints[3] == 4);"
+    "local words = b.readarray('w', 2);"
+    "assert(words[0] == 0x0100 && words[1] == 0xCDAB);"
+    "local doubles = b.readarray('d', 2);"
+    "assert(doubles[0] == 0.5 && doubles[1] == -2.0 && b.eos());"
+    "b.seek(0);"
+    "local swapped = b.readarray('i', 1, true);"
+    "assert(swapped[0] == 0x01000000 && b.tell() == 4);"
+    "b.seek(0);"
+    "b.writearray('d', [1.25], true);"
+    "b.seek(0);"
+    "assert(b.readarray('d', 1, true)[0] == 1.25 && b.readarray('b', 0).len() == 0);"
+    "local dest = blob(2);"
+    "dest[0] = 7;"
+    "b.seek(8);"
+    "assert(b.readinto(dest, 1, 4) == 4 && dest.len() == 5 && dest[0] == 7 && dest[1] == 0xE0);"
+    "b.seek(-2, 'e');"
+    "assert(b.readinto(dest, 5, 8) == 2 && dest.len() == 7);"
+    "local src = blob(16);"
+    "assert(src.readinto(dest, 0, 1000) == 16 && dest.len() == 16);"
+    "src.seek(0);"
+    "assert(src.readinto(dest, 10, 1 << 60) == 16 && dest.len() == 26);"
+    "result <- ints[2];");
+
+  REQUIRE(sq["result"].get<int>() == 300000);
+  REQUIRE_THROWS_AS(sq.runString("blob(4).readarray('i', 2);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("blob(16).readarray('i', 1 << 40);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("blob(16).readarray('l', 1 << 62);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("blob(4).readarray('q', 1);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("blob(0).writearray('i', [1, \"x\"]);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("local b = blob(4); b.readinto(b, 0, 1);"), const marmot::MarmotError &);
+}
+
+TEST_CASE( "I/O library maps files into memory", "[marmot::Interpreter]" ) {
+  const char * path = "marmot-test-mapped.bin";
+
+  {
+    const std::int32_t values[] = { 1, 2, 3, 4 };
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(values), sizeof(values));
+    out << "tail";
+  }
+
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_iolib(sq.getVM());
+  sqstd_register_bloblib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  sq.runString(std::string("path <- \"") + path + "\";");
+  sq.runString(
+    "local f = mmapfile(path);"
+    "assert(typeof f == \"mmapfile\" && f.len() == 20);"
+    "f.advise(\"sequential\");"
+    "f.advise(\"willneed\", 5, 10);"
+    "local ints = f.readarray('i', 2);"
+    "assert(ints[0] == 1 && ints[1] == 2);"
+    "local view = f.readblob(8);"
+    "assert(typeof view == \"blob\" && view.len() == 8 && f.tell() == 16);"
+    "assert(view.readn('i') == 3);"
+    "view[0] = 9;"
+    "f.close();"
+    "assert(view[0] == 9 && view.readn('i') == 4 && view.eos());"
+    "view.writen(7, 'i');"
+    "assert(view.len() == 8);"
+    "local w = mmapfile(path, \"r+\");"
+    "w.seek(-4, 'e');"
+    "assert(w.readblob(100).len() == 4 && w.eos());"
+    "w.seek(16);"
+    "w.writen(0x44434241, 'i');"
+    "w.flush();"
+    "w.advise(\"dontneed\", 0, 4);"
+    "local created = mmapfile(path + \".new\", \"w+\", 8);"
+    "assert(created.len() == 8 && created.readn('l') == 0);"
+    "result <- w.len();");
+
+  REQUIRE(sq["result"].get<int>() == 20);
+  REQUIRE_THROWS_AS(sq.runString("mmapfile(path + \".missing\");"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("mmapfile(path, \"a\");"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("local f = mmapfile(path); f.close(); f.readn('i');"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("mmapfile(path).readblob(4).resize(8);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("mmapfile(path).advise(\"often\");"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("mmapfile(path).advise(\"dontneed\");"), const marmot::MarmotError &);
+
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(contents.size() == 20);
+    REQUIRE(contents[8] == 3);
+    REQUIRE(contents.substr(16) == "ABCD");
+  }
+
+  std::remove(path);
+  std::remove((std::string(path) + ".new").c_str());
+}
+
+TEST_CASE( "Blob library slices blobs and wraps host memory without copying", "[marmot::Interpreter]" ) {
+  unsigned char payload[] = { 10, 20, 30, 40, 50, 60 };
+  releasedViews = 0;
+
+  {
+    marmot::State sq;
+    sq_pushroottable(sq.getVM());
+    sqstd_register_bloblib(sq.getVM());
+    sq_pushstring(sq.getVM(), "payload", -1);
+    REQUIRE(SQ_SUCCEEDED(sqstd_createblobview(sq.getVM(), payload, sizeof(payload), releaseView)));
+    sq_newslot(sq.getVM(), -3, SQFalse);
+    sq_poptop(sq.getVM());
+
+    sq.runString(
+      "local b = blob(8);"
+      "for(local i = 0; i < 8; i++) b[i] = i;"
+      "local s = b.slice(2, 6);"
+      "assert(s.len() == 4 && s[0] == 2 && s[3] == 5);"
+      "s[1] = 99;"
+      "assert(b[3] == 99);"
+      "b[4] = 77;"
+      "assert(s[2] == 77 && b.slice(-2)[0] == 6 && b.slice(1, -1).len() == 6 && b.slice(8).len() == 0);"
+      "local inner = s.slice(1, 3);"
+      "assert(inner.len() == 2 && inner[0] == 99 && inner[1] == 77);"
+      "local copy = clone(s);"
+      "copy[0] = 1;"
+      "assert(s[0] == 2);"
+      "b.resize(16);"
+      "b[2] = 55;"
+      "assert(s[0] == 2 && b.len() == 8);"
+      "b = null;"
+      "assert(inner.readn('b') == 99 && inner.readn('b') == 77);"
+      "assert(payload.len() == 6 && payload[2] == 30);"
+      "payload[0] = 11;"
+      "tail <- payload.slice(4);"
+      "delete getroottable().payload;"
+      "result <- tail[0] + tail[1];");
+
+    REQUIRE(sq["result"].get<int>() == 110);
+    REQUIRE(payload[0] == 11);
+    REQUIRE(releasedViews == 0);
+    REQUIRE_THROWS_AS(sq.runString("blob(4).slice(3, 2);"), const marmot::MarmotError &);
+    REQUIRE_THROWS_AS(sq.runString("blob(4).slice(0, 5);"), const marmot::MarmotError &);
+    REQUIRE_THROWS_AS(sq.runString("blob(4).slice(1).resize(8);"), const marmot::MarmotError &);
+
+    sq.runString("tail = null;");
+    REQUIRE(releasedViews == 1);
+  }
+
+  REQUIRE(releasedViews == 1);
+
+  {
+    marmot::State sq;
+    const SQInteger top = sq_gettop(sq.getVM());
+    REQUIRE(SQ_FAILED(sqstd_createblobview(sq.getVM(), payload, sizeof(payload), releaseView)));
+    REQUIRE(sq_gettop(sq.getVM()) == top);
+  }
+
+  REQUIRE(releasedViews == 1);
+}
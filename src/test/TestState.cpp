@@ -22,6 +22,10 @@
 #include "marmot/State.hpp"
 #include "marmot/Table.hpp"
 #include <catch/catch.hpp>
+#include <sqstdblob.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 
 //
 // Tests for marmot::State
@@ -167,3 +171,563 @@ TEST_CASE( "State propogates Squirrel exceptions as C++ exceptions", "[marmot::S
 
   REQUIRE_THROWS(sq.runString("throw \"This is really bad.\""));
 }
+
+TEST_CASE( "State caches compiled scripts", "[marmot::State]" ) {
+  marmot::State sq;
+
+  sq.runString("counter <- (\"counter\" in getroottable()) ? counter + 1 : 1;");
+  sq.runString("counter <- (\"counter\" in getroottable()) ? counter + 1 : 1;");
+  sq.runString("counter <- (\"counter\" in getroottable()) ? counter + 1 : 1;", false, "other.nut");
+
+  REQUIRE(sq["counter"].get<int>() == 3);
+  REQUIRE(sq.scriptCacheStats().hits == 1);
+  REQUIRE(sq.scriptCacheStats().misses == 2);
+  REQUIRE(sq.scriptCacheStats().entries == 2);
+
+  sq.clearScriptCache();
+  REQUIRE(sq.scriptCacheStats().entries == 0);
+  REQUIRE(sq.scriptCacheStats().bytes == 0);
+}
+
+TEST_CASE( "State evicts least recently used scripts over the cache budget", "[marmot::State]" ) {
+  marmot::State sq;
+  const std::string first = "a <- 1;";
+  const std::string second = "b <- 2;";
+  const std::string third = "c <- 3;";
+
+  sq.setScriptCacheBudget(first.size() + second.size());
+
+  sq.runString(first);
+  sq.runString(second);
+  sq.runString(first);  // Hit, makes the second script the oldest
+  sq.runString(third);  // Evicts the second script
+  sq.runString(first);  // Still cached
+  sq.runString(second); // Recompiled
+
+  const auto & stats = sq.scriptCacheStats();
+  REQUIRE(stats.hits == 2);
+  REQUIRE(stats.misses == 4);
+  REQUIRE(stats.evictions == 2);
+  REQUIRE(stats.bytes <= first.size() + second.size());
+
+  sq.setScriptCacheBudget(0);
+  REQUIRE(sq.scriptCacheStats().entries == 0);
+
+  sq.runString(first);
+  REQUIRE(sq.scriptCacheStats().hits == 2);
+}
+
+TEST_CASE( "State does not cache scripts that fail to compile", "[marmot::State]" ) {
+  marmot::State sq;
+  const int top = sq_gettop(sq.getVM());
+
+  REQUIRE_THROWS(sq.runString("marmot++ invalid code"));
+  REQUIRE_THROWS(sq.runString("marmot++ invalid code"));
+  REQUIRE_THROWS(sq.runString("throw \"This is really bad.\"", true));
+
+  REQUIRE(sq.scriptCacheStats().entries == 1);
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+}
+
+TEST_CASE( "State can compile scripts to bytecode and run them", "[marmot::State]" ) {
+  marmot::State compiler;
+  const int compilerTop = sq_gettop(compiler.getVM());
+
+  std::vector<std::uint8_t> bytecode;
+  REQUIRE_NOTHROW(bytecode = compiler.compileToBytecode("a <- \"marmot\"; return 41 + 1;", "bytecode.nut"));
+  REQUIRE(!bytecode.empty());
+  REQUIRE(sq_gettop(compiler.getVM()) == compilerTop);
+
+  // Compiling must not run the script
+  REQUIRE_THROWS(compiler.runString("return a;"));
+
+  marmot::State sq;
+  const int top = sq_gettop(sq.getVM());
+
+  REQUIRE_NOTHROW(sq.runBytecode(bytecode, true));
+  REQUIRE(marmot::stack::pop<int>(sq.getVM()) == 42);
+  REQUIRE(sq["a"].get<std::string>() == "marmot");
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+
+  marmot::Reference closure = sq.loadBytecode(bytecode.data(), bytecode.size());
+  REQUIRE(closure.getTypeString() == "closure (function)");
+}
+
+TEST_CASE( "State rejects invalid bytecode", "[marmot::State]" ) {
+  marmot::State sq;
+  const int top = sq_gettop(sq.getVM());
+
+  REQUIRE_THROWS(sq.compileToBytecode("marmot++ invalid code"));
+
+  std::vector<std::uint8_t> bytecode = sq.compileToBytecode("return 1;");
+  std::vector<std::uint8_t> truncated(bytecode.begin(), bytecode.begin() + bytecode.size() / 2);
+  std::vector<std::uint8_t> garbage = {'n', 'o', 't', ' ', 'b', 'y', 't', 'e', 'c', 'o', 'd', 'e'};
+
+  REQUIRE_THROWS(sq.loadBytecode(truncated));
+  REQUIRE_THROWS(sq.loadBytecode(garbage));
+  REQUIRE_THROWS(sq.runBytecode(nullptr, 0));
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+}
+
+TEST_CASE( "State can save and map bytecode images", "[marmot::State]" ) {
+  const char * path = "marmot-test-image.bin";
+
+  {
+    marmot::State compiler;
+    REQUIRE_NOTHROW(compiler.saveBytecodeImage(path, "local greeting = \"hello\"; function greet(name) { return greeting + \", \" + name; }", "image.nut"));
+  }
+
+  marmot::State sq;
+  const int top = sq_gettop(sq.getVM());
+
+  marmot::Reference closure = sq.loadBytecodeImage(path);
+  std::remove(path);
+
+  closure.push();
+  sq_pushroottable(sq.getVM());
+  REQUIRE(SQ_SUCCEEDED(sq_call(sq.getVM(), 1, SQFalse, SQTrue)));
+  sq_poptop(sq.getVM()); // Pop the closure
+
+  REQUIRE_NOTHROW(sq.runString("result <- greet(\"marmot\");"));
+  REQUIRE(sq["result"].get<std::string>() == "hello, marmot");
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+}
+
+TEST_CASE( "State rejects missing and invalid bytecode images", "[marmot::State]" ) {
+  const char * path = "marmot-test-not-an-image.bin";
+  marmot::State sq;
+
+  REQUIRE_THROWS(sq.loadBytecodeImage("marmot-test-missing-image.bin"));
+
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "this is not a bytecode image";
+  }
+
+  REQUIRE_THROWS(sq.loadBytecodeImage(path));
+  std::remove(path);
+}
+
+namespace {
+  struct CountingAllocator {
+    long long live = 0;
+    long long allocations = 0;
+    long long frees = 0;
+
+    static void * malloc(SQUserPointer up, SQUnsignedInteger size) {
+      CountingAllocator * self = static_cast<CountingAllocator*>(up);
+      self->live += size;
+      self->allocations += 1;
+      return std::malloc(size);
+    }
+
+    static void * realloc(SQUserPointer up, void * p, SQUnsignedInteger oldsize, SQUnsignedInteger size) {
+      CountingAllocator * self = static_cast<CountingAllocator*>(up);
+      self->live += static_cast<long long>(size) - static_cast<long long>(oldsize);
+      self->allocations += p ? 0 : 1;
+      return std::realloc(p, size);
+    }
+
+    static void free(SQUserPointer up, void * p, SQUnsignedInteger size) {
+      CountingAllocator * self = static_cast<CountingAllocator*>(up);
+      self->live -= size;
+      self->frees += 1;
+      std::free(p);
+    }
+  };
+}
+
+TEST_CASE( "State allocates through a custom allocator with sized frees", "[marmot::State]" ) {
+  CountingAllocator counter;
+  SQAllocator allocator = { CountingAllocator::malloc, CountingAllocator::realloc, CountingAllocator::free, &counter };
+
+  {
+    marmot::State sq(allocator);
+
+    REQUIRE(counter.allocations > 0);
+
+    sq.runString(
+      "class Point { x = 0; y = 0; constructor(x, y) { this.x = x; this.y = y; } }"
+      "local points = [];"
+      "for(local i = 0; i < 100; i++) { points.append(Point(i, i * 2)); }"
+      "names <- {};"
+      "foreach(i, p in points) { names[\"point\" + i] <- p.weakref(); }"
+      "function gen() { for(local i = 0; i < 3; i++) yield i; }"
+      "foreach(v in gen()) {}"
+    );
+
+    SQAllocator current;
+    sq_getallocator(sq.getVM(), &current);
+    REQUIRE(current.up == &counter);
+  }
+
+  REQUIRE(counter.live == 0);
+  REQUIRE(counter.frees == counter.allocations);
+}
+
+TEST_CASE( "State tracks its memory usage", "[marmot::State]" ) {
+  marmot::State sq;
+
+  SQMemoryStats before = sq.memoryStats();
+
+  REQUIRE(before.used > 0u);
+  REQUIRE(before.allocations > 0u);
+  REQUIRE(before.limit == 0u);
+
+  sq.runString("big <- []; for(local i = 0; i < 10000; i++) { big.append(\"item\" + i); }");
+
+  SQMemoryStats during = sq.memoryStats();
+
+  REQUIRE(during.used > before.used);
+  REQUIRE(during.peak >= during.used);
+  REQUIRE(during.allocations > before.allocations);
+
+  sq.runString("big = null;");
+
+  SQMemoryStats after = sq.memoryStats();
+
+  REQUIRE(after.used < during.used);
+  REQUIRE(after.peak >= during.peak);
+}
+
+TEST_CASE( "State enforces a hard memory limit", "[marmot::State]" ) {
+  marmot::State sq;
+
+  sq.setMemoryLimit(sq.memoryStats().used + 64 * 1024);
+
+  REQUIRE_THROWS(sq.runString("local a = []; while(true) { a.append(\"item\" + a.len()); }"));
+
+  // The state stays usable once the offending script has unwound.
+  sq.runString("result <- 1 + 2;");
+
+  REQUIRE(sq.memoryStats().limit > 0u);
+
+  sq.setMemoryLimit(0);
+  sq.runString("local a = []; for(local i = 0; i < 10000; i++) { a.append(i); }");
+}
+
+TEST_CASE( "State refuses a single allocation past the memory limit", "[marmot::State]" ) {
+  marmot::State sq;
+  const std::size_t limit = sq.memoryStats().used + 8 * 1024 * 1024;
+
+  sq.setMemoryLimit(limit);
+
+  REQUIRE_THROWS_AS(sq.runString("local a = array(50000000, 0);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("local a = []; a.resize(50000000);"), const marmot::MarmotError &);
+  REQUIRE(sq.memoryStats().peak < limit);
+
+  sq.runString("result <- array(1000, 0).len();");
+  REQUIRE(sq["result"].get<int>() == 1000);
+}
+
+TEST_CASE( "State counts blobs against the memory limit", "[marmot::State]" ) {
+  marmot::State sq;
+  sq_pushroottable(sq.getVM());
+  sqstd_register_bloblib(sq.getVM());
+  sq_poptop(sq.getVM());
+
+  std::size_t before = sq.memoryStats().used;
+  sq.runString("big <- blob(1024 * 1024);");
+  REQUIRE(sq.memoryStats().used >= before + 1024 * 1024);
+  sq.runString("big = null;");
+
+  const std::size_t limit = sq.memoryStats().used + 8 * 1024 * 1024;
+  sq.setMemoryLimit(limit);
+
+  REQUIRE_THROWS_AS(sq.runString("blob(50000000);"), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.runString("blob(16).resize(50000000);"), const marmot::MarmotError &);
+  REQUIRE(sq.memoryStats().peak < limit);
+
+  sq.runString("result <- blob(16).len();");
+  REQUIRE(sq["result"].get<int>() == 16);
+}
+
+TEST_CASE( "State collects cyclic garbage in bounded steps", "[marmot::State]" ) {
+  marmot::State sq;
+
+  sq.runString(
+    "for(local i = 0; i < 1000; i++) {"
+    "  local a = { id = i }; local b = { other = a }; a.other <- b;"
+    "}"
+  );
+
+  std::size_t before = sq.memoryStats().used;
+  int steps = 1;
+
+  while(!sq.collectGarbageStep(16)) {
+    ++steps;
+  }
+
+  REQUIRE(steps > 1);
+  REQUIRE(sq.memoryStats().used < before);
+  REQUIRE(sq.collectGarbage() == 0u);
+}
+
+TEST_CASE( "State sweeps unreachable objects a few at a time", "[marmot::State]" ) {
+  marmot::State sq;
+
+  // The held table is swept well before the keeper that references it and
+  // stays around emptied in between, so its weak reference must read null.
+  sq.runString(
+    "local function cycles(n) {"
+    "  for(local i = 0; i < n; i++) { local a = {}; local b = { other = a }; a.other <- b; }"
+    "}"
+    "local function garbage() {"
+    "  local keeper = {}; keeper.self <- keeper;"
+    "  cycles(200);"
+    "  local held = { marker = true }; keeper.held <- held;"
+    "  cycles(2000);"
+    "  return held.weakref();"
+    "}"
+    "dead <- garbage();"
+    "born <- [];"
+    "swept <- 0;"
+    "function check() {"
+    "  local t = dead;"
+    "  if(t != null && !(\"marker\" in t)) swept++;"
+    "  born.append({ n = born.len() });"
+    "}"
+  );
+
+  std::size_t before = sq.memoryStats().used;
+  int sweepSteps = 0;
+
+  // Reading the weak reference while marking would keep it alive, so the
+  // checks only start once the sweep has begun to give memory back.
+  while(!sq.collectGarbageStep(16)) {
+    if(sq.memoryStats().used < before) {
+      sq.runString("check();");
+      ++sweepSteps;
+    }
+  }
+
+  sq.runString(
+    "intact <- true;"
+    "foreach(i, b in born) if(b.n != i) intact = false;"
+  );
+
+  REQUIRE(sweepSteps > 1);
+  REQUIRE(sq["swept"].get<int>() == 0);
+  REQUIRE(sq["intact"].get<bool>());
+  REQUIRE(sq.collectGarbage() == 0u);
+}
+
+TEST_CASE( "State keeps live objects intact during incremental collection", "[marmot::State]" ) {
+  const char * script =
+    "class Node { id = 0; next = null; constructor(i) { id = i; } }"
+    "local live = [];"
+    "local total = 0;"
+    "for(local round = 0; round < 50; round++) {"
+    "  for(local i = 0; i < 20; i++) {"
+    "    local a = Node(i); local b = Node(i + 1); a.next = b; b.next = a;"
+    "    local t = { self = null, nodes = [a, b] }; t.self = t;"
+    "    if(i % 3 == 0) live.append(t);"
+    "    step(i % 4 + 1);"
+    "    local g = (function() { for(local k = 0; k < 3; k++) { step(1); yield a.id + k; } })();"
+    "    foreach(x in g) total += x;"
+    "  }"
+    "  if(live.len() > 2) { local x = live[round % live.len()]; local y = live[0];"
+    "    local tmp = x.nodes; x.nodes = y.nodes; y.nodes = tmp; x.nodes.append(Node(round)); }"
+    "}"
+    "foreach(t in live) { assert(t.self == t); foreach(n in t.nodes) total += n.id + (n.next ? n.next.id : 0); }"
+    "result <- total;";
+
+  marmot::State reference;
+  reference.runString("function step(budget) {}");
+  reference.runString(script);
+
+  marmot::State incremental;
+  incremental.runString("function step(budget) { collectgarbagestep(budget); }");
+  incremental.runString(script);
+
+  REQUIRE(incremental["result"].get<int>() == reference["result"].get<int>());
+}
+
+TEST_CASE( "State paces garbage collection by allocation volume", "[marmot::State]" ) {
+  const char * script =
+    "for(local i = 0; i < 20000; i++) { local t = { pad = array(16) }; t.self <- t; }";
+
+  marmot::State unpaced;
+  unpaced.runString(script);
+  const std::size_t leaked = unpaced.memoryStats().used;
+
+  marmot::State full;
+  full.setGarbageCollectorPacing(100);
+  full.runString(script);
+
+  marmot::State incremental;
+  incremental.setGarbageCollectorPacing(100, 64);
+  incremental.runString(script);
+
+  REQUIRE(full.memoryStats().peak < leaked / 2);
+  REQUIRE(incremental.memoryStats().peak < leaked / 2);
+  REQUIRE(unpaced.collectGarbage() == 40000u);
+}
+
+#ifndef SQ_NO_SLAB_ALLOCATOR
+TEST_CASE( "State uses the slab allocator by default", "[marmot::State]" ) {
+  std::vector<SQSlabClassStats> stats;
+
+  {
+    marmot::State sq;
+
+    sq.runString(
+      "local t = [];"
+      "for(local i = 0; i < 1000; i++) { t.append({ value = i, name = \"item\" + i }); }"
+      "t = null;"
+    );
+
+    stats = sq.slabStats();
+
+    REQUIRE(stats.size() == SQ_SLAB_NUMCLASSES);
+
+    SQUnsignedInteger allocations = 0;
+    SQUnsignedInteger previousSize = 0;
+
+    for(const SQSlabClassStats & cls : stats) {
+      REQUIRE(cls.size > previousSize);
+      previousSize = cls.size;
+      allocations += cls.allocations;
+    }
+
+    REQUIRE(allocations > 2000u);
+  }
+
+  {
+    CountingAllocator counter;
+    SQAllocator allocator = { CountingAllocator::malloc, CountingAllocator::realloc, CountingAllocator::free, &counter };
+    marmot::State sq(allocator);
+
+    REQUIRE(sq.slabStats().empty());
+  }
+}
+#endif
+
+TEST_CASE( "State compiles many files in parallel", "[marmot::State]" ) {
+  std::vector<std::string> paths;
+
+  for(int i = 0; i < 24; ++i) {
+    paths.push_back("marmot-test-parallel-" + std::to_string(i) + ".nut");
+    std::ofstream out(paths.back(), std::ios::binary);
+    out << "local n = " << i << ";\nsquares.append(n * n);\nreturn \"" << paths.back() << "\";";
+  }
+
+  marmot::State sq;
+  const int top = sq_gettop(sq.getVM());
+  sq.runString("squares <- [];");
+
+  std::vector<marmot::Reference> closures = sq.compileFiles(paths, 4);
+  REQUIRE(closures.size() == paths.size());
+  REQUIRE(sq.compileFiles(paths, 1).size() == paths.size());
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+
+  for(std::size_t i = 0; i < closures.size(); ++i) {
+    closures[i].push();
+    sq_pushroottable(sq.getVM());
+    REQUIRE(SQ_SUCCEEDED(sq_call(sq.getVM(), 1, SQTrue, SQTrue)));
+    REQUIRE(marmot::stack::get<std::string>(sq.getVM(), -1) == paths[i]);
+    sq_pop(sq.getVM(), 2); // Pop the return value and the closure
+  }
+
+  sq.runString("local sum = 0; foreach(i, v in squares) { assert(v == i * i); sum += v; } result <- sum;");
+  REQUIRE(sq["result"].get<int>() == 4324);
+
+  {
+    std::ofstream out(paths[7], std::ios::binary);
+    out << "local x = ;";
+  }
+
+  REQUIRE_THROWS_AS(sq.compileFiles(paths, 4), const marmot::MarmotError &);
+  REQUIRE_THROWS_AS(sq.compileFiles({ "marmot-test-parallel-missing.nut" }), const marmot::MarmotError &);
+  REQUIRE(sq_gettop(sq.getVM()) == top);
+
+  for(const auto & path : paths) {
+    std::remove(path.c_str());
+  }
+}
+
+TEST_CASE( "State compiles each file with its own constants", "[marmot::State]" ) {
+  const std::vector<std::string> paths = { "marmot-test-consts-a.nut", "marmot-test-consts-b.nut" };
+
+  {
+    std::ofstream a(paths[0], std::ios::binary);
+    a << "const K = 1;\nenum E { V = 3 }\nreturn K + E.V;";
+    std::ofstream b(paths[1], std::ios::binary);
+    b << "return K;";
+  }
+
+  marmot::State sq;
+  sq.runString("K <- 2;");
+
+  // A single worker compiles both files, one after the other
+  std::vector<marmot::Reference> closures = sq.compileFiles(paths, 1);
+  std::vector<int> results;
+
+  for(auto & closure : closures) {
+    closure.push();
+    sq_pushroottable(sq.getVM());
+    REQUIRE(SQ_SUCCEEDED(sq_call(sq.getVM(), 1, SQTrue, SQTrue)));
+    results.push_back(marmot::stack::get<int>(sq.getVM(), -1));
+    sq_pop(sq.getVM(), 2); // Pop the return value and the closure
+  }
+
+  REQUIRE(results[0] == 4);
+  REQUIRE(results[1] == 2);
+
+  for(const auto & path : paths) {
+    std::remove(path.c_str());
+  }
+}
+
+TEST_CASE( "State compiles files against a copy of its own constants", "[marmot::State]" ) {
+  const std::vector<std::string> paths = { "marmot-test-host-consts.nut" };
+
+  {
+    std::ofstream file(paths[0], std::ios::binary);
+    file << "return LIMIT + Color.Blue + NAME.len();";
+  }
+
+  marmot::State sq;
+  sq.getConstTable().set("LIMIT", 40);
+  sq.getConstTable().set("NAME", "abc");
+  sq.runString("enum Color { Red, Blue }");
+
+  std::vector<marmot::Reference> closures = sq.compileFiles(paths, 2);
+
+  // The constants are inlined, so changing them afterwards makes no difference
+  sq.getConstTable().set("LIMIT", 0);
+
+  closures[0].push();
+  sq_pushroottable(sq.getVM());
+  REQUIRE(SQ_SUCCEEDED(sq_call(sq.getVM(), 1, SQTrue, SQTrue)));
+  REQUIRE(marmot::stack::get<int>(sq.getVM(), -1) == 44);
+  sq_pop(sq.getVM(), 2); // Pop the return value and the closure
+
+  std::remove(paths[0].c_str());
+}
+
+TEST_CASE( "State reports string table statistics", "[marmot::State]" ) {
+  marmot::State sq;
+  const SQStringTableStats before = sq.stringTableStats();
+
+  REQUIRE(before.strings > 0u);
+  REQUIRE(before.usedslots <= before.slots);
+  REQUIRE((before.slots & (before.slots - 1)) == 0u);
+
+  sq.runString(
+    "keys <- [];"
+    "for(local i = 0; i < 2000; i++) {"
+    "  keys.append(\"https://example.com/generated/keys/with/a/long/shared/prefix/\" + i + \"/and/a/long/shared/suffix.json\");"
+    "}");
+
+  const SQStringTableStats after = sq.stringTableStats();
+
+  REQUIRE(after.strings >= before.strings + 2000);
+  REQUIRE(after.strings <= after.slots);
+  REQUIRE(after.usedslots <= after.slots);
+  REQUIRE(after.longestchain >= 1u);
+
+#ifdef SQ_FULL_STRING_HASH
+  REQUIRE(after.longestchain <= 8);
+#endif
+}